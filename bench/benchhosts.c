@@ -0,0 +1,267 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+/**
+ * Host parsing benchmark.
+ *
+ * Generates a cache file of hosts shaped like the L2DM-LLDP template, checks that the json-c path and the raw scanner
+ * give the same hosts, and times either path. Each path is timed in a process of its own so that the peak RSS is its own.
+ * usage: benchhosts gen FILE HOSTS PORTS
+ *        benchhosts compare FILE
+ *        benchhosts {jsonc|scan} FILE [RUNS]
+ * */
+
+/**
+ * \file benchhosts.c
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "json_tokener.h"
+#include "json_object.h"
+#include "zconn.h"
+
+int g_zDebugMode = 0; // GLOBAL debug mode, as in main.c
+
+struct hostCol zconnParseHosts(json_object *jhosts, int threads); // zconn.c. The json-c path used for hosts from the API.
+
+/**
+ * Item name endings of a linked device, with the key name each has in the template.
+ * */
+static const char *remoteItems[][2] = {{"chassis.id", "Chassis Info"}, {"chassis.type", "Chassis Info Type"},
+                                       {"port.id", "Interface Info"}, {"port.type", "Interface Info Type"},
+                                       {"port.desc", "Interface Descr"}, {"sys.desc", "Host Descr"},
+                                       {"sysname", "Host"}};
+
+/**
+ * Seconds since an arbitrary point, for timing.
+ * */
+static double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Write a cache file of hosts, each with PORTS linked devices of 7 items and its own chassis and system description items.
+ * Every 100th host has escapes in its name and system description, so that the comparison covers string decoding.
+ * @return      0 if success, 1 if the file could not be written.
+ * */
+static int benchGenerate(char *fileName, int hostCount, int ports)
+{
+    int h, k, p;
+    FILE *fp = fopen(fileName, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "Could not open %s for writing\n", fileName);
+        return 1;
+    }
+
+    fputc('[', fp);
+    for (h = 0; h < hostCount; h++)
+    {
+        const char *escaped = (h % 100 == 0) ? "\\\"\\u00e9\\\\" : "";
+        fprintf(fp, "%s{\"hostid\":\"%i\",\"host\":\"sw%i%s\",\"interfaces\":[{\"interfaceid\":\"%i\",\"ip\":\"10.%i.%i.1\"}],\"items\":[",
+                (h > 0) ? "," : "", h + 1, h, escaped, h + 1, h / 256, h % 256);
+        fprintf(fp, "{\"itemid\":\"%i\",\"key_\":\"SNMP-Chassis-Id\",\"name\":\"Chassis Id\",\"lastvalue\":\"00:11:22:%02x:%02x:%02x\","
+                    "\"lastclock\":\"1700000000\",\"value_type\":\"1\"},",
+                h * 1000, (h >> 16) & 255, (h >> 8) & 255, h & 255);
+        fprintf(fp, "{\"itemid\":\"%i\",\"key_\":\"SNMP-Chassis-Id-Type\",\"name\":\"Chassis Id Type\",\"lastvalue\":\"4\","
+                    "\"lastclock\":\"1700000000\",\"value_type\":\"3\"},",
+                h * 1000 + 1);
+        fprintf(fp, "{\"itemid\":\"%i\",\"key_\":\"system.descr[sysDescr.0]\",\"name\":\"System description\",\"lastvalue\":\"Switch %s model\","
+                    "\"lastclock\":\"1700000000\",\"value_type\":\"1\"}",
+                h * 1000 + 2, escaped);
+        for (p = 1; p <= ports; p++)
+        {
+            int n = (h + p) % hostCount; // the neighbour on this port
+            for (k = 0; k < 7; k++)
+            {
+                fprintf(fp, ",{\"itemid\":\"%i\",\"key_\":\"lldp.rem.%s[10.%i.%i.1,public,%i,%i,0]\",\"name\":\"[Port - Gi1/0/%i] - [MSAP %i] - [ Connect to ] %s\",",
+                        h * 1000 + 100 + p * 7 + k, remoteItems[k][0], h / 256, h % 256, p, p, p, p, remoteItems[k][1]);
+                if (k == 0)
+                    fprintf(fp, "\"lastvalue\":\"00:11:22:%02x:%02x:%02x\",", (n >> 16) & 255, (n >> 8) & 255, n & 255);
+                else if (k == 2)
+                    fprintf(fp, "\"lastvalue\":\"Gi1/0/%i\",", p);
+                else if (k == 6)
+                    fprintf(fp, "\"lastvalue\":\"sw%i\",", n);
+                else
+                    fprintf(fp, "\"lastvalue\":\"%s\",", (k % 2) ? "4" : "uplink");
+                fprintf(fp, "\"lastclock\":\"1700000000\",\"value_type\":\"1\"}");
+            }
+        }
+        fputs("]}", fp);
+    }
+    fputs("]\n", fp);
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * Read hosts through json-c, as hosts from the API are read when they are joined: the file is fed to the tokener a
+ * buffer at a time, then the tree is parsed into hosts.
+ * */
+static struct hostCol benchReadJsonc(char *fileName, int threads)
+{
+    struct hostCol ret = {0, NULL, NULL};
+    char buffer[65536];
+    size_t len;
+    json_object *jobj = NULL;
+    enum json_tokener_error jerr = json_tokener_continue;
+    struct json_tokener *tok = json_tokener_new();
+    FILE *fp = fopen(fileName, "r");
+
+    if (!fp || !tok)
+    {
+        if (fp)
+            fclose(fp);
+        if (tok)
+            json_tokener_free(tok);
+        return ret;
+    }
+    while (!jobj && jerr == json_tokener_continue && (len = fread(buffer, 1, sizeof buffer, fp)) > 0)
+    {
+        jobj = json_tokener_parse_ex(tok, buffer, len);
+        jerr = json_tokener_get_error(tok);
+    }
+    fclose(fp);
+    if (!jobj && jerr == json_tokener_continue)
+        jobj = json_tokener_parse_ex(tok, "", 1);
+    json_tokener_free(tok);
+
+    if (jobj)
+        ret = zconnParseHosts(jobj, threads);
+    json_object_put(jobj);
+    return ret;
+}
+
+/**
+ * Compare two linked devices field by field.
+ * @return      1 if the same, 0 if not.
+ * */
+static int benchSameDevice(struct linkedDevice *a, struct linkedDevice *b)
+{
+    return a->msap == b->msap && a->locPortName == b->locPortName && a->remChassisId == b->remChassisId &&
+           a->remChassisIdType == b->remChassisIdType && a->remHostName == b->remHostName && a->remHostDesc == b->remHostDesc &&
+           a->remPortId == b->remPortId && a->remPortIdType == b->remPortIdType && a->remPortDesc == b->remPortDesc;
+}
+
+/**
+ * Parse the file through json-c and through the raw scanner and compare the hosts field by field.
+ * Strings are interned, so equal strings have equal handles.
+ * @return      0 if the hosts are the same, 1 if not.
+ * */
+static int benchCompare(char *fileName)
+{
+    int i, j;
+    int differ = 0;
+    struct hostCol a = benchReadJsonc(fileName, 1);
+    struct hostCol b = zconnGetHostsFromFile(fileName, 2);
+
+    if (a.count != b.count)
+    {
+        printf("json-c %i hosts, scan %i hosts\n", a.count, b.count);
+        differ++;
+    }
+    for (i = 0; i < a.count && i < b.count && differ < 20; i++)
+    {
+        struct host *x = &a.hosts[i];
+        struct host *y = &b.hosts[i];
+        if (x->id != y->id || x->zabbixId != y->zabbixId || x->name != y->name || x->sysDesc != y->sysDesc ||
+            x->chassisId != y->chassisId || x->chassisIdType != y->chassisIdType ||
+            x->interfaceCount != y->interfaceCount || x->devicesCount != y->devicesCount)
+        {
+            printf("host %i differs: '%s' / '%s'\n", i, zstrGet(x->name), zstrGet(y->name));
+            differ++;
+            continue;
+        }
+        for (j = 0; j < x->interfaceCount; j++)
+        {
+            if (memcmp(&x->interfaces[j], &y->interfaces[j], sizeof x->interfaces[j]) != 0)
+            {
+                printf("host %i interface %i differs\n", i, j);
+                differ++;
+            }
+        }
+        for (j = 0; j < x->devicesCount; j++)
+        {
+            if (!benchSameDevice(&x->linkedDevices[j], &y->linkedDevices[j]))
+            {
+                printf("host %i linked device %i differs\n", i, j);
+                differ++;
+            }
+        }
+    }
+    printf("%i hosts, %i differences\n", a.count, differ);
+    if (a.count == 0)
+        differ++;
+    freeHostCol(&a);
+    freeHostCol(&b);
+    return (differ > 0) ? 1 : 0;
+}
+
+/**
+ * Time parsing the file on one thread, best of a number of runs.
+ * @return      0 if success, 1 if no hosts were parsed.
+ * */
+static int benchTime(char *mode, char *fileName, int runs)
+{
+    int i, r;
+    int count = 0;
+    long check = 0; // sum of a few fields, so that both paths can be seen to do the same work
+    double best = 0.0;
+    struct rusage ru;
+
+    for (r = 0; r < runs; r++)
+    {
+        double start = benchNow();
+        struct hostCol hosts = (strcmp(mode, "jsonc") == 0) ? benchReadJsonc(fileName, 1) : zconnGetHostsFromFile(fileName, 1);
+        double seconds = benchNow() - start;
+        if (r == 0 || seconds < best)
+            best = seconds;
+        count = hosts.count;
+        check = 0;
+        for (i = 0; i < hosts.count; i++)
+            check += hosts.hosts[i].id + hosts.hosts[i].devicesCount + hosts.hosts[i].interfaceCount;
+        freeHostCol(&hosts);
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%-6s %i hosts  best of %i %.3fs  peak RSS %li KB  check %li\n", mode, count, runs, best, ru.ru_maxrss, check);
+    return (count > 0) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 5 && strcmp(argv[1], "gen") == 0)
+        return benchGenerate(argv[2], atoi(argv[3]), atoi(argv[4]));
+    if (argc >= 3 && strcmp(argv[1], "compare") == 0)
+        return benchCompare(argv[2]);
+    if (argc >= 3 && (strcmp(argv[1], "jsonc") == 0 || strcmp(argv[1], "scan") == 0))
+        return benchTime(argv[1], argv[2], (argc > 3) ? atoi(argv[3]) : 5);
+
+    fprintf(stderr, "usage: benchhosts gen FILE HOSTS PORTS\n"
+                    "       benchhosts compare FILE\n"
+                    "       benchhosts {jsonc|scan} FILE [RUNS]\n");
+    return 1;
+}
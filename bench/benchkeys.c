@@ -0,0 +1,156 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+/**
+ * Item key classifier benchmark.
+ *
+ * Generates item names and keys shaped like the L2DM-LLDP template, checks that classifyItemKey agrees with
+ * classifyItemName and times the key classifier against the name classifier.
+ * See benchnames.c for the name classifier against the instr() chains it replaced.
+ * usage: benchkeys [ITEMS]
+ * */
+
+/**
+ * \file benchkeys.c
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zitem.h"
+
+/**
+ * Item name endings of a linked device, with the key name each has in the template.
+ * */
+static const char *remoteItems[][2] = {{"chassis.id", "Chassis Info"}, {"chassis.type", "Chassis Info Type"},
+                                       {"port.id", "Interface Info"}, {"port.type", "Interface Info Type"},
+                                       {"port.desc", "Interface Descr"}, {"sys.desc", "Host Descr"},
+                                       {"sysname", "Host"}};
+
+/**
+ * Seconds since an arbitrary point, for timing.
+ * */
+static double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Generate an item: 14 in 15 belong to a linked device, the rest are the host's own chassis and system description items.
+ * @param [out] name    buffer for the item name.
+ * @param [out] key     buffer for the item key.
+ * @param [in] size     size of each buffer.
+ * */
+static void benchItem(char *name, char *key, size_t size)
+{
+    int r = rand() % 75;
+    if (r < 70)
+    {
+        int k = r % 7;
+        int port = rand() % 48 + 1;
+        int msap = rand() % 400 + 1;
+        snprintf(name, size, "[Port - GigabitEthernet1/0/%i] - [MSAP %i] - [ Connect to ] %s", port, msap, remoteItems[k][1]);
+        snprintf(key, size, "lldp.rem.%s[10.%i.%i.%i,public,%i,%i%s]", remoteItems[k][0], rand() % 255, rand() % 255, rand() % 255,
+                 port, msap, (k == 4 || k == 5) ? "" : ",0");
+    }
+    else if (r < 72)
+    {
+        snprintf(name, size, "Chassis Id");
+        snprintf(key, size, "SNMP-Chassis-Id");
+    }
+    else if (r < 74)
+    {
+        snprintf(name, size, "Chassis Id Type");
+        snprintf(key, size, "SNMP-Chassis-Id-Type");
+    }
+    else
+    {
+        snprintf(name, size, "System description");
+        snprintf(key, size, "system.descr[sysDescr.0]");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int i, run;
+    int differ = 0;
+    char nameTmp[300];
+    char keyTmp[300];
+    struct itemClass a, b;
+    volatile long sink = 0; // keeps the classifications from being optimised away
+    const char *runs[] = {"name", "key", "key + port name"};
+
+    char **names = malloc(count * sizeof *names);
+    char **keys = malloc(count * sizeof *keys);
+    if (count <= 0 || !names || !keys)
+    {
+        fprintf(stderr, "usage: benchkeys [ITEMS]\n");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++)
+    {
+        benchItem(nameTmp, keyTmp, sizeof nameTmp);
+        names[i] = strdup(nameTmp);
+        keys[i] = strdup(keyTmp);
+    }
+
+    // Both classifiers must agree before the times mean anything.
+    for (i = 0; i < count; i++)
+    {
+        classifyItemName(names[i], &a);
+        if (!classifyItemKey(keys[i], &b) || a.msap != b.msap || a.field != b.field)
+        {
+            if (differ++ < 5)
+                printf("key and name differ: %s | %s\n", keys[i], names[i]);
+        }
+    }
+    printf("%i items, %i differ\n", count, differ);
+
+    for (run = 0; run < 3; run++)
+    {
+        double start = benchNow();
+        for (i = 0; i < count; i++)
+        {
+            if (run == 0)
+                classifyItemName(names[i], &a);
+            else if (run == 1)
+                classifyItemKey(keys[i], &a);
+            else if (classifyItemKey(keys[i], &a) && a.msap > 0)
+                findItemPort(names[i], &a);
+            sink += a.msap + a.field;
+        }
+        double seconds = benchNow() - start;
+        printf("%-16s %.3fs  %.1f ns/item\n", runs[run], seconds, seconds * 1e9 / count);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        free(names[i]);
+        free(keys[i]);
+    }
+    free(names);
+    free(keys);
+    return (differ > 0) ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+/**
+ * Item name classifier benchmark.
+ *
+ * Generates item names shaped like the L2DM-LLDP template, checks that classifyItemName agrees with the instr() chains
+ * it replaced and times both.
+ * usage: benchnames [ITEMS]
+ * */
+
+/**
+ * \file benchnames.c
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zitem.h"
+
+/**
+ * Item name endings of a linked device.
+ * */
+static const char *remoteItems[] = {"Chassis Info", "Chassis Info Type", "Interface Info", "Interface Info Type",
+                                    "Interface Descr", "Host Descr", "Host"};
+
+/**
+ * Seconds since an arbitrary point, for timing.
+ * */
+static double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Find a string in another, as zconnParseHosts did before zitem.
+ * Kept as it was, including that it restarts without looking at the character again after a partial match.
+ * @return      position of tofind in findin or -1 if not found.
+ * */
+static int legacyInstr(char *tofind, char *findin, unsigned int start)
+{
+    int i, j;
+    if (start > strlen(findin) - 1)
+        return -1;
+    for (i = start, j = 0; findin[i] != '\0' && tofind[j] != '\0'; i++)
+    {
+        if (findin[i] == tofind[j])
+            j++;
+        else
+            j = 0;
+    }
+    if (j == 0)
+        return -1;
+    else if (tofind[j] == '\0')
+        return i - j;
+    return -1;
+}
+
+/**
+ * Classify an item name as zconnParseHosts did before zitem: copy the name and search it for each key word in turn.
+ * @param [in] name     item name.
+ * @param [out] ic      classification of the item. The port points into port.
+ * @param [out] port    buffer of 256 characters the port name is copied to.
+ * */
+static void legacyClassifyItemName(const char *name, struct itemClass *ic, char *port)
+{
+    char itemName[256];
+    char strTmp[256];
+    int strStart, strEnd;
+
+    memset(itemName, 0, sizeof itemName);
+    strcpy(itemName, name);
+    ic->msap = 0;
+    ic->port = NULL;
+    ic->portLen = 0;
+    ic->field = itemField_None;
+
+    strStart = legacyInstr("[MSAP", itemName, 0);
+    strEnd = legacyInstr("]", itemName, strStart);
+    if (strStart > -1 && strEnd >= strStart + 6)
+    {
+        strStart += 6;
+        memset(strTmp, 0, sizeof strTmp);
+        memcpy(strTmp, &itemName[strStart], strEnd - strStart);
+        ic->msap = atoi(strTmp);
+    }
+
+    if (ic->msap > 0)
+    {
+        strStart = legacyInstr("[Port - ", itemName, 0);
+        strEnd = legacyInstr("]", itemName, strStart);
+        if (strStart > -1 && strEnd >= strStart + 8)
+        {
+            strStart += 8;
+            memcpy(port, &itemName[strStart], strEnd - strStart);
+            port[strEnd - strStart] = '\0';
+            ic->port = port;
+            ic->portLen = strEnd - strStart;
+        }
+        if (legacyInstr("Chassis Info Type", itemName, 0) > -1)
+            ic->field = itemField_RemChassisIdType;
+        else if (legacyInstr("Chassis Info", itemName, 0) > -1)
+            ic->field = itemField_RemChassisId;
+        else if (legacyInstr("Host Desc", itemName, 0) > -1)
+            ic->field = itemField_RemHostDesc;
+        else if (legacyInstr("Host", itemName, 0) > -1)
+            ic->field = itemField_RemHostName;
+        else if (legacyInstr("Interface Info Type", itemName, 0) > -1)
+            ic->field = itemField_RemPortIdType;
+        else if (legacyInstr("Interface Info", itemName, 0) > -1)
+            ic->field = itemField_RemPortId;
+        else if (legacyInstr("Interface Desc", itemName, 0) > -1)
+            ic->field = itemField_RemPortDesc;
+    }
+    else
+    {
+        if (legacyInstr("Chassis Id Type", itemName, 0) > -1)
+            ic->field = itemField_ChassisIdType;
+        else if (legacyInstr("Chassis Id", itemName, 0) > -1)
+            ic->field = itemField_ChassisId;
+        else if (legacyInstr("System description", itemName, 0) > -1)
+            ic->field = itemField_SysDesc;
+    }
+}
+
+/**
+ * Generate an item name: 14 in 15 belong to a linked device, the rest are the host's own chassis and system description items.
+ * @param [out] name    buffer for the item name.
+ * @param [in] size     size of the buffer.
+ * */
+static void benchItemName(char *name, size_t size)
+{
+    int r = rand() % 75;
+    if (r < 70)
+        snprintf(name, size, "[Port - GigabitEthernet1/0/%i] - [MSAP %i] - [ Connect to ] %s", rand() % 48 + 1, rand() % 400 + 1,
+                 remoteItems[r % 7]);
+    else if (r < 72)
+        snprintf(name, size, "Chassis Id");
+    else if (r < 74)
+        snprintf(name, size, "Chassis Id Type");
+    else
+        snprintf(name, size, "System description");
+}
+
+int main(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int i, run;
+    int differ = 0;
+    char nameTmp[300];
+    char port[256];
+    struct itemClass a, b;
+    volatile long sink = 0; // keeps the classifications from being optimised away
+    const char *runs[] = {"name (instr)", "name"};
+
+    char **names = malloc(count * sizeof *names);
+    if (count <= 0 || !names)
+    {
+        fprintf(stderr, "usage: benchnames [ITEMS]\n");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++)
+    {
+        benchItemName(nameTmp, sizeof nameTmp);
+        names[i] = strdup(nameTmp);
+    }
+
+    // Both classifiers must agree before the times mean anything.
+    for (i = 0; i < count; i++)
+    {
+        classifyItemName(names[i], &a);
+        legacyClassifyItemName(names[i], &b, port);
+        if (a.msap != b.msap || a.field != b.field || a.portLen != b.portLen || (a.port && strncmp(a.port, b.port, a.portLen) != 0))
+        {
+            if (differ++ < 5)
+                printf("name classifiers differ: %s\n", names[i]);
+        }
+    }
+    printf("%i items, %i differ\n", count, differ);
+
+    for (run = 0; run < 2; run++)
+    {
+        double start = benchNow();
+        for (i = 0; i < count; i++)
+        {
+            if (run == 0)
+                legacyClassifyItemName(names[i], &a, port);
+            else
+                classifyItemName(names[i], &a);
+            sink += a.msap + a.field;
+        }
+        double seconds = benchNow() - start;
+        printf("%-16s %.3fs  %.1f ns/item\n", runs[run], seconds, seconds * 1e9 / count);
+    }
+
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    return (differ > 0) ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#!/bin/sh
+#######################################################################
+#
+# Copyright (C) 2021 Craig Moore
+#
+# This file is part of zabbix-map.
+#
+# zabbix-map is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# zabbix-map is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+#######################################################################
+
+# Checks zabbix-map against the stand-in API in zabbixstub.py:
+#  - an incremental run after the network changes gives the same map and cache as a full run;
+#  - a run replayed from recorded responses makes no API calls and gives the same hosts.
+# Extra arguments are passed to every zabbix-map run, e.g. -pagesize 5 or -narrow 0.
+# The stub's environment options (HUBS, LATE, RENAME, ...) are passed through.
+# usage: bench/stubcheck.sh [SWITCHES [FILLER]] [-- zabbix-map options]
+# The binary run is ./zabbix-map, or $ZBIN. Needs python3 and curl.
+
+N=50; F=5
+[ $# -gt 0 ] && [ "$1" != "--" ] && { N=$1; shift; }
+[ $# -gt 0 ] && [ "$1" != "--" ] && { F=$1; shift; }
+[ "$1" = "--" ] && shift
+
+BIN=${ZBIN:-./zabbix-map}
+DIR=$(dirname "$0")
+PORT=${PORT:-8099}
+URL=http://127.0.0.1:$PORT
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/stubcheck.XXXXXX")
+PID=
+FAILED=0
+
+stop() {
+    [ -n "$PID" ] && kill $PID 2>/dev/null && wait $PID 2>/dev/null
+    PID=
+}
+start() {
+    stop
+    python3 "$DIR/zabbixstub.py" $PORT $N $F > "$TMP/stub.log" 2>&1 &
+    PID=$!
+    until curl -s $URL/ > /dev/null; do sleep 0.2; done
+}
+run() {
+    "$BIN" -ep $URL/api_jsonrpc.php -map stubcheck "$@" > "$TMP/run.log" 2>&1 || { echo "zabbix-map failed:"; cat "$TMP/run.log"; FAILED=1; }
+}
+# The map sent to the stub, without the element and link IDs, which differ from run to run.
+maps() {
+    curl -s $URL/maps | python3 -c "
+import json, sys
+for m in json.load(sys.stdin).values():
+    labels = {s['selementid']: s['label'] for s in m['selements']}
+    elements = sorted((s['label'], s['x'], s['y'], s['elementtype']) for s in m['selements'])
+    links = sorted(tuple(sorted((labels[l['selementid1']], labels[l['selementid2']]))) + (l.get('label', ''),) for l in m['links'])
+    json.dump({'name': m['name'], 'w': m['width'], 'h': m['height'], 'elements': elements, 'links': links}, sys.stdout, indent=0)
+" > "$1"
+}
+# The hosts in a cache file, in host ID order.
+hosts() {
+    python3 -c "
+import json, sys
+hosts = json.load(open(sys.argv[1]))
+print(json.dumps(sorted((h['hostid'], h['host'], h['interfaces'], sorted(h['items'], key=lambda i: i['itemid'])) for h in hosts), sort_keys=True))
+" "$1" > "$2"
+}
+same() {
+    if [ -s "$2" ] && cmp -s "$2" "$3"; then echo "$1: same"; else echo "$1: DIFFERS"; FAILED=1; fi
+}
+
+trap 'stop; rm -rf "$TMP"' EXIT INT TERM
+
+# Incremental against full
+start
+run -cache "$TMP/cache.json" "$@"
+sleep 1.2 # so that values changed below are stamped after the cache was written
+curl -s $URL/mutate > /dev/null
+curl -s $URL/reset > /dev/null
+run -cache "$TMP/cache.json" -incr 1 "$@"
+echo "incremental run: $(curl -s $URL/)"
+maps "$TMP/incr.map"; hosts "$TMP/cache.json" "$TMP/incr.hosts"
+curl -s $URL/reset > /dev/null
+run -cache "$TMP/cache.json" "$@"
+echo "full run:        $(curl -s $URL/)"
+maps "$TMP/full.map"; hosts "$TMP/cache.json" "$TMP/full.hosts"
+same "incremental map" "$TMP/incr.map" "$TMP/full.map"
+same "incremental cache" "$TMP/incr.hosts" "$TMP/full.hosts"
+
+# Record and replay
+mkdir "$TMP/fixtures"
+start
+run -record "$TMP/fixtures" -cache "$TMP/recorded.json" "$@"
+hosts "$TMP/recorded.json" "$TMP/recorded.hosts"
+start
+run -replay "$TMP/fixtures" -cache "$TMP/replayed.json" "$@"
+curl -s $URL/ | grep -q '"posts": 0,' || { echo "replayed run called the API"; FAILED=1; }
+hosts "$TMP/replayed.json" "$TMP/replayed.hosts"
+same "replayed cache" "$TMP/recorded.hosts" "$TMP/replayed.hosts"
+
+exit $FAILED
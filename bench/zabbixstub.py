@@ -0,0 +1,383 @@
+#!/usr/bin/env python3
+#######################################################################
+#
+# Copyright (C) 2021 Craig Moore
+#
+# This file is part of zabbix-map.
+#
+# zabbix-map is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# zabbix-map is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+#######################################################################
+
+"""Stand-in Zabbix API for trying zabbix-map without a Zabbix server.
+
+Serves a generated network of switches shaped like the L2DM-LLDP template: switch i is linked to switch (i-1)//3 and
+its children, and each switch has one unmanaged neighbour (a pseudo host). It answers the calls zabbix-map makes,
+keeps the maps it is sent in memory, and counts connections, requests and calls so runs can be compared.
+
+usage: zabbixstub.py [PORT [SWITCHES [FILLER [FIRST [IDBASE [LAST [ROTATE]]]]]]]
+    PORT        port listened on, on 127.0.0.1. default 8099.
+    SWITCHES    switches in the network. default 50.
+    FILLER      items per switch not used by the mapper. default 5.
+    FIRST, LAST the switches this server monitors, [FIRST, LAST), to stand in for one of several servers. default all.
+    IDBASE      host ID of switch 0. default 10000.
+    ROTATE      hosts are returned starting from this one. default 0.
+
+Environment:
+    HUBS=1      every 5th switch has two more unmanaged neighbours on its first port (a pseudo hub).
+    PW          password accepted by user.login. default zabbix.
+    TOKEN       API token accepted as a bearer header.
+    SLOW=S      host.get and item.get take S seconds. RAMP=1 makes each one take S longer than the last.
+    FAILHOST=1  host.get fails.
+    LATE=1      /mutate also gives an item a value stamped before the last run, as a proxy sending late would.
+    RENAME=1    /mutate also renames and readdresses a host, without new values, and renames an item with a new value.
+
+GET paths:
+    /           the counts as JSON.     /maps       the maps sent, as JSON.
+    /reset      zero the counts.        /expire     end every session.
+    /mutate     change the network: a link moves, the last switch goes, a switch gains a neighbour and a switch is added.
+    /flaky?every=N&code=C[&after=S]     refuse every Nth POST with HTTP code C, with Retry-After S if given.
+
+e.g. python3 bench/zabbixstub.py 8099 200 &
+     ./zabbix-map -ep http://127.0.0.1:8099/api_jsonrpc.php -map test -debug true
+"""
+
+import fnmatch
+import gzip
+import json
+import os
+import sys
+import threading
+import time
+import uuid
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+ARGS = [int(a) for a in sys.argv[1:]]
+PORT = ARGS[0] if len(ARGS) > 0 else 8099
+N = ARGS[1] if len(ARGS) > 1 else 50
+FILLER = ARGS[2] if len(ARGS) > 2 else 5
+FIRST = ARGS[3] if len(ARGS) > 3 else 0
+IDBASE = ARGS[4] if len(ARGS) > 4 else 10000
+LAST = ARGS[5] if len(ARGS) > 5 else N
+ROTATE = ARGS[6] if len(ARGS) > 6 else 0
+
+STATS = {"conns": 0, "posts": 0, "reqs": 0, "calls": {}}
+MAPS = {}
+NEXT = [100]  # next map, element and link ID
+SESSIONS = set()
+FLAKY = {"every": 0, "code": 503, "after": None, "n": 0}
+TOKEN = os.environ.get("TOKEN", "tok0123456789abcdef0123456789abcdef0123456789abcdef0123456789ab")
+lock = threading.Lock()
+
+
+def mac(i):
+    """Chassis ID of switch i, or of an unmanaged neighbour when i is negative."""
+    if i < 0:
+        return "aa:bb:cc:%02x:%02x:%02x" % ((-i >> 16) & 255, (-i >> 8) & 255, -i & 255)
+    return "00:11:22:%02x:%02x:%02x" % ((i >> 16) & 255, (i >> 8) & 255, i & 255)
+
+
+def ip(i):
+    return "10.0.%d.%d" % (i // 250, i % 250 + 1)
+
+
+def switch(i):
+    """Host i with its interface and items."""
+    hid = IDBASE + i
+    items = []
+
+    def item(name, key, value, valueType, clock="1700000000"):
+        items.append({"itemid": str(hid * 100 + len(items) + 1), "name": name, "key_": key, "lastvalue": str(value),
+                      "value_type": str(valueType), "lastclock": clock})
+
+    def neighbour(port, msap, n, full=True):
+        pre = "[Port - Gi0/%d] - [MSAP %d] - [ Connect to ] " % (port, msap)
+        kp = "%s,public,%d,%d" % (ip(i), port, msap)
+        item(pre + "Chassis Info", "lldp.rem.chassis.id[%s,x]" % kp, mac(n), 1)
+        if full:
+            item(pre + "Chassis Info Type", "lldp.rem.chassis.type[%s,x]" % kp, 4, 3)
+        item(pre + "Interface Info", "lldp.rem.port.id[%s,x]" % kp, "Gi0/%d" % (msap + 10) if full else "eth0", 1)
+        if full:
+            item(pre + "Interface Info Type", "lldp.rem.port.type[%s,x]" % kp, 5, 3)
+            item(pre + "Interface Descr", "lldp.rem.port.desc[%s]" % kp, "uplink", 4)
+            item(pre + "Host Descr", "lldp.rem.sys.desc[%s]" % kp, "desc", 4)
+            item(pre + "Host", "lldp.rem.sysname[%s,x]" % kp, "sw%d" % n, 1)
+
+    item("Chassis Id", "SNMP-Chassis-Id", mac(i), 1)
+    item("Chassis Id Type", "SNMP-Chassis-Id-Type", 4, 3)
+    item("System description", "system.descr[sysDescr.0]", "Switch model %d" % i, 1)
+    neighbours = ([(i - 1) // 3] if i > 0 else []) + [c for c in (3 * i + 1, 3 * i + 2, 3 * i + 3) if c < N] + [-1 - i]
+    for m, n in enumerate(neighbours):
+        neighbour(m + 1, m + 1, n)
+    if os.environ.get("HUBS") and i % 5 == 0:
+        neighbour(1, 90, -100000 - i, False)
+        neighbour(1, 91, -200000 - i, False)
+    for f in range(FILLER):
+        item("[Port - Gi0/%d] - Link Speed" % f, "lldp.loc.if.ifSpeed[%d]" % f, 1000, 3)
+    return {"hostid": str(hid), "host": "sw%d" % i, "interfaces": [{"interfaceid": str(hid), "ip": ip(i)}], "items": items}
+
+
+HOSTS = [switch(i) for i in range(N)][FIRST:LAST]
+HOSTS = HOSTS[ROTATE:] + HOSTS[:ROTATE]
+
+
+def mutate():
+    now = str(int(time.time()))
+    # Switch 1 now sees an unmanaged chassis where it saw switch 0.
+    for x in HOSTS[1]["items"]:
+        if x["key_"].startswith("lldp.rem.chassis.id") and x["lastvalue"] == mac(0):
+            x["lastvalue"] = "aa:bb:cc:dd:ee:01"
+            x["lastclock"] = now
+            break
+    if os.environ.get("LATE"):
+        x = HOSTS[4]["items"][2]
+        x["lastvalue"] = "late value"
+        x["lastclock"] = "1700000005"
+    if os.environ.get("RENAME"):
+        HOSTS[5]["host"] = "renamed5"
+        HOSTS[5]["interfaces"][0]["ip"] = "10.9.9.9"
+        # An item renamed without a new value keeps its old name in an incremental run, so this one gets a new value too.
+        HOSTS[6]["items"][0]["name"] = "Chassis Id (renamed)"
+        HOSTS[6]["items"][0]["lastclock"] = now
+    HOSTS.pop()
+    # Switch 2 gains a neighbour on a new port.
+    h = HOSTS[2]
+    iid = max(int(x["itemid"]) for x in h["items"])
+    pre = "[Port - Gi0/9] - [MSAP 9] - [ Connect to ] "
+    for name, key, value, valueType in (("Chassis Info", "lldp.rem.chassis.id[9]", "aa:bb:cc:dd:ee:02", 1),
+                                        ("Chassis Info Type", "lldp.rem.chassis.type[9]", 4, 3),
+                                        ("Interface Info", "lldp.rem.port.id[9]", "Gi0/19", 1),
+                                        ("Interface Info Type", "lldp.rem.port.type[9]", 5, 3),
+                                        ("Host", "lldp.rem.sysname[9]", "new", 1)):
+        iid += 1
+        h["items"].append({"itemid": str(iid), "name": pre + name, "key_": key, "lastvalue": str(value),
+                           "value_type": str(valueType), "lastclock": now})
+    # A new switch linked to switch 3.
+    hid = 100000
+    pre = "[Port - Gi0/1] - [MSAP 1] - [ Connect to ] "
+    HOSTS.append({"hostid": str(hid), "host": "swnew", "interfaces": [{"interfaceid": str(hid), "ip": "10.0.0.250"}],
+                  "items": [{"itemid": str(hid * 100 + 1), "name": "Chassis Id", "key_": "SNMP-Chassis-Id",
+                             "lastvalue": "00:99:99:99:99:99", "value_type": "1", "lastclock": now},
+                            {"itemid": str(hid * 100 + 2), "name": pre + "Chassis Info", "key_": "lldp.rem.chassis.id[1]",
+                             "lastvalue": mac(3), "value_type": "1", "lastclock": now},
+                            {"itemid": str(hid * 100 + 3), "name": pre + "Host", "key_": "lldp.rem.sysname[1]",
+                             "lastvalue": "sw3", "value_type": "1", "lastclock": now}]})
+
+
+def pick(obj, output):
+    if output == "extend" or output is None:
+        return dict(obj)
+    return {k: obj[k] for k in output if k in obj}
+
+
+def selected(params, hosts):
+    if "hostids" in params:
+        ids = set(str(x) for x in params["hostids"])
+        hosts = [h for h in hosts if h["hostid"] in ids]
+    return hosts
+
+
+def call(method, params, auth, bearer):
+    if os.environ.get("FAILHOST") and method == "host.get":
+        raise Exception("host.get failed")
+    if os.environ.get("SLOW") and method in ("host.get", "item.get"):
+        STATS["slow"] = STATS.get("slow", 0) + 1
+        time.sleep(float(os.environ["SLOW"]) * (STATS["slow"] if os.environ.get("RAMP") else 1))
+
+    if method == "apiinfo.version":
+        return "6.0.0"
+    if method == "user.login":
+        if params.get("password") != os.environ.get("PW", "zabbix"):
+            raise Exception("Incorrect user name or password")
+        sid = uuid.uuid4().hex
+        SESSIONS.add(sid)
+        return sid
+    if method == "user.checkAuthentication":
+        if params.get("sessionid") not in SESSIONS:
+            raise Exception("Session terminated, re-login, please.")
+        return {"userid": "1", "sessionid": params["sessionid"]}
+    if bearer is not None and auth is not None:
+        raise Exception("auth and bearer both given")
+    if bearer != TOKEN and auth not in SESSIONS:
+        raise Exception("Not authorised.")
+
+    if method == "host.get":
+        hosts = selected(params, HOSTS)
+        if params.get("sortfield") == "hostid":
+            hosts = sorted(hosts, key=lambda h: int(h["hostid"]))
+        if "limit" in params:
+            hosts = hosts[:int(params["limit"])]
+        res = []
+        for h in hosts:
+            r = pick(h, params.get("output") if params.get("output") != "extend" else ["hostid", "host"])
+            if "selectInterfaces" in params:
+                r["interfaces"] = [pick(x, params["selectInterfaces"]) for x in h["interfaces"]]
+            if "selectItems" in params:
+                r["items"] = [pick(x, params["selectItems"]) for x in h["items"]]
+            res.append(r)
+        return res
+    if method == "hostinterface.get":
+        return [{"hostid": h["hostid"], "ip": x["ip"], "interfaceid": x["interfaceid"]} for h in HOSTS for x in h["interfaces"]]
+    if method == "item.get":
+        patterns = params.get("search", {}).get("key_", [])
+        if isinstance(patterns, str):
+            patterns = [patterns]
+        itemIds = set(str(y) for y in params["itemids"]) if "itemids" in params else None
+        res = []
+        for h in selected(params, HOSTS):
+            for x in h["items"]:
+                if patterns and not any(fnmatch.fnmatchcase(x["key_"], p if params.get("searchWildcardsEnabled") else "*" + p + "*")
+                                        for p in patterns):
+                    continue
+                if itemIds is not None and x["itemid"] not in itemIds:
+                    continue
+                r = pick(x, params.get("output"))
+                r["hostid"] = h["hostid"]
+                res.append(r)
+        return res
+    if method == "map.get":
+        maps = list(MAPS.values())
+        if "name" in params.get("filter", {}):
+            names = params["filter"]["name"]
+            names = names if isinstance(names, list) else [names]
+            maps = [m for m in maps if m["name"] in names]
+        res = []
+        for m in maps:
+            r = {k: v for k, v in m.items() if k not in ("selements", "links")}
+            if params.get("output") not in (None, "extend"):
+                r = pick(r, params["output"])
+            if "selectSelements" in params:
+                r["selements"] = m["selements"]
+            if "selectLinks" in params:
+                r["links"] = m["links"]
+            res.append(r)
+        return res
+    if method == "map.delete":
+        for i in params:
+            MAPS.pop(str(i), None)
+        return {"sysmapids": [str(i) for i in params]}
+    if method in ("map.create", "map.update"):
+        return saveMap(method, params)
+    raise KeyError(method)
+
+
+def newId():
+    NEXT[0] += 1
+    return str(NEXT[0] - 1)
+
+
+def saveMap(method, params):
+    if method == "map.create":
+        sid = newId()
+        m = {"sysmapid": sid, "name": params["name"], "width": str(params.get("width")), "height": str(params.get("height")),
+             "label_type": str(params.get("label_type", 2)), "selements": [], "links": []}
+        MAPS[sid] = m
+    else:
+        sid = str(params["sysmapid"])
+        m = MAPS[sid]
+        for k in ("name", "width", "height", "label_type"):
+            if k in params:
+                m[k] = str(params[k])
+
+    ref = {}  # element IDs sent, to the IDs they are kept as
+    if "selements" in params:
+        old = {s["selementid"]: s for s in m["selements"]}
+        new = []
+        for s in params["selements"]:
+            o = {k: (str(v) if k in ("x", "y") else v) for k, v in s.items()}
+            if method == "map.update" and s.get("selementid") in old:
+                o = dict(old[s["selementid"]], **o)
+            else:
+                o["selementid"] = newId()
+            ref[s.get("selementid")] = o["selementid"]
+            new.append(o)
+        m["selements"] = new
+    if "links" in params:
+        old = {l["linkid"]: l for l in m["links"]}
+        new = []
+        for l in params["links"]:
+            if l.get("linkid") in old:
+                new.append(dict(old[l["linkid"]], **l))
+            else:
+                new.append(dict(l, linkid=newId(), selementid1=ref.get(l["selementid1"], l["selementid1"]),
+                                selementid2=ref.get(l["selementid2"], l["selementid2"])))
+        m["links"] = new
+    return {"sysmapids": [sid]}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        super().setup()
+        with lock:
+            STATS["conns"] += 1
+
+    def log_message(self, *args):
+        pass
+
+    def reply(self, code, body, headers=()):
+        self.send_response(code)
+        for k, v in headers:
+            self.send_header(k, v)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        with lock:
+            if self.path == "/mutate":
+                mutate()
+            elif self.path == "/reset":
+                STATS.update({"posts": 0, "reqs": 0, "calls": {}})
+            elif self.path == "/expire":
+                SESSIONS.clear()
+            elif self.path.startswith("/flaky?"):
+                q = dict(x.split("=") for x in self.path.split("?")[1].split("&"))
+                FLAKY.update({"every": int(q.get("every", 0)), "code": int(q.get("code", 503)), "after": q.get("after"), "n": 0})
+            body = json.dumps(MAPS if self.path == "/maps" else STATS).encode()
+        self.reply(200, body)
+
+    def do_POST(self):
+        raw = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        with lock:
+            STATS["posts"] += 1
+            FLAKY["n"] += 1
+            refuse = FLAKY["every"] > 0 and FLAKY["n"] % FLAKY["every"] == 0
+            if refuse:
+                STATS["refused"] = STATS.get("refused", 0) + 1
+        if refuse:
+            self.reply(FLAKY["code"], b"<html>busy</html>", [("Retry-After", FLAKY["after"])] if FLAKY["after"] else [])
+            return
+
+        req = json.loads(raw)
+        bearer = (self.headers.get("Authorization") or "")[len("Bearer "):] or None
+        out = []
+        for r in req if isinstance(req, list) else [req]:
+            with lock:
+                STATS["reqs"] += 1
+                STATS["calls"][r["method"]] = STATS["calls"].get(r["method"], 0) + 1
+            try:
+                out.append({"jsonrpc": "2.0", "result": call(r["method"], r.get("params", {}), r.get("auth"), bearer), "id": r.get("id")})
+            except Exception as e:
+                out.append({"jsonrpc": "2.0", "error": {"code": -32602, "message": "Invalid params.", "data": repr(e)}, "id": r.get("id")})
+        body = json.dumps(out if isinstance(req, list) else out[0]).encode()
+        headers = [("Content-Type", "application/json")]
+        if "gzip" in self.headers.get("Accept-Encoding", ""):
+            body = gzip.compress(body)
+            headers.append(("Content-Encoding", "gzip"))
+        self.reply(200, body, headers)
+
+
+if __name__ == "__main__":
+    ThreadingHTTPServer(("127.0.0.1", PORT), Handler).serve_forever()
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <arpa/inet.h>
 
 struct ipRanges *parseIpRanges(char *input);
 char *ui2ip(unsigned int ipAsUInt);
@@ -32,8 +33,9 @@ unsigned int ip2ui(char *ip)
 {
     /* An IP consists of four ranges. */
     long ipAsUInt = 0;
+    char *rPtr; // reentrant version required as hosts can be fetched from several servers at the same time.
     /* Deal with first range. */
-    char *cPtr = strtok(ip, ".");
+    char *cPtr = strtok_r(ip, ".", &rPtr);
     if (cPtr)
         ipAsUInt += atoi(cPtr) * pow(256, 3);
 
@@ -41,7 +43,7 @@ unsigned int ip2ui(char *ip)
     int exponent = 2;
     while (cPtr && exponent >= 0)
     {
-        cPtr = strtok(NULL, ".\0");
+        cPtr = strtok_r(NULL, ".\0", &rPtr);
         if (cPtr)
             ipAsUInt += atoi(cPtr) * pow(256, exponent--);
     }
@@ -91,7 +93,7 @@ int ip2octets(const char *ip, char octets[4][4])
 {
 
     char *token;
-    const char delim[1] = ".";
+    const char delim[2] = ".";
     char ipTmp[strlen(ip) + 1]; // Temp string required to remove const restriction for strtok.
     strcpy(ipTmp, ip);
     token = strtok(ipTmp, delim);
@@ -132,8 +134,8 @@ struct ipRange spreadToIpRange(const char *from, const char *to)
     ret.upper = 0;
 
     // Copy from and to so that they remain immutable
-    char f[strlen(from)];
-    char t[strlen(to)];
+    char f[strlen(from) + 1];
+    char t[strlen(to) + 1];
     strcpy(f, from);
     strcpy(t, to);
 
@@ -144,7 +146,7 @@ struct ipRange spreadToIpRange(const char *from, const char *to)
     char fromTerms[4][4]; // from address as terms
     char toTerms[4][4];   // to address as terms
     char *token;
-    const char delim[1] = ".";
+    const char delim[2] = ".";
     int i = 0;
 
     // Get the tokens 'octets' of the 'From' address
@@ -300,4 +302,56 @@ struct ipRanges *parseIpRanges(char *input)
         ret->n++;
     }
     return ret;
-}
\ No newline at end of file
+}
+
+int ipInRanges(struct ipRanges *ips, unsigned int ip)
+{
+    int i;
+    for (i = 0; i < ips->n; i++)
+    {
+        if (ips->ranges[i].lower <= ip && ips->ranges[i].upper >= ip)
+            return 1;
+    }
+    return 0;
+}
+
+int ipAddrInRanges(struct ipRanges *ips, const struct ipAddr *ip)
+{
+    return ipIsV4(ip) && ipInRanges(ips, ipV4(ip));
+}
+
+int ipParse(const char *str, struct ipAddr *ip)
+{
+    memset(ip, 0, sizeof *ip);
+    if (!str)
+        return 0;
+    if (inet_pton(AF_INET6, str, ip->b) == 1)
+        return 1;
+    if (inet_pton(AF_INET, str, &ip->b[12]) == 1)
+    {
+        // IPv4-mapped
+        ip->b[10] = 0xff;
+        ip->b[11] = 0xff;
+        return 1;
+    }
+    memset(ip, 0, sizeof *ip);
+    return 0;
+}
+
+int ipIsV4(const struct ipAddr *ip)
+{
+    static const unsigned char prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    return memcmp(ip->b, prefix, sizeof prefix) == 0;
+}
+
+unsigned int ipV4(const struct ipAddr *ip)
+{
+    return ((unsigned int)ip->b[12] << 24) | ((unsigned int)ip->b[13] << 16) | ((unsigned int)ip->b[14] << 8) | ip->b[15];
+}
+
+char *ipFormat(const struct ipAddr *ip, char *buf, size_t size)
+{
+    if (!inet_ntop(ipIsV4(ip) ? AF_INET : AF_INET6, ipIsV4(ip) ? &ip->b[12] : ip->b, buf, size) && size > 0)
+        buf[0] = '\0';
+    return buf;
+}
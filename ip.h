@@ -29,12 +29,26 @@
  * \file ip.h
  * */
 
+#include <stddef.h>
+
+#define IP_ADDR_STRLEN 46 // Longest text form of an IP address, with its terminator (INET6_ADDRSTRLEN).
+
 struct ipRange
 {
     unsigned int upper;    // lower part of the range
     unsigned int lower;    // upper part of the range.
 };
 
+/**
+ * An IPv4 or IPv6 address in binary, in network order.
+ * IPv4 addresses are held in their IPv4-mapped IPv6 form (::ffff:a.b.c.d), which tags them as IPv4. So every address takes
+ * the same 16 bytes, and two addresses are equal exactly when their bytes are.
+ * */
+struct ipAddr
+{
+    unsigned char b[16];
+};
+
 struct ipRanges
 {
     int n;                  // number of IP ranges.
@@ -58,4 +72,53 @@ struct ipRanges
 struct ipRanges *parseIpRanges(char *input);
 unsigned int ip2ui(char *ip);
 
+/**
+ * Check whether an IP address is inside any of the given ranges.
+ * @param [in] ips      the IP ranges
+ * @param [in] ip       the IP address as an unsigned int (see ip2ui)
+ * @return              1 if inside one of the ranges, 0 otherwise.
+ * */
+int ipInRanges(struct ipRanges *ips, unsigned int ip);
+
+/**
+ * Check whether an IP address is inside any of the given ranges. The ranges are IPv4, so an IPv6 address is never inside them.
+ * This is the one rule for filtering hosts: a host is kept when one of its interfaces is inside the ranges, so hosts with only
+ * IPv6 addresses, only DNS names or no interfaces are left out by any filter, even 0.0.0.0/0. To keep every host, do not filter at all.
+ * @param [in] ips      the IP ranges
+ * @param [in] ip       the IP address
+ * @return              1 if inside one of the ranges, 0 otherwise.
+ * */
+int ipAddrInRanges(struct ipRanges *ips, const struct ipAddr *ip);
+
+/**
+ * Parse an IPv4 or IPv6 address with inet_pton.
+ * @param [in] str      the address. E.g. "192.168.4.1" or "fe80::1". May be NULL.
+ * @param [out] ip      set to the address in binary.
+ * @return              1 if success, 0 if the string is not an IP address.
+ * */
+int ipParse(const char *str, struct ipAddr *ip);
+
+/**
+ * Check whether an IP address is IPv4.
+ * @param [in] ip       the IP address
+ * @return              1 if IPv4, 0 if IPv6.
+ * */
+int ipIsV4(const struct ipAddr *ip);
+
+/**
+ * Get an IPv4 address as an unsigned int, as ip2ui gives.
+ * @param [in] ip       the IP address. Must be IPv4 (see ipIsV4).
+ * @return              the IP address as an unsigned int.
+ * */
+unsigned int ipV4(const struct ipAddr *ip);
+
+/**
+ * Format an IP address as text, dotted for IPv4 and colon separated for IPv6.
+ * @param [in] ip       the IP address
+ * @param [out] buf     buffer for the text. IP_ADDR_STRLEN characters is enough for any address.
+ * @param [in] size     size of the buffer
+ * @return              buf
+ * */
+char *ipFormat(const struct ipAddr *ip, char *buf, size_t size);
+
 #endif
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "zmap.h"
 #include "zconn.h"
 #include "Forests.h"
@@ -33,31 +34,67 @@ struct methodCol
     enum sortMethods *sm; // Array of sort methods;
 };
 
+#define MAX_SERVERS 16 // Zabbix servers that can be federated into a single map.
+
+struct server
+{
+    struct zconnCtx *zc;  // client context for the server
+    char *user;           // user name used for the server
+    char *pw;             // password of the user
+    char cache[268];      // cache file of the hosts from the server. Empty if not cached.
+    int fromApi;          // 1 to get the hosts from the API. 0 to authenticate only, the hosts being read from the cache file.
+    int authKey;          // 0 if authentication failed
+    struct hostCol hosts; // hosts from the server
+    pthread_t thread;     // thread getting the hosts from the server
+    int threaded;         // 1 if the thread was started
+};
+
 void showHelp(void);
 struct padding parsePadding(char *s);
 void parseSorts(char *s, struct methodCol *mc);
 void parseSpacing(char *s, double spaces[2]);
+int splitList(char *s, char **items, int max);
+void *fetchHosts(void *arg);
+void freeServers(struct server *servers, int count);
 
 int g_zDebugMode = 0;     // GLOBAL debug mode
 
 int main(int argc, char *argv[])
 {
     char map[80] = "No name map";
-    char ip[255] = "0.0.0.0/0";
+    char ip[255] = "";
     char src[10] = "api";
-    char cache[25] = "";
+    char cache[256] = "";       // cache file. Empty for none.
     char sortStr[30] = "1"; //descendantsDesc
     char padStr[30] = "50.0, 50.0, 50.0, 50.0";
     char nodeSpace[20] = "100.0,100.0";
-    char user[120] = "Admin";
-    char pw[120] = "zabbix";
+    char user[512] = "Admin";
+    char pw[512] = "zabbix";
+    char token[1024] = "";        // API token used in place of the user and password. Repeated for several servers.
+    char session[256] = "";       // file caching sessions between runs. Empty for no cache.
     char debug[6] = "false";
-    char ep[256] = "";   // API End Point
+    char ep[1024] = "";  // API End Point(s). Comma separated for several servers.
+    char target[4] = "1"; // end point the map is published to, counting from 1.
     char out[4] = "api"; // output. api=Zabbix API (map), bmp = bitmap image
     char phubs[2] = "1";          // pseudo hubs 1=true, 0=false.
     char phosts[2] = "1";         // pseudo hosts 1=true, 0=false
     char linklabels[2] = "0";     // labels on links. 1=true, 0=false.
+    char pagesize[10] = "0";      // hosts per host.get page. 0=single call.
+    char parallel[4] = "4";       // host.get pages requested at the same time.
+    char narrow[2] = "1";         // request only the items used by the mapper. 1=true, 0=false.
+    char incr[2] = "0";           // refresh the hosts in the cache file. 1=true, 0=false.
+    char pipeline[4] = "0";       // threads parsing host pages while the rest download. 0=parse after download.
+    char parsers[4] = "0";        // threads parsing the hosts after download. 0=one per core.
+    char rate[128] = "0";         // API calls per second. 0=no limit. Comma separated for several servers.
+    char inflight[128] = "0";     // API calls in flight at the same time. 0=no limit. Comma separated for several servers.
+    char record[256] = "";        // directory API responses are recorded to. Empty to not record.
+    char replay[256] = "";        // directory API responses are replayed from in place of calling the API. Empty to call the API.
     char *cptr = NULL;
+    size_t csize = 0;   // size of the buffer cptr points to
+    char *users[MAX_SERVERS], *pws[MAX_SERVERS], *tokens[MAX_SERVERS]; // each -u, -p and -token given, verbatim, pairing with the end points in order
+    int userCount = 0, pwCount = 0, tokenCount = 0;
+    char **lptr = NULL; // list the value of a repeatable parameter is added to
+    int *lcount = NULL;
     int h = 0; // show help.
     int i, j, k;
 
@@ -67,36 +104,153 @@ int main(int argc, char *argv[])
         if (i % 2 != 0)
         {
             // Parameter names
+            lptr = NULL;
             if (strcmp(argv[i], "-map") == 0)
+            {
                 cptr = &map[0];
+                csize = sizeof map;
+            }
             else if (strncmp(argv[i], "-ip", 255) == 0)
+            {
                 cptr = &ip[0];
+                csize = sizeof ip;
+            }
             else if (strcmp(argv[i], "-src") == 0)
+            {
                 cptr = &src[0];
+                csize = sizeof src;
+            }
             else if (strcmp(argv[i], "-cache") == 0)
+            {
                 cptr = &cache[0];
+                csize = sizeof cache;
+            }
             else if (strcmp(argv[i], "-orderby") == 0)
+            {
                 cptr = &sortStr[0];
+                csize = sizeof sortStr;
+            }
             else if (strcmp(argv[i], "-padding") == 0)
+            {
                 cptr = &padStr[0];
+                csize = sizeof padStr;
+            }
             else if (strcmp(argv[i], "-nodespace") == 0)
+            {
                 cptr = &nodeSpace[0];
+                csize = sizeof nodeSpace;
+            }
             else if (strcmp(argv[i], "-u") == 0)
+            {
                 cptr = &user[0];
+                csize = sizeof user;
+                lptr = users;
+                lcount = &userCount;
+            }
             else if (strcmp(argv[i], "-p") == 0)
+            {
                 cptr = &pw[0];
+                csize = sizeof pw;
+                lptr = pws;
+                lcount = &pwCount;
+            }
+            else if (strcmp(argv[i], "-token") == 0)
+            {
+                cptr = &token[0];
+                csize = sizeof token;
+                lptr = tokens;
+                lcount = &tokenCount;
+            }
+            else if (strcmp(argv[i], "-session") == 0)
+            {
+                cptr = &session[0];
+                csize = sizeof session;
+            }
             else if (strcmp(argv[i], "-debug") == 0)
+            {
                 cptr = &debug[0];
+                csize = sizeof debug;
+            }
             else if (strcmp(argv[i], "-ep") == 0)
+            {
                 cptr = &ep[0];
+                csize = sizeof ep;
+            }
+            else if (strcmp(argv[i], "-target") == 0)
+            {
+                cptr = &target[0];
+                csize = sizeof target;
+            }
             else if (strcmp(argv[i], "-phubs") == 0)
+            {
                 cptr = &phubs[0];
+                csize = sizeof phubs;
+            }
             else if (strcmp(argv[i], "-phosts") == 0)
+            {
                 cptr = &phosts[0];
+                csize = sizeof phosts;
+            }
             else if (strcmp(argv[i], "-out") == 0)
+            {
                 cptr = &out[0];
+                csize = sizeof out;
+            }
             else if (strcmp(argv[i], "-ll") == 0)
+            {
                 cptr = &linklabels[0];
+                csize = sizeof linklabels;
+            }
+            else if (strcmp(argv[i], "-pagesize") == 0)
+            {
+                cptr = &pagesize[0];
+                csize = sizeof pagesize;
+            }
+            else if (strcmp(argv[i], "-parallel") == 0)
+            {
+                cptr = &parallel[0];
+                csize = sizeof parallel;
+            }
+            else if (strcmp(argv[i], "-narrow") == 0)
+            {
+                cptr = &narrow[0];
+                csize = sizeof narrow;
+            }
+            else if (strcmp(argv[i], "-incr") == 0)
+            {
+                cptr = &incr[0];
+                csize = sizeof incr;
+            }
+            else if (strcmp(argv[i], "-pipeline") == 0)
+            {
+                cptr = &pipeline[0];
+                csize = sizeof pipeline;
+            }
+            else if (strcmp(argv[i], "-parsers") == 0)
+            {
+                cptr = &parsers[0];
+                csize = sizeof parsers;
+            }
+            else if (strcmp(argv[i], "-rate") == 0)
+            {
+                cptr = &rate[0];
+                csize = sizeof rate;
+            }
+            else if (strcmp(argv[i], "-inflight") == 0)
+            {
+                cptr = &inflight[0];
+                csize = sizeof inflight;
+            }
+            else if (strcmp(argv[i], "-record") == 0)
+            {
+                cptr = &record[0];
+                csize = sizeof record;
+            }
+            else if (strcmp(argv[i], "-replay") == 0)
+            {
+                cptr = &replay[0];
+                csize = sizeof replay;
+            }
             else if ((strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "-?") == 0) || (strcmp(argv[i], "--h") == 0) || (strcmp(argv[i], "--?") == 0) || (strcmp(argv[i], "--help") == 0))
                 // help required
                 h = 1;
@@ -104,8 +258,14 @@ int main(int argc, char *argv[])
         else
         {
             // Parameter values
-            if (cptr)
-                strcpy(cptr, argv[i]);      // TODO: Overflow possible here as this is not using strncpy. Need to refractor this section of code.
+            if (cptr && snprintf(cptr, csize, "%s", argv[i]) >= (int)csize)
+            {
+                fprintf(stderr, "Value for %s is longer than the %i characters allowed\n", argv[i - 1], (int)csize - 1);
+                return 1;
+            }
+            // Credentials are repeated for several end points rather than split, as they can hold any character.
+            if (lptr && *lcount < MAX_SERVERS)
+                lptr[(*lcount)++] = argv[i];
         }
     }
 
@@ -118,6 +278,7 @@ int main(int argc, char *argv[])
     if (g_zDebugMode)
     {
         printf("API End Point: %s\n", ep);
+        printf("Target: %s\n", target);
         printf("Map Name: %s\n", map);
         printf("IP: %s\n", ip);
         printf("Source: %s\n", src);
@@ -128,28 +289,152 @@ int main(int argc, char *argv[])
         printf("Output: %s\n", out);
         printf("Username: %s\n", user);
         printf("Password: %s\n", pw);
+        printf("Token: %s\n", (tokenCount > 0) ? "set" : "not set"); // never the token itself, as debug output gets shared
+        printf("Session Cache: %s\n", session);
         printf("LinkLabels: %s\n", linklabels);
         printf("Pseudo Hubs: %s\n", phubs);
         printf("Pseudo Hosts: %s\n", phosts);
+        printf("Page Size: %s\n", pagesize);
+        printf("Parallel Pages: %s\n", parallel);
+        printf("Narrow Items: %s\n", narrow);
+        printf("Incremental: %s\n", incr);
+        printf("Pipeline: %s\n", pipeline);
+        printf("Parsers: %s\n", parsers);
+        printf("Rate: %s\n", rate);
+        printf("In Flight: %s\n", inflight);
+        printf("Record: %s\n", record);
+        printf("Replay: %s\n", replay);
     }
 
     if (h)
         showHelp();
     else
     {
-        if (strlen(ep) > 0)
-            setEndpoint(ep); // Change API endpoint if supplied. Otherwise default value used.
-
-        if (g_zDebugMode)
-            printf("DEBUG: About to authenticate\n");
-        int authKey = zconnAuth(user, pw);
-        if (g_zDebugMode)
-            printf("DEBUG: Authentication complete\n");
-        if (authKey == 0)
+        // IP ranges used to filter the hosts.
+        struct ipRanges *ips = NULL;
+        if (strlen(ip) > 0)
+            ips = parseIpRanges(ip);
+
+        // The Zabbix servers, each with its own client context. Users and passwords pair with the end points in order,
+        // the last one given being used for any remaining end points.
+        struct server servers[MAX_SERVERS];
+        char *eps[MAX_SERVERS], *rates[MAX_SERVERS], *inflights[MAX_SERVERS];
+        int epCount = splitList(ep, eps, MAX_SERVERS);
+        int rateCount = splitList(rate, rates, MAX_SERVERS);
+        int inflightCount = splitList(inflight, inflights, MAX_SERVERS);
+        int serverCount = (epCount > 0) ? epCount : 1;
+        int tgt = atoi(target) - 1;
+        if (tgt < 0 || tgt >= serverCount)
         {
-            fprintf(stderr, "Authentication failed for user %s accessing Zabbix", user);
+            fprintf(stderr, "Target %s is not one of the %i API end points\n", target, serverCount);
+            if (ips)
+            {
+                free(ips->ranges);
+                free(ips);
+            }
             return 1;
         }
+        if (strcmp(src, "api") != 0 && strcmp("", cache) == 0)
+        {
+            fprintf(stderr, "Attempt to use cached data without cache data store location provided\n");
+            if (ips)
+            {
+                free(ips->ranges);
+                free(ips);
+            }
+            return 2;
+        }
+
+        for (i = 0; i < serverCount; i++)
+        {
+            struct server *sv = &servers[i];
+            sv->zc = zconnNew();
+            if (!sv->zc)
+            {
+                freeServers(servers, i);
+                if (ips)
+                {
+                    free(ips->ranges);
+                    free(ips);
+                }
+                return 1;
+            }
+            if (epCount > 0 && !setEndpoint(sv->zc, eps[i])) // Change API endpoint if supplied. Otherwise default value used.
+            {
+                fprintf(stderr, "API end point %s is too long\n", eps[i]);
+                freeServers(servers, i + 1);
+                if (ips)
+                {
+                    free(ips->ranges);
+                    free(ips);
+                }
+                return 1;
+            }
+
+            setPaging(sv->zc, atoi(pagesize), atoi(parallel));
+            setNarrowItems(sv->zc, strncmp(narrow, "1", 1) == 0);
+            setIncremental(sv->zc, strncmp(incr, "1", 1) == 0);
+            setPipeline(sv->zc, atoi(pipeline));
+            setParseThreads(sv->zc, atoi(parsers));
+            setIpFilter(sv->zc, ips);
+            if (tokenCount > 0)
+                setToken(sv->zc, tokens[(i < tokenCount) ? i : tokenCount - 1]); // Use the API token rather than logging in.
+            setSessionCache(sv->zc, session);
+            setRateLimit(sv->zc, (rateCount > 0) ? atof(rates[(i < rateCount) ? i : rateCount - 1]) : 0.0,
+                         (inflightCount > 0) ? atoi(inflights[(i < inflightCount) ? i : inflightCount - 1]) : 0);
+            if (strcmp("", replay) != 0)
+                setFixtures(sv->zc, replay, 1);
+            else if (strcmp("", record) != 0)
+                setFixtures(sv->zc, record, 0);
+
+            sv->user = (userCount > 0) ? users[(i < userCount) ? i : userCount - 1] : user;
+            sv->pw = (pwCount > 0) ? pws[(i < pwCount) ? i : pwCount - 1] : pw;
+            // Each server has its own cache file. The first uses the name given, the others have their number appended.
+            if (strcmp("", cache) == 0)
+                sv->cache[0] = '\0';
+            else if (i == 0)
+                snprintf(sv->cache, sizeof sv->cache, "%s", cache);
+            else
+                snprintf(sv->cache, sizeof sv->cache, "%s.%i", cache, i + 1);
+            sv->fromApi = (strcmp(src, "api") == 0);
+            sv->authKey = 0;
+            sv->hosts.count = 0;
+            sv->hosts.hosts = NULL;
+            sv->hosts.arena = NULL;
+            sv->threaded = 0;
+        }
+
+        // Get the hosts from every server at the same time, so that the total time is that of the slowest server.
+        if (serverCount > 1)
+            for (i = 0; i < serverCount; i++)
+                servers[i].threaded = (pthread_create(&servers[i].thread, NULL, fetchHosts, &servers[i]) == 0);
+        for (i = 0; i < serverCount; i++)
+        {
+            if (servers[i].threaded)
+                pthread_join(servers[i].thread, NULL);
+            else
+                fetchHosts(&servers[i]);
+        }
+
+        for (i = 0; i < serverCount; i++)
+        {
+            if (servers[i].authKey == 0)
+            {
+                if (serverCount > 1)
+                    fprintf(stderr, "Authentication failed for user %s accessing Zabbix at %s", servers[i].user, eps[i]);
+                else
+                    fprintf(stderr, "Authentication failed for user %s accessing Zabbix", servers[i].user);
+                freeServers(servers, serverCount);
+                if (ips)
+                {
+                    free(ips->ranges);
+                    free(ips);
+                }
+                return 1;
+            }
+            if (!servers[i].fromApi)
+                servers[i].hosts = zconnGetHostsFromFile(servers[i].cache, atoi(parsers)); // Use cached data
+        }
 
         double spacing[2];
         parseSpacing(nodeSpace, spacing);
@@ -165,70 +450,50 @@ int main(int argc, char *argv[])
         struct hostLink hl;
         hl.links.count = 0;
 
-        if (strcmp(src, "api") == 0)
+        if (serverCount > 1)
         {
-            // Use live Zabbix data.
-            hl.hosts = zconnGetHostsFromAPI((strcmp("", cache) == 0) ? NULL : cache);
+            // Merge the topologies of the servers into one.
+            struct hostCol cols[MAX_SERVERS];
+            for (i = 0; i < serverCount; i++)
+                cols[i] = servers[i].hosts;
+            hl.hosts = mergeHostCols(cols, serverCount, tgt);
+            for (i = 0; i < serverCount; i++)
+                servers[i].hosts = cols[i];
         }
         else
-        {
-            // Use cached data
-            if (strcmp("", cache) == 0)
-            {
-                fprintf(stderr, "Attempt to use cached data without cache data store location provided\n");
-                return 2;
-            }
-            // else
-            hl.hosts = zconnGetHostsFromFile(cache);
-        }
+            hl.hosts = servers[0].hosts;
+        servers[0].hosts.count = 0; // now owned by hl
+        servers[0].hosts.hosts = NULL;
+        servers[0].hosts.arena = NULL;
 
         // check to see if the IP addresses on the host interfaces are within the limits of the ip ranges requested by the filter.
+        // Hosts from the API have already been narrowed down by the API query, but a cache file contains everything.
         if (g_zDebugMode)
             printf("DEBUG: About to check IP addresses\n");
-        if (strlen(ip) > 0)
+        if (ips && ips->n > 0 && hl.hosts.count > 0)
         {
-            int ipasui;
-            if (hl.hosts.count > 0)
+            int inRange;
+            j = 0; // next free position in the hosts collection
+            for (i = 0; i < hl.hosts.count; i++)
             {
-                struct ipRanges *ips = parseIpRanges(ip);
-                int inRange;
-                if (ips->n > 0)
+                inRange = 0;
+                for (k = 0; k < hl.hosts.hosts[i].interfaceCount && !inRange; k++)
+                    inRange = ipAddrInRanges(ips, &hl.hosts.hosts[i].interfaces[k]);
+                if (inRange)
                 {
-                    for (i = hl.hosts.count - 1; i > -1; i--)
-                    {
-                        inRange = 0;
-                        for (k = 0; k < hl.hosts.hosts[i].interfaceCount; k++)
-                        {
-                            ipasui = ip2ui(hl.hosts.hosts[i].interfaces[k]);
-
-                            for (j = 0; j < ips->n; j++)
-                            {
-                                if (ips->ranges[j].lower <= ipasui && ips->ranges[j].upper >= ipasui)
-                                {
-                                    inRange = 1;
-                                    break;
-                                }
-                            }
-                            if (inRange == 1)
-                                break;
-                        }
-                        if (inRange == 0)
-                        {
-                            // Remove the host from the collection
-                            free(hl.hosts.hosts[i].linkedDevices);
-
-                            for (k = i; k < hl.hosts.count - 1; k++)
-                            {
-                                hl.hosts.hosts[k] = hl.hosts.hosts[k + 1];
-                            }
-
-                            hl.hosts.count--;
-                        }
-                    }
+                    // Keep the host, moving it down over any removed hosts.
+                    if (j != i)
+                        hl.hosts.hosts[j] = hl.hosts.hosts[i];
+                    j++;
                 }
-                free(ips->ranges);
-                free(ips);
+                // Otherwise the host is removed from the collection. Its linked devices are freed with the rest of the collection.
             }
+            hl.hosts.count = j;
+        }
+        if (ips)
+        {
+            free(ips->ranges);
+            free(ips);
         }
         if (g_zDebugMode)
             printf("DEBUG: About to evaluate hosts\n");
@@ -267,20 +532,15 @@ int main(int argc, char *argv[])
 
             if (strcmp(out, "api") == 0)
             {
-                // Delete the map if it currently exists.
-                zconnDeleteMapByName(map);
-
-                // Write the map into Zabbix
-                createMap(hlPtr, map, xMax, yMax, strncmp(linklabels, "1", 1) == 0 ? 1 : 0);
+                // Write the map into Zabbix, updating the map in place if it currently exists.
+                updateMap(servers[tgt].zc, hlPtr, map, xMax, yMax, strncmp(linklabels, "1", 1) == 0 ? 1 : 0);
             }
             else if (strcmp(out, "bmp") == 0)
             {
                  puts("-out bmp NOT IMPLEMENTED.\n");
             }
 
-            freeHostCol(&(hlPtr->hosts));
-            if (hlPtr->links.count > 0)
-                free(hlPtr->links.links);
+            freeHostCol(&(hlPtr->hosts)); // The links are freed with the hosts.
         }
         else
         {
@@ -288,6 +548,7 @@ int main(int argc, char *argv[])
         }
 
         free(mc.sm);
+        freeServers(servers, serverCount);
     }
 
     return 0;
@@ -418,12 +679,18 @@ void showHelp()
     printf("option should be followed by option value if applicable. Use double quotes if value includes spaces.\n");
     printf("example: zabbix-map -map \"test map\" -ip \"192.168.4.0\\24, 192.168.4.101\" -u admin -p password1\n\n");
     printf(" -ep \t\t\tAPI End Point. default http://localhost/api_jsonrpc.php\n");
-    printf(" -map \t\t\tname of the map in Zabbix. Will overwrite if existing.\n");
+    printf("\t\t\tSeveral comma separated end points merge the hosts of several Zabbix servers into one map.\n");
+    printf("\t\t\tThe servers are queried at the same time. Hosts seen by more than one server (same chassis ID) are merged.\n");
+    printf(" -target\t\tNumber of the end point (counting from 1) that the map is published to. default 1.\n");
+    printf(" -map \t\t\tname of the map in Zabbix. Will be updated in place if existing.\n");
     printf(" -ip\t\t\tIP address(es) of hosts to be included in the map.\n");
     printf("\t\t\tCan take multiple address or ranges. Must be comma seperated.\n");
     printf("\t\t\tCan have single addresses (E.g. 192.168.4.1)\n");
     printf("\t\t\tor hyphenated ranges (E.g. 192.168.4.0-.128 or 192.168.4.0-5.0)\n");
     printf("\t\t\tor CIDR ranges (E.g. 192.168.4.0/24)\n");
+    printf("\t\t\tRanges are IPv4. With -ip a host is included only when one of its interfaces has an IPv4\n");
+    printf("\t\t\taddress in range, so hosts with no interfaces, DNS-only hosts and IPv6-only hosts are left\n");
+    printf("\t\t\tout, even with 0.0.0.0/0. Without -ip every host is included, hosts with no interfaces too.\n");
     printf(" -src\t\t\tData source for the map {api,file}.\n");
     printf("\t\t\tif taken from file then cache file is source.\n");
     printf("\t\t\tif api then data comes from live data and cache file is used to store results.\n");
@@ -446,8 +713,90 @@ void showHelp()
     printf("\t\t\tTwo values required if given. X axis first, Y axis second.\n");
     printf("\t\t\texample: -nodespace \"100.0, 50.0\"\n");
     printf(" -u\t\t\tUsername to be used for the connection to Zabbix server.\n");
-    printf(" -p\t\t\tPassword to be used for the given Zabbix server user.\n");
+    printf("\t\t\tRepeat for several end points, in the same order. The last is used for any remaining end points.\n");
+    printf(" -p\t\t\tPassword to be used for the given Zabbix server user. Taken as given, commas and spaces included.\n");
+    printf("\t\t\tRepeat for several end points, in the same order. The last is used for any remaining end points.\n");
+    printf(" -token\t\t\tAPI token used in place of -u and -p. Sent as a bearer header, so no login is made.\n");
+    printf("\t\t\tRepeat for several end points, in the same order. The last is used for any remaining end points.\n");
+    printf(" -session\t\tSession cache file. A session from a previous run is reused while Zabbix still accepts it,\n");
+    printf("\t\t\tsaving a login each run. The file holds live sessions so is only readable by its owner.\n");
     printf(" -phosts\t\t\tHosts that are found though LLDP but are not in the Zabbix database will be represented on the map.\n");
     printf(" -phubs\t\t\tIf more than two hosts are connected through the same link show a hub at the joining section.\n");
     printf(" -ll\t\t\tLinks between hosts labelled to show port assignments.\n");
-}
\ No newline at end of file
+    printf(" -pagesize\t\tGet hosts from the API in pages of this many hosts. default 0 (all hosts in one call).\n");
+    printf(" -parallel\t\tNumber of host pages requested at the same time when -pagesize is used. default 4.\n");
+    printf(" -narrow\t\tRequest only the LLDP, chassis and system description items from the API (by item key). default 1.\n");
+    printf("\t\t\tSet to 0 to request every item of every host.\n");
+    printf(" -incr\t\t\tRefresh the hosts held in the cache file rather than requesting every host again. default 0.\n");
+    printf("\t\t\tOnly new hosts, new items and items with a new value (by lastclock) are requested.\n");
+    printf(" -pipeline\t\tNumber of threads parsing host pages while the remaining pages are downloaded. default 0 (parse after download).\n");
+    printf("\t\t\tUses -pagesize, or pages of 250 hosts if no page size is given.\n");
+    printf(" -parsers\t\tNumber of threads parsing the hosts after download or from the cache file. default 0 (one per core).\n");
+    printf(" -rate\t\t\tMost API calls per second made to the Zabbix frontend. default 0 (no limit).\n");
+    printf("\t\t\tComma separated for several end points, in the same order. The last is used for any remaining end points.\n");
+    printf(" -inflight\t\tMost API calls in flight at the same time to the Zabbix frontend. default 0 (no limit other than -parallel).\n");
+    printf("\t\t\tComma separated for several end points, in the same order. The last is used for any remaining end points.\n");
+    printf("\t\t\tBoth limits are reduced while the frontend is slow or answers 429 or 5xx, and refused calls are retried.\n");
+    printf(" -record		Directory the API responses are recorded to, to be replayed by a later run with -replay.\n");
+    printf(" -replay		Directory of API responses recorded with -record. The responses are replayed in place of calling the API,\n");
+    printf("\t\t\tso no Zabbix server or network is needed. The end points and settings must match the recorded run.\n");
+}
+
+/**
+ * Split a comma separated list in place. Spaces around each item are removed.
+ * @param [in] s        string containing the list. Modified.
+ * @param [out] items   pointers to the items within s.
+ * @param [in] max      maximum number of items. Any further items are ignored.
+ * @return              number of items found.
+ * */
+int splitList(char *s, char **items, int max)
+{
+    int n = 0;
+    char *rPtr;
+    char *tok = strtok_r(s, ",", &rPtr);
+    while (tok != NULL && n < max)
+    {
+        while (*tok == ' ')
+            tok++;
+        char *end = tok + strlen(tok);
+        while (end > tok && end[-1] == ' ')
+            *--end = '\0';
+        if (*tok)
+            items[n++] = tok;
+        tok = strtok_r(NULL, ",", &rPtr);
+    }
+    return n;
+}
+
+/**
+ * Authenticate against a Zabbix server and get its hosts. Run on its own thread for each server when federating.
+ * @param [in] arg      the server (struct server).
+ * */
+void *fetchHosts(void *arg)
+{
+    struct server *sv = arg;
+    if (g_zDebugMode)
+        printf("DEBUG: About to authenticate\n");
+    sv->authKey = (zconnInit(sv->zc)) ? zconnAuth(sv->zc, sv->user, sv->pw) : 0;
+    if (g_zDebugMode)
+        printf("DEBUG: Authentication complete\n");
+
+    if (sv->authKey != 0 && sv->fromApi)
+        sv->hosts = zconnGetHostsFromAPI(sv->zc, (strcmp("", sv->cache) == 0) ? NULL : sv->cache); // Use live Zabbix data.
+    return NULL;
+}
+
+/**
+ * Free the servers, closing their connections.
+ * @param [in] servers  servers to free.
+ * @param [in] count    number of servers.
+ * */
+void freeServers(struct server *servers, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        freeHostCol(&servers[i].hosts);
+        zconnFree(servers[i].zc);
+    }
+}
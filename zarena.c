@@ -0,0 +1,171 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+
+#include "zarena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ZARENA_CHUNK_MIN 65536    // Size of the first chunk.
+#define ZARENA_CHUNK_MAX 4194304  // Chunks stop doubling at this size.
+#define ZARENA_ALIGN 16           // Alignment of every allocation.
+
+/**
+ * Chunk of arena memory. The memory follows the header.
+ * */
+struct zarenaChunk
+{
+    struct zarenaChunk *next; /**< next (older) chunk */
+    size_t size;              /**< bytes of memory after the header */
+};
+
+#define ZARENA_HEADER_SIZE ((sizeof(struct zarenaChunk) + ZARENA_ALIGN - 1) & ~(size_t)(ZARENA_ALIGN - 1))
+
+static size_t zarenaRound(size_t size)
+{
+    return (size + ZARENA_ALIGN - 1) & ~(size_t)(ZARENA_ALIGN - 1);
+}
+
+struct zarena *zarenaNew()
+{
+    struct zarena *a = malloc(sizeof *a);
+    if (!a)
+        return NULL;
+    a->chunks = NULL;
+    a->next = NULL;
+    a->end = NULL;
+    a->last = NULL;
+    a->chunkSize = ZARENA_CHUNK_MIN;
+    return a;
+}
+
+/**
+ * Add a chunk with room for at least the given size.
+ * @return      1 if success, 0 if out of memory.
+ * */
+static int zarenaGrow(struct zarena *a, size_t size)
+{
+    int own = (size > a->chunkSize); // Too big for the next chunk, so gets a chunk of its own.
+    size_t chunkSize = (own) ? size : a->chunkSize;
+    struct zarenaChunk *c = malloc(ZARENA_HEADER_SIZE + chunkSize);
+
+    if (!c)
+        return 0;
+    c->size = chunkSize;
+    if (!own && a->chunkSize < ZARENA_CHUNK_MAX)
+        a->chunkSize *= 2;
+    if (own && a->chunks && a->next < a->end)
+    {
+        // Keep allocating from the current chunk, which may still have plenty of room.
+        c->next = a->chunks->next;
+        a->chunks->next = c;
+        return 1;
+    }
+    c->next = a->chunks;
+    a->chunks = c;
+    a->next = (char *)c + ZARENA_HEADER_SIZE;
+    a->end = a->next + chunkSize;
+    a->last = NULL;
+    return 1;
+}
+
+void *zarenaAlloc(struct zarena *a, size_t size)
+{
+    char *ret;
+
+    size = zarenaRound((size > 0) ? size : 1);
+    if ((size_t)(a->end - a->next) < size)
+    {
+        if (!zarenaGrow(a, size))
+            return NULL;
+        if ((size_t)(a->end - a->next) < size)
+        {
+            // Given a chunk of its own, which was put behind the current one.
+            return (char *)a->chunks->next + ZARENA_HEADER_SIZE;
+        }
+    }
+    ret = a->next;
+    a->next += size;
+    a->last = ret;
+    return ret;
+}
+
+void *zarenaRealloc(struct zarena *a, void *ptr, size_t oldSize, size_t newSize)
+{
+    void *ret;
+
+    if (!ptr)
+        return zarenaAlloc(a, newSize);
+    if (ptr == a->last && (size_t)(a->end - (char *)ptr) >= zarenaRound((newSize > 0) ? newSize : 1))
+    {
+        // The most recent allocation, with room to grow (or shrinking). Move the end of it.
+        a->next = (char *)ptr + zarenaRound((newSize > 0) ? newSize : 1);
+        return ptr;
+    }
+    if (newSize <= oldSize)
+        return ptr; // Shrinking something older. Not worth a copy.
+    ret = zarenaAlloc(a, newSize);
+    if (ret)
+        memcpy(ret, ptr, oldSize);
+    return ret;
+}
+
+void zarenaAdopt(struct zarena *a, struct zarena *from)
+{
+    struct zarenaChunk *c;
+
+    if (!from)
+        return;
+    if (from->chunks)
+    {
+        // The adopted chunks go behind the current chunk, which carries on being allocated from.
+        for (c = from->chunks; c->next; c = c->next)
+            ;
+        if (a->chunks)
+        {
+            c->next = a->chunks->next;
+            a->chunks->next = from->chunks;
+        }
+        else
+        {
+            c->next = NULL;
+            a->chunks = from->chunks;
+            a->next = from->next;
+            a->end = from->end;
+            a->last = from->last;
+        }
+    }
+    free(from);
+}
+
+void zarenaFree(struct zarena *a)
+{
+    struct zarenaChunk *c, *next;
+
+    if (!a)
+        return;
+    for (c = a->chunks; c; c = next)
+    {
+        next = c->next;
+        free(c);
+    }
+    free(a);
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+
+#ifndef ZARENA_HEADER
+#define ZARENA_HEADER
+/**
+ * Memory Arena.
+ *
+ * Memory for one topology snapshot (the hosts, their linked devices and the links between them) is taken from an arena
+ * in large chunks and given back all at once, rather than by thousands of separate malloc and free calls.
+ * An arena is used by one thread at a time.
+ * */
+
+/**
+ * \file zarena.h
+ * */
+
+#include <stddef.h>
+
+struct zarenaChunk;
+
+/**
+ * Arena of memory.
+ * */
+struct zarena
+{
+    struct zarenaChunk *chunks; /**< chunks of memory, the newest first */
+    char *next;                 /**< next free byte of the newest chunk */
+    char *end;                  /**< end of the newest chunk */
+    char *last;                 /**< most recent allocation, which can be grown or shrunk in place */
+    size_t chunkSize;           /**< size of the next chunk. Doubles with each chunk up to a limit. */
+};
+
+/**
+ * Create an arena.
+ * @return      new arena, or NULL if out of memory.
+ * */
+struct zarena *zarenaNew();
+
+/**
+ * Allocate memory from an arena. The memory is aligned for any type and is not cleared.
+ * @param [in] a        arena.
+ * @param [in] size     bytes to allocate.
+ * @return              the memory, or NULL if out of memory.
+ * */
+void *zarenaAlloc(struct zarena *a, size_t size);
+
+/**
+ * Resize memory allocated from an arena. The most recent allocation is resized in place where it fits, otherwise the
+ * contents are copied to new memory and the old memory is left in the arena until the arena is freed.
+ * @param [in] a        arena.
+ * @param [in] ptr      memory to resize, from this arena or one it has adopted. NULL to allocate.
+ * @param [in] oldSize  current size of the memory.
+ * @param [in] newSize  size required.
+ * @return              the resized memory, or NULL if out of memory (in which case ptr is unchanged).
+ * */
+void *zarenaRealloc(struct zarena *a, void *ptr, size_t oldSize, size_t newSize);
+
+/**
+ * Move all the memory of one arena into another, so that memory from both is freed with the other.
+ * @param [in] a        arena to take the memory.
+ * @param [in] from     arena to give up its memory. Freed. May be NULL.
+ * */
+void zarenaAdopt(struct zarena *a, struct zarena *from);
+
+/**
+ * Free an arena and all the memory allocated from it.
+ * @param [in] a        arena. May be NULL.
+ * */
+void zarenaFree(struct zarena *a);
+#endif
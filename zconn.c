@@ -19,714 +19,3769 @@
  **********************************************************************/
 
 #include "zconn.h"
+#include "ip.h"
+#include "zitem.h"
 #include "curl/curl.h"
 #include "json_tokener.h"
 #include "json_object.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 
 extern int g_zDebugMode;
 
 /**
- * Memory structure for JSON responses
+ * Parser state for a JSON response.
+ * The response is parsed as it arrives from the server so that the raw response never needs to be held in memory, unless
+ * the raw response is wanted instead (see zconnStreamInitRaw).
  * */
-struct MemoryStruct
+struct ResponseStream
 {
-    char *memory;
-    size_t size;
+    struct json_tokener *tok;      /**< incremental parser fed by the curl write callback. NULL when keeping the raw response. */
+    json_object *jobj;             /**< parsed response. Set once the complete response has been received. */
+    enum json_tokener_error jerr;  /**< parser state after the last chunk */
+    size_t size;                   /**< number of bytes received */
+    char *raw;                     /**< raw response, '\0' terminated, when it is kept rather than parsed. NULL otherwise. */
+    size_t rawAlloc;               /**< bytes allocated for raw */
 };
 
-static char endpoint[256] = "http://localhost/api_jsonrpc.php"; // API End point
+/**
+ * Calls queued to be sent to the API together as a single JSON-RPC batch request.
+ * Each call keeps the ID it is given by zconnRequest so that the replies can be matched to the calls.
+ * */
+struct zconnBatch
+{
+    json_object *requests;  /**< array of request objects, in the order they were queued */
+    json_object **results;  /**< result of each call once the batch has been run. NULL for calls that failed. */
+    int count;              /**< number of calls queued */
+    int failed;             /**< set if a call could not be queued */
+};
+
+/**
+ * Connection shared by every API call made through a client context.
+ * A single curl handle is kept alive between calls so that the TCP (and TLS) connection to the frontend is reused, and
+ * the share handle caches DNS lookups and TLS sessions should a new connection be needed.
+ * */
+struct zconnSession
+{
+    CURL *curl;                 /**< keep-alive handle reused by every call */
+    CURLSH *share;              /**< DNS and TLS session cache */
+    struct curl_slist *headers; /**< request headers, built once */
+    int calls;                  /**< number of API calls made */
+    long connects;              /**< number of new connections opened to make those calls */
+    double totalTime;           /**< total time spent in API calls (seconds) */
+    double handshakeTime;       /**< time spent connecting (TCP + TLS) on new connections (seconds) */
+    curl_off_t received;        /**< response bytes received, as sent over the wire (compressed) */
+    size_t decoded;             /**< response bytes after decompression, as fed into the parser */
+};
+
+#define LIMIT_METHODS 16        // Most API methods with a latency baseline. Methods beyond this are not checked for slowing down.
+
+/**
+ * Lowest latency seen for one API method.
+ * Methods differ too much in cost to share a baseline: a cheap user.login would make every host.get page look slow.
+ * */
+struct zconnLatency
+{
+    char method[32];    /**< Zabbix API method name */
+    double minLatency;  /**< lowest latency seen for the method (seconds) */
+};
+
+/**
+ * Limits on the calls made to the frontend, protecting it from the mapper.
+ * Calls are paced by a token bucket and capped in number in flight. Both limits are scaled down (multiplicative decrease)
+ * when the frontend answers 429 or 5xx or its latency rises, and scaled back up a step at a time (additive increase)
+ * while it is healthy. 429 and 5xx also hold off every call for the Retry-After time or an exponential backoff.
+ * */
+struct zconnLimiter
+{
+    double rate;        /**< calls per second. 0 for no limit. */
+    double burst;       /**< calls that can be made at once after a quiet period */
+    double tokens;      /**< calls that can be made now */
+    double refilled;    /**< time the tokens were last topped up */
+    int maxInFlight;    /**< most calls in flight at the same time. 0 for no limit. */
+    double scale;       /**< fraction of the rate and in flight limits currently allowed. 1.0 when the frontend is healthy. */
+    double holdUntil;   /**< no call is made before this time */
+    double backoff;     /**< hold off after the next 429 or 5xx, when the frontend gives no Retry-After (seconds) */
+    struct zconnLatency baselines[LIMIT_METHODS]; /**< lowest latency seen for each method, the baselines for detecting the frontend slowing down */
+    int baselineCount;  /**< number of methods with a baseline */
+    int backoffs;       /**< number of times the limits were scaled down */
+    int retries;        /**< number of calls retried after a 429 or 5xx */
+    double queued;      /**< total time calls waited for the limits (seconds) */
+    double maxQueued;   /**< longest time a call waited for the limits (seconds) */
+};
+
+/**
+ * Client context for one Zabbix server.
+ * Holds everything a session needs: the end point, the authorisation, the request counter, the connection and the
+ * settings used when getting hosts. Nothing is shared between contexts, so each thread can talk to its own server
+ * through its own context.
+ * */
+struct zconnCtx
+{
+    char endpoint[256];           /**< API end point */
+    struct zconnSession session;  /**< connection and call statistics */
+    struct zconnLimiter limit;    /**< pacing of the calls to the end point */
+    int connId;                   /**< connection ID of the last request. Ensures that API response matches request. */
+    char authId[40];              /**< authorisation ID. Empty until user.login succeeds. */
+    char token[129];              /**< API token sent as a bearer header. Empty to log in with a user and password. */
+    char sessionFile[256];        /**< file caching session IDs between runs. Empty for no cache. */
+    int pageSize;                 /**< hosts per host.get page. 0 fetches all hosts in a single call. */
+    int pageParallel;             /**< number of host.get pages requested at the same time */
+    struct ipRanges *ipFilter;    /**< only hosts with an interface in these ranges are requested. NULL for all hosts. */
+    int narrowItems;              /**< get only the items used by the mapper (item.get with a key search) rather than every item of every host */
+    int incremental;              /**< bring the hosts in the cache file up to date rather than getting every host again */
+    int parserThreads;            /**< threads parsing host pages while the rest are downloaded. 0 parses once everything has been downloaded. */
+    int parseThreads;             /**< threads parsing the hosts once everything has been downloaded. 0 for one per core. */
+    char fixtureDir[256];         /**< directory responses are recorded to or replayed from. Empty for neither. */
+    int fixtureMode;              /**< FIXTURE_RECORD or FIXTURE_REPLAY when fixtureDir is set */
+};
+
+static pthread_mutex_t curlGlobalLock = PTHREAD_MUTEX_INITIALIZER; // curl_global_init and curl_global_cleanup are not thread safe
+static int curlGlobalUsers = 0; // Number of contexts with an open connection
+static pthread_mutex_t sessionFileLock = PTHREAD_MUTEX_INITIALIZER; // Contexts in the same process share the session file
+
+#define LIMIT_RETRIES 3         // Times a call is retried after a 429 or 5xx response.
+#define LIMIT_BACKOFF_MIN 0.25  // First hold off after a 429 or 5xx without a Retry-After (seconds). Doubles while they continue.
+#define LIMIT_BACKOFF_MAX 8.0   // Longest hold off without a Retry-After (seconds).
+#define LIMIT_SCALE_MIN 0.0625  // Limits are never scaled below this fraction.
+#define LIMIT_SLOW 2.0          // Latency above this multiple of the lowest latency seen for the method counts as the frontend slowing down.
+#define PIPELINE_PAGE_SIZE 250  // Hosts per page when pipelining without a page size set.
+#define PIPELINE_QUEUE_SIZE 16  // Pages that can wait to be parsed. Must be a power of 2.
+#define FIXTURE_RECORD 1     // Responses are written to the fixture directory as they are received.
+#define FIXTURE_REPLAY 2     // Responses are read from the fixture directory. Nothing is sent to the end point.
+#define PARSE_BLOCK_SIZE 64     // Hosts taken at a time by a thread parsing hosts.
+#define PARSE_THREADS_MAX 64    // Most threads parsing one array of hosts.
+#define MSAP_INDEX_SIZE 256   // Slots in the index of linked devices by MSAP. Doubles for a host with more than half as many linked devices. Must be a power of 2.
+
+/**
+ * Item keys used by the mapper. Used to narrow item.get to only the items that zconnParseHosts makes use of.
+ * */
+#define ITEM_KEY_COUNT 4
+static const char *itemKeys[ITEM_KEY_COUNT] = {
+    "lldp.rem.*",        // LLDP remote (linked device) items from Template LLDP - General
+    "SNMP-Chassis-Id*",  // Chassis Id and Chassis Id Type from LLDP - Local Common
+    "system.descr*",     // System description
+    "sysDescr*"          // System description (older templates)
+};
+
+/**
+ * Prepare a response stream for a new response.
+ * @return      1 if success, 0 if out of memory.
+ * */
+static int zconnStreamInit(struct ResponseStream *stream)
+{
+    stream->tok = json_tokener_new();
+    stream->jobj = NULL;
+    stream->jerr = json_tokener_continue;
+    stream->size = 0;
+    stream->raw = NULL;
+    stream->rawAlloc = 0;
+    return (stream->tok) ? 1 : 0;
+}
+
+/**
+ * Prepare a response stream that keeps the raw response rather than parsing it.
+ * @return      1 if success, 0 if out of memory.
+ * */
+static int zconnStreamInitRaw(struct ResponseStream *stream)
+{
+    stream->tok = NULL;
+    stream->jobj = NULL;
+    stream->jerr = json_tokener_continue;
+    stream->size = 0;
+    stream->rawAlloc = 65536;
+    stream->raw = malloc(stream->rawAlloc);
+    if (stream->raw)
+        stream->raw[0] = '\0';
+    return (stream->raw) ? 1 : 0;
+}
+
+/**
+ * Feed a chunk of the response into the stream parser.
+ * @return      1 if the chunk was accepted, 0 if the response is not valid JSON.
+ * */
+static int zconnStreamFeed(struct ResponseStream *stream, const char *data, size_t len)
+{
+    if (stream->raw)
+    {
+        if (stream->size + len >= stream->rawAlloc)
+        {
+            size_t size = stream->rawAlloc;
+            while (stream->size + len >= size)
+                size *= 2;
+            char *tmpPtr = realloc(stream->raw, size);
+            if (!tmpPtr)
+            {
+                fprintf(stderr, "Out of memory attempting to hold the response");
+                return 0;
+            }
+            stream->raw = tmpPtr;
+            stream->rawAlloc = size;
+        }
+        memcpy(stream->raw + stream->size, data, len);
+        stream->size += len;
+        stream->raw[stream->size] = '\0';
+        return 1;
+    }
+    if (stream->jobj)
+        return 1; // Response already complete. Anything after it (e.g. trailing new line) is ignored.
+
+    stream->size += len;
+    stream->jobj = json_tokener_parse_ex(stream->tok, data, len);
+    stream->jerr = json_tokener_get_error(stream->tok);
+    return (stream->jerr == json_tokener_success || stream->jerr == json_tokener_continue) ? 1 : 0;
+}
+
+/**
+ * Complete the stream once all data has been fed in.
+ * @return      parsed JSON object (caller must put) or NULL if the response was not complete, valid JSON.
+ * */
+static json_object *zconnStreamEnd(struct ResponseStream *stream)
+{
+    if (!stream->jobj && stream->jerr == json_tokener_continue)
+    {
+        // Include the '\0' now that we know we're at the end of input
+        stream->jobj = json_tokener_parse_ex(stream->tok, "", 1);
+        stream->jerr = json_tokener_get_error(stream->tok);
+    }
+    if (!stream->jobj || stream->jerr != json_tokener_success)
+    {
+        fprintf(stderr, "Error: %s\n", json_tokener_error_desc(stream->jerr));
+        json_object_put(stream->jobj);
+        stream->jobj = NULL;
+    }
+
+    json_object *jobj = stream->jobj;
+    stream->jobj = NULL;
+    return jobj;
+}
+
+/**
+ * Free any memory held by a response stream.
+ * */
+static void zconnStreamFree(struct ResponseStream *stream)
+{
+    json_object_put(stream->jobj);
+    stream->jobj = NULL;
+    if (stream->tok)
+        json_tokener_free(stream->tok);
+    stream->tok = NULL;
+    free(stream->raw);
+    stream->raw = NULL;
+}
+
+/**
+ * Empty a response stream for the response to a request sent again, keeping or parsing the response as before.
+ * @return      1 if success, 0 if out of memory.
+ * */
+static int zconnStreamReset(struct ResponseStream *stream)
+{
+    int raw = (stream->raw != NULL);
+    zconnStreamFree(stream);
+    return (raw) ? zconnStreamInitRaw(stream) : zconnStreamInit(stream);
+}
 
 /**
- * callback method for CURL to capture response from server
+ * callback method for CURL to capture response from server.
+ * Each chunk is parsed as it arrives rather than being buffered.
  * */
 static size_t
-WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
+WriteStreamCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
     size_t realsize = size * nmemb;
-    struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+    struct ResponseStream *stream = (struct ResponseStream *)userp;
 
-    char *ptr = realloc(mem->memory, mem->size + realsize + 1);
-    if (!ptr)
+    if (!zconnStreamFeed(stream, contents, realsize))
     {
-        /* out of memory! */
-        printf("not enough memory (realloc returned NULL)\n");
+        /* Not JSON. Returning less than realsize aborts the transfer. */
+        if (stream->tok)
+            fprintf(stderr, "Error: %s\n", json_tokener_error_desc(stream->jerr));
         return 0;
     }
 
-    mem->memory = ptr;
-    memcpy(&(mem->memory[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->memory[mem->size] = 0;
-
     return realsize;
 }
 
-// Set the end point to be used by the connection module.
-void setEndpoint(char *ep)
+/**
+ * Read a JSON file, parsing it a buffer at a time.
+ * @param [in] fileName     name of the file.
+ * @return                  parsed JSON object (caller must put) or NULL if the file does not exist or is not valid JSON.
+ * */
+static json_object *zconnReadJsonFile(char *fileName)
+{
+    /* declare a file pointer */
+    FILE *infile;
+    char buffer[65536]; // The file is parsed as it is read so only a small buffer is needed.
+    size_t numbytes;
+
+    /* open an existing file for reading */
+    infile = fopen(fileName, "r");
+
+    /* quit if the file does not exist */
+    if (infile == NULL)
+        return NULL;
+
+    struct ResponseStream stream;
+    if (!zconnStreamInit(&stream))
+    {
+        fclose(infile);
+        return NULL;
+    }
+
+    /* parse the file a buffer at a time */
+    while ((numbytes = fread(buffer, sizeof(char), sizeof buffer, infile)) > 0)
+    {
+        if (!zconnStreamFeed(&stream, buffer, numbytes))
+            break;
+    }
+    fclose(infile);
+
+    json_object *jobj = zconnStreamEnd(&stream);
+    zconnStreamFree(&stream);
+    return jobj;
+}
+
+/**
+ * Time in seconds from an arbitrary fixed point, for measuring how long the pipeline stages take.
+ * */
+static double zconnNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Peak resident set size of this process in KB. Used for debug output.
+ * */
+static long zconnPeakRss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;
+}
+
+// Set the end point to be used by the connection module.
+int setEndpoint(struct zconnCtx *ctx, char *ep)
+{
+    if (strlen(ep) >= sizeof ctx->endpoint)
+        return 0;
+    snprintf(ctx->endpoint, sizeof ctx->endpoint, "%s", ep);
+    return 1;
+}
+
+// Set the IP ranges used to select hosts when getting hosts from the API.
+void setIpFilter(struct zconnCtx *ctx, struct ipRanges *ips)
+{
+    ctx->ipFilter = (ips && ips->n > 0) ? ips : NULL;
+}
+
+// Set whether only the items used by the mapper are requested.
+void setNarrowItems(struct zconnCtx *ctx, int narrow)
+{
+    ctx->narrowItems = (narrow) ? 1 : 0;
+}
+
+// Set whether zconnGetHostsFromAPI refreshes the hosts in the cache file rather than getting every host again.
+void setIncremental(struct zconnCtx *ctx, int incr)
+{
+    ctx->incremental = (incr) ? 1 : 0;
+}
+
+// Set the number of threads parsing host pages while the rest of the pages are downloaded.
+void setPipeline(struct zconnCtx *ctx, int threads)
+{
+    ctx->parserThreads = (threads > 0) ? threads : 0;
+}
+
+// Set the number of threads parsing the hosts once they have all been downloaded.
+void setParseThreads(struct zconnCtx *ctx, int threads)
+{
+    ctx->parseThreads = (threads > 0) ? threads : 0;
+}
+
+// Set the API token used in place of a user login.
+void setToken(struct zconnCtx *ctx, char *token)
+{
+    snprintf(ctx->token, sizeof ctx->token, "%s", token);
+    if (ctx->session.headers && ctx->token[0] != '\0')
+    {
+        // Connection already open, so add the header to the ones sent with each call.
+        char header[160];
+        snprintf(header, sizeof header, "Authorization: Bearer %s", ctx->token);
+        ctx->session.headers = curl_slist_append(ctx->session.headers, header);
+    }
+}
+
+// Set the file caching session IDs between runs.
+void setSessionCache(struct zconnCtx *ctx, char *fileName)
+{
+    snprintf(ctx->sessionFile, sizeof ctx->sessionFile, "%s", fileName);
+}
+
+// Set the limits on the calls made to the end point.
+void setRateLimit(struct zconnCtx *ctx, double rate, int maxInFlight)
+{
+    ctx->limit.rate = (rate > 0.0) ? rate : 0.0;
+    ctx->limit.burst = (rate > 1.0) ? rate : 1.0; // Up to a second of calls at once
+    ctx->limit.tokens = ctx->limit.burst;
+    ctx->limit.refilled = zconnNow();
+    ctx->limit.maxInFlight = (maxInFlight > 0) ? maxInFlight : 0;
+}
+
+// Set the directory API responses are recorded to or replayed from.
+void setFixtures(struct zconnCtx *ctx, char *dir, int replay)
+{
+    snprintf(ctx->fixtureDir, sizeof ctx->fixtureDir, "%s", dir);
+    ctx->fixtureMode = (replay) ? FIXTURE_REPLAY : FIXTURE_RECORD;
+}
+
+// Set the host.get paging used by zconnGetHostsFromAPI.
+void setPaging(struct zconnCtx *ctx, int size, int parallel)
+{
+    ctx->pageSize = (size > 0) ? size : 0;
+    ctx->pageParallel = (parallel > 0) ? parallel : 1;
+}
+
+/**
+ * Create a curl handle set up with the options that do not change between calls.
+ * The handle uses the session DNS and TLS session cache.
+ * */
+static CURL *zconnNewHandle(struct zconnCtx *ctx)
+{
+    CURL *curl = curl_easy_init();
+    if (!curl)
+        return NULL;
+
+    if (ctx->session.share)
+        curl_easy_setopt(curl, CURLOPT_SHARE, ctx->session.share);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, ctx->session.headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteStreamCallback);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, -1L); // Keep DNS entries for the lifetime of the session
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L); // HTTP errors (e.g. 429, 503) fail the call rather than feeding an error page to the parser
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // Ask for any compression curl can decode (gzip, deflate, ...). The write callback gets the decoded data.
+    return curl;
+}
+
+struct zconnCtx *zconnNew()
+{
+    struct zconnCtx *ctx = calloc(1, sizeof(struct zconnCtx));
+    if (!ctx)
+    {
+        fprintf(stderr, "Out of memory creating zconn context\n");
+        return NULL;
+    }
+
+    strcpy(ctx->endpoint, "http://localhost/api_jsonrpc.php");
+    ctx->pageParallel = 4;
+    ctx->narrowItems = 1;
+    ctx->limit.scale = 1.0;
+    ctx->limit.backoff = LIMIT_BACKOFF_MIN;
+    return ctx;
+}
+
+int zconnInit(struct zconnCtx *ctx)
+{
+    if (ctx->session.curl)
+        return 1; // Already initialised
+
+    pthread_mutex_lock(&curlGlobalLock);
+    if (curlGlobalUsers == 0 && curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    {
+        pthread_mutex_unlock(&curlGlobalLock);
+        fprintf(stderr, "Could not initialise curl\n");
+        return 0;
+    }
+    curlGlobalUsers++;
+    pthread_mutex_unlock(&curlGlobalLock);
+
+    ctx->session.share = curl_share_init();
+    if (ctx->session.share)
+    {
+        curl_share_setopt(ctx->session.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(ctx->session.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ctx->session.headers = curl_slist_append(NULL, "Content-Type: application/json");
+    if (ctx->token[0] != '\0')
+    {
+        char header[160];
+        snprintf(header, sizeof header, "Authorization: Bearer %s", ctx->token);
+        ctx->session.headers = curl_slist_append(ctx->session.headers, header);
+    }
+
+    ctx->session.curl = zconnNewHandle(ctx);
+    if (!ctx->session.curl)
+    {
+        fprintf(stderr, "Could not create curl handle\n");
+        zconnCleanup(ctx);
+        return 0;
+    }
+
+    ctx->session.calls = 0;
+    ctx->session.connects = 0;
+    ctx->session.totalTime = 0.0;
+    ctx->session.handshakeTime = 0.0;
+    ctx->session.received = 0;
+    ctx->session.decoded = 0;
+    return 1;
+}
+
+void zconnCleanup(struct zconnCtx *ctx)
+{
+    if (!ctx->session.headers)
+        return; // Not initialised
+
+    if (g_zDebugMode && ctx->session.calls > 0)
+    {
+        // The first call always has to connect. Every call made without opening a new connection saved a handshake.
+        double avgHandshake = (ctx->session.connects > 0) ? ctx->session.handshakeTime / ctx->session.connects : 0.0;
+        printf("DEBUG: zconn %i calls in %.3fs, %li new connection%s (%.3fs handshaking), est. %.3fs saved by connection reuse\n",
+               ctx->session.calls, ctx->session.totalTime, ctx->session.connects, (ctx->session.connects == 1) ? "" : "s", ctx->session.handshakeTime,
+               (ctx->session.calls - ctx->session.connects) * avgHandshake);
+        printf("DEBUG: zconn %" CURL_FORMAT_CURL_OFF_T " bytes received for %zu bytes of responses (%.1f%%)\n", ctx->session.received, ctx->session.decoded,
+               (ctx->session.decoded > 0) ? 100.0 * ctx->session.received / ctx->session.decoded : 0.0);
+        printf("DEBUG: zconn %.3fs queued for the limits (longest %.3fs, average %.3fs), %i backoff%s, %i retr%s\n", ctx->limit.queued, ctx->limit.maxQueued,
+               ctx->limit.queued / ctx->session.calls, ctx->limit.backoffs, (ctx->limit.backoffs == 1) ? "" : "s", ctx->limit.retries, (ctx->limit.retries == 1) ? "y" : "ies");
+    }
+
+    if (ctx->session.curl)
+        curl_easy_cleanup(ctx->session.curl);
+    if (ctx->session.share)
+        curl_share_cleanup(ctx->session.share);
+    curl_slist_free_all(ctx->session.headers);
+    ctx->session.curl = NULL;
+    ctx->session.share = NULL;
+    ctx->session.headers = NULL;
+
+    pthread_mutex_lock(&curlGlobalLock);
+    if (--curlGlobalUsers == 0)
+        curl_global_cleanup();
+    pthread_mutex_unlock(&curlGlobalLock);
+}
+
+void zconnFree(struct zconnCtx *ctx)
+{
+    if (!ctx)
+        return;
+    zconnCleanup(ctx);
+    free(ctx);
+}
+
+/**
+ * Time until the limits allow another call, taking the call if allowed now.
+ * @param [in] ctx      client context.
+ * @return              0 if the call may be made now (and has been counted), otherwise the seconds to wait before asking again.
+ * */
+static double zconnLimitDelay(struct zconnCtx *ctx)
+{
+    struct zconnLimiter *l = &ctx->limit;
+    if (ctx->fixtureMode == FIXTURE_REPLAY)
+        return 0.0; // Nothing is sent to the end point.
+    double now = zconnNow();
+    if (now < l->holdUntil)
+        return l->holdUntil - now;
+    if (l->rate <= 0.0)
+        return 0.0;
+
+    double rate = l->rate * l->scale;
+    l->tokens += (now - l->refilled) * rate;
+    if (l->tokens > l->burst)
+        l->tokens = l->burst;
+    l->refilled = now;
+    if (l->tokens >= 1.0)
+    {
+        l->tokens -= 1.0;
+        return 0.0;
+    }
+    return (1.0 - l->tokens) / rate;
+}
+
+/**
+ * Number of calls the limits allow in flight at the same time.
+ * @param [in] ctx      client context.
+ * @param [in] wanted   number of calls the caller would like in flight.
+ * @return              number of calls allowed in flight. At least 1.
+ * */
+static int zconnLimitInFlight(struct zconnCtx *ctx, int wanted)
+{
+    if (ctx->limit.maxInFlight > 0)
+    {
+        int allowed = (int)(ctx->limit.maxInFlight * ctx->limit.scale);
+        if (allowed < wanted)
+            wanted = allowed;
+    }
+    return (wanted > 1) ? wanted : 1;
+}
+
+/**
+ * Wait until the limits allow another call, taking the call.
+ * @param [in] ctx      client context.
+ * @return              time waited (seconds).
+ * */
+static double zconnLimitWait(struct zconnCtx *ctx)
+{
+    double start = zconnNow();
+    double delay;
+    while ((delay = zconnLimitDelay(ctx)) > 0.0)
+    {
+        struct timespec ts = {(time_t)delay, (long)((delay - (time_t)delay) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+    return zconnNow() - start;
+}
+
+/**
+ * Latency baseline of an API method, added the first time the method completes.
+ * @param [in] l        limiter.
+ * @param [in] method   Zabbix API method name.
+ * @return              the baseline, or NULL if every slot is taken by other methods.
+ * */
+static struct zconnLatency *zconnLimitBaseline(struct zconnLimiter *l, char *method)
+{
+    int i;
+    for (i = 0; i < l->baselineCount; i++)
+    {
+        if (strcmp(l->baselines[i].method, method) == 0)
+            return &l->baselines[i];
+    }
+    if (l->baselineCount == LIMIT_METHODS)
+        return NULL;
+    struct zconnLatency *b = &l->baselines[l->baselineCount++];
+    snprintf(b->method, sizeof(b->method), "%s", method);
+    b->minLatency = 0.0;
+    return b;
+}
+
+/**
+ * Adapt the limits to the response of a completed call.
+ * A 429 or 5xx response scales the limits down and holds off every call, for the time given by Retry-After where the
+ * frontend sends one. Latency rising well above the lowest seen for the same method scales the limits down gently. Other
+ * responses scale the limits back up a step at a time.
+ * @param [in] ctx      client context.
+ * @param [in] curl     handle the call was made on.
+ * @param [in] method   Zabbix API method name, or the kind of call, selecting the latency baseline.
+ * @return              1 if the call was refused (429 or 5xx) and is worth retrying, 0 otherwise.
+ * */
+static int zconnLimitFeedback(struct zconnCtx *ctx, CURL *curl, char *method)
+{
+    struct zconnLimiter *l = &ctx->limit;
+    long code = 0;
+    double latency = 0.0;
+    curl_off_t retryAfter = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &latency);
+
+    if (code == 429 || code >= 500)
+    {
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter);
+        double hold = (retryAfter > 0) ? (double)retryAfter : l->backoff;
+        l->holdUntil = zconnNow() + hold;
+        l->backoff = (l->backoff * 2 < LIMIT_BACKOFF_MAX) ? l->backoff * 2 : LIMIT_BACKOFF_MAX;
+        l->scale = (l->scale / 2 > LIMIT_SCALE_MIN) ? l->scale / 2 : LIMIT_SCALE_MIN;
+        l->tokens = 0.0;
+        l->backoffs++;
+        if (g_zDebugMode)
+            printf("DEBUG: zconnLimit [%s] HTTP %li, holding off %.3fs, limits scaled to %.3f\n", method, code, hold, l->scale);
+        return 1;
+    }
+
+    l->backoff = LIMIT_BACKOFF_MIN;
+    struct zconnLatency *b = zconnLimitBaseline(l, method);
+    if (b && (b->minLatency == 0.0 || latency < b->minLatency))
+        b->minLatency = latency;
+    if (b && latency > b->minLatency * LIMIT_SLOW + 0.05)
+    {
+        // The frontend is slowing down. Ease off before it starts refusing calls.
+        l->scale = (l->scale * 0.75 > LIMIT_SCALE_MIN) ? l->scale * 0.75 : LIMIT_SCALE_MIN;
+        l->backoffs++;
+        if (g_zDebugMode)
+            printf("DEBUG: zconnLimit [%s] latency %.3fs against %.3fs, limits scaled to %.3f\n", method, latency, b->minLatency, l->scale);
+    }
+    else if (l->scale < 1.0)
+        l->scale = (l->scale + 0.1 < 1.0) ? l->scale + 0.1 : 1.0;
+    return 0;
+}
+
+/**
+ * Record the time a call waited for the limits.
+ * @param [in] ctx      client context.
+ * @param [in] queued   time waited (seconds).
+ * */
+static void zconnLimitQueued(struct zconnCtx *ctx, double queued)
+{
+    ctx->limit.queued += queued;
+    if (queued > ctx->limit.maxQueued)
+        ctx->limit.maxQueued = queued;
+}
+
+/**
+ * Record the timing and size of the last call made on a handle.
+ * The size is recorded both as received (compressed when the server compresses the response) and as decoded.
+ * @param [in]  ctx         client context.
+ * @param [in]  curl        handle the call was made on.
+ * @param [in]  method      Zabbix API method name, used for the debug output only.
+ * @param [in]  decoded     size of the decoded response that was fed into the parser.
+ * @param [in]  queued      time the call waited for the limits before it was sent (seconds).
+ * */
+static void zconnRecordTiming(struct zconnCtx *ctx, CURL *curl, char *method, size_t decoded, double queued)
+{
+    double total = 0.0, connect = 0.0, appConnect = 0.0;
+    long connects = 0;
+    curl_off_t received = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appConnect);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+
+    ctx->session.calls++;
+    ctx->session.totalTime += total;
+    ctx->session.received += received;
+    ctx->session.decoded += decoded;
+    if (connects > 0)
+    {
+        // appConnect is only non zero for TLS connections, and includes the TCP connect time.
+        ctx->session.connects += connects;
+        ctx->session.handshakeTime += (appConnect > connect) ? appConnect : connect;
+    }
+
+    zconnLimitQueued(ctx, queued);
+
+    if (g_zDebugMode)
+        printf("DEBUG: zconnResp [%s] %.3fs, queued %.3fs, %s connection (connect %.3fs, tls %.3fs), %" CURL_FORMAT_CURL_OFF_T " bytes received, %zu decoded\n",
+               method, total, queued, (connects > 0) ? "new" : "reused", connect, appConnect, received, decoded);
+}
+
+/**
+ * Build the JSON-RPC request object for a call to the Zabbix API.
+ * Takes ownership of params.
+ * @param [in]  ctx         client context.
+ * @param [in]  method      Zabbix API method name such as user.login or host.get
+ * @param [in]  params      parameters specific to a given method. For example user.login requires username and password
+ * @return                  request object or NULL if the call cannot be made.
+ * */
+static json_object *zconnRequest(struct zconnCtx *ctx, char *method, json_object *params)
+{
+    /* an authentication string would look like this  "{\"jsonrpc\": \"2.0\",\"method\": \"user.login\",\"params\": {\"user\": \"Admin\",\"password\": \"zabbix\"},\"id\": 1,\"auth\": null}";*/
+    // Methods called before there is a session to authorise them.
+    int noAuth = (strcmp("user.login", method) == 0 || strcmp("user.checkAuthentication", method) == 0);
+    if (ctx->authId[0] == '\0' && ctx->token[0] == '\0' && !noAuth)
+    {
+        fprintf(stderr, "Zabbix Response called for method other than authentication and without valid authentication value set.\n");
+        json_object_put(params);
+        return NULL;
+    }
+
+    ctx->connId++;
+
+    char connIdString[11];
+    sprintf(connIdString, "%i", ctx->connId);
+
+    json_object *jobj = json_object_new_object();
+    // JSON POST with parameters
+    json_object_object_add(jobj, "jsonrpc", json_object_new_string("2.0"));
+    json_object_object_add(jobj, "method", json_object_new_string(method));
+    if (params)
+        json_object_object_add(jobj, "params", params);
+
+    // Authentication ID should be null if attempting to authenticate. An API token is sent as a header instead.
+    if (noAuth)
+    {
+        json_object_object_add(jobj, "auth", json_object_new_null());
+    }
+    else if (ctx->token[0] == '\0')
+    {
+        json_object_object_add(jobj, "auth", json_object_new_string(ctx->authId));
+    }
+
+    json_object_object_add(jobj, "id", json_object_new_string(connIdString));
+
+    //printf("JSON request:\n%s\n", json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY_TAB));
+    return jobj;
+}
+
+/**
+ * Extract the result from the reply to a single call, reporting any error returned by the Zabbix API.
+ * @param [in]  ctx         client context.
+ * @param [in]  method      Zabbix API method name that was called.
+ * @param [in]  jobj        reply object for the call.
+ * @return                  result of the call (caller must put) or NULL if the call failed.
+ * */
+static json_object *zconnReplyResult(struct zconnCtx *ctx, char *method, json_object *jobj)
+{
+    struct json_object *result = NULL; // return object
+
+    // We got something from the remote server
+    struct json_object *zerr = NULL; // returned error
+    if (json_object_object_get_ex(jobj, "error", &zerr))
+    {
+        /* Error detected */
+        // TODO: Need to VALGRIND this bit
+        struct json_object *zerrMsg = json_object_object_get(zerr, "message");
+        struct json_object *zerrData = json_object_object_get(zerr, "data");
+        if (strcmp("user.checkAuthentication", method) != 0)
+            fprintf(stderr, "Error from Zabbix API. Message: %s, data: %s\n", json_object_get_string(zerrMsg), json_object_get_string(zerrData));
+        else if (g_zDebugMode)
+            printf("DEBUG: cached session rejected. Message: %s, data: %s\n", json_object_get_string(zerrMsg), json_object_get_string(zerrData)); // An expired session is expected
+    }
+    else
+    {
+        if (json_object_object_get_ex(jobj, "result", &result))
+        {
+            // Success
+            json_object_get(result); // Increment the reference counter so that we maintain the reference after we put the parent
+            if (strcmp("user.login", method) == 0)
+            {
+                // This is the response to the authentication query, so record the authentication response.
+                const char *authStr = json_object_get_string(result);
+                strcpy(ctx->authId, authStr);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * The method and parameters of a call, without the ID and authorisation that change from run to run.
+ * @param [in]  request     request object for the call.
+ * @return                  new object (caller must put).
+ * */
+static json_object *zconnFixtureCall(json_object *request)
+{
+    json_object *call = json_object_new_object();
+    json_object *jobjTmp;
+
+    if (json_object_object_get_ex(request, "method", &jobjTmp))
+        json_object_object_add(call, "method", json_object_get(jobjTmp));
+    if (json_object_object_get_ex(request, "params", &jobjTmp))
+        json_object_object_add(call, "params", json_object_get(jobjTmp));
+    return call;
+}
+
+/**
+ * Name of the fixture file holding the response to a request.
+ * The name is the method (or "batch") and a FNV-1a hash of the end point, methods and parameters, so the same request
+ * made in a later run finds the response recorded for it whatever its call IDs and session.
+ * @param [in]  ctx         client context.
+ * @param [in]  request     request object for a single call or array of them for a batch.
+ * @param [out] name        fixture file name.
+ * @param [in]  len         size of name.
+ * */
+static void zconnFixtureName(struct zconnCtx *ctx, json_object *request, char *name, size_t len)
+{
+    json_object *key;
+    json_object *jobjTmp;
+    const char *method = "batch";
+    const char *p;
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    if (json_object_is_type(request, json_type_array))
+    {
+        key = json_object_new_array();
+        for (i = 0; i < (int)json_object_array_length(request); i++)
+            json_object_array_add(key, zconnFixtureCall(json_object_array_get_idx(request, i)));
+    }
+    else
+    {
+        key = zconnFixtureCall(request);
+        if (json_object_object_get_ex(request, "method", &jobjTmp))
+            method = json_object_get_string(jobjTmp);
+    }
+
+    for (p = ctx->endpoint; *p != '\0'; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    for (p = json_object_to_json_string_ext(key, JSON_C_TO_STRING_PLAIN); *p != '\0'; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+
+    snprintf(name, len, "%s/%s-%016llx.json", ctx->fixtureDir, method, hash);
+    json_object_put(key);
+}
+
+/**
+ * Swap the IDs in the replies to a request between the IDs of the calls and their positions in the request.
+ * Fixtures hold positions so that a replayed response can be given the IDs of the calls it is replayed for.
+ * @param [in]     request      request object for a single call or array of them for a batch.
+ * @param [in,out] response     response to the request.
+ * @param [in]     toPosition   1 to replace the call IDs with positions, 0 to replace positions with the call IDs.
+ * */
+static void zconnFixtureIds(json_object *request, json_object *response, int toPosition)
+{
+    json_object *jobjTmp;
+    int i, j;
+
+    if (!json_object_is_type(request, json_type_array))
+    {
+        if (json_object_is_type(response, json_type_object) && json_object_object_get_ex(request, "id", &jobjTmp))
+            json_object_object_add(response, "id", (toPosition) ? json_object_new_int(0) : json_object_get(jobjTmp));
+        return;
+    }
+    if (!json_object_is_type(response, json_type_array))
+        return; // A batch refused as a whole has a single error with no ID.
+
+    for (i = 0; i < (int)json_object_array_length(response); i++)
+    {
+        json_object *jreply = json_object_array_get_idx(response, i);
+        if (!json_object_object_get_ex(jreply, "id", &jobjTmp))
+            continue;
+        if (toPosition)
+        {
+            const char *id = json_object_get_string(jobjTmp);
+            for (j = 0; j < (int)json_object_array_length(request); j++)
+            {
+                json_object *jcallId;
+                if (json_object_object_get_ex(json_object_array_get_idx(request, j), "id", &jcallId) && strcmp(id, json_object_get_string(jcallId)) == 0)
+                {
+                    json_object_object_add(jreply, "id", json_object_new_int(j));
+                    break;
+                }
+            }
+        }
+        else
+        {
+            j = json_object_get_int(jobjTmp);
+            if (j >= 0 && j < (int)json_object_array_length(request) &&
+                json_object_object_get_ex(json_object_array_get_idx(request, j), "id", &jobjTmp))
+                json_object_object_add(jreply, "id", json_object_get(jobjTmp));
+        }
+    }
+}
+
+/**
+ * Write the response to a request to the fixture directory, to be replayed by a later run.
+ * The file is readable by the owner only, as the session cache is, and the session ID returned by user.login is recorded
+ * as a placeholder, as it would still be live when the fixture is read.
+ * @param [in]  ctx         client context.
+ * @param [in]  request     request object for a single call or array of them for a batch.
+ * @param [in]  response    parsed response. Left as it was once written.
+ * */
+static void zconnFixtureRecord(struct zconnCtx *ctx, json_object *request, json_object *response)
+{
+    char name[512];
+    FILE *outfile;
+    json_object *jobjTmp;
+    json_object *session = NULL; // session ID taken out of a user.login response while it is written
+
+    zconnFixtureName(ctx, request, name, sizeof name);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    outfile = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (!outfile)
+    {
+        if (fd >= 0)
+            close(fd);
+        fprintf(stderr, "Could not record the response to %s\n", name);
+        return;
+    }
+
+    if (json_object_object_get_ex(request, "method", &jobjTmp) && strcmp(json_object_get_string(jobjTmp), "user.login") == 0 &&
+        json_object_object_get_ex(response, "result", &session))
+    {
+        json_object_get(session);
+        json_object_object_add(response, "result", json_object_new_string("recorded"));
+    }
+    zconnFixtureIds(request, response, 1);
+    fputs(json_object_to_json_string_ext(response, JSON_C_TO_STRING_PLAIN), outfile);
+    fclose(outfile);
+    zconnFixtureIds(request, response, 0);
+    if (session)
+        json_object_object_add(response, "result", session);
+
+    if (g_zDebugMode)
+        printf("DEBUG: zconnResp recorded to %s\n", name);
+}
+
+/**
+ * Feed the recorded response to a request into a response stream in place of sending the request.
+ * @param [in]  ctx         client context.
+ * @param [in]  request     request object for a single call or array of them for a batch.
+ * @param [in]  method      name of the call for the debug output
+ * @param [out] chunk       response stream the response is parsed into. Must have been initialised.
+ * @return                  1 if the response was replayed, 0 if none was recorded for the request.
+ * */
+static int zconnFixtureReplay(struct zconnCtx *ctx, json_object *request, char *method, struct ResponseStream *chunk)
+{
+    char name[512];
+
+    zconnFixtureName(ctx, request, name, sizeof name);
+    json_object *response = zconnReadJsonFile(name);
+    if (!response)
+    {
+        fprintf(stderr, "No recorded response for %s (%s)\n", method, name);
+        return 0;
+    }
+
+    zconnFixtureIds(request, response, 0);
+    const char *data = json_object_to_json_string_ext(response, JSON_C_TO_STRING_PLAIN);
+    size_t len = strlen(data);
+    int ok = zconnStreamFeed(chunk, data, len);
+    json_object_put(response);
+
+    ctx->session.calls++;
+    ctx->session.decoded += len;
+    if (g_zDebugMode)
+        printf("DEBUG: zconnResp [%s] replayed from %s, %zu bytes\n", method, name, len);
+    return ok;
+}
+
+/**
+ * Complete the response to a request and print it in debug mode.
+ * The response is recorded when recording.
+ * @param [in]  ctx         client context.
+ * @param [in]  request     request object for a single call or array of them for a batch.
+ * @param [in]  response    response stream that has received the complete response from the Zabbix API
+ * @return                  parsed response (caller must put) or NULL if it was not valid JSON.
+ * */
+static json_object *zconnParseResponse(struct zconnCtx *ctx, json_object *request, struct ResponseStream *response)
+{
+    json_object *jobj = zconnStreamEnd(response);
+
+    if (!jobj)
+        return NULL;
+
+    if (ctx->fixtureMode == FIXTURE_RECORD)
+        zconnFixtureRecord(ctx, request, jobj);
+
+    if (g_zDebugMode)
+    {
+        if (response->size < 5000)
+        {
+            printf("DEBUG: curl response size: %zu, curl response: %s\n", response->size, json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
+        }
+        else
+        {
+            printf("DEBUG: curl response size: %zu, peak RSS %li KB\n", response->size, zconnPeakRss());
+        }
+    }
+
+    if (g_zDebugMode)
+        printf("DEBUG: parseResult\n");
+
+    // Debug print (uncomment line below to see all API responses).
+    //printf("response:\n%s\n", json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY_TAB));
+    return jobj;
+}
+
+/**
+ * Parse the response to a call from the Zabbix API and extract the result.
+ * @param [in]  ctx         client context.
+ * @param [in]  request     request object for the call.
+ * @param [in]  method      Zabbix API method name that was called.
+ * @param [in]  response    response stream that has received the complete response from the Zabbix API
+ * @return                  result of the call (caller must put) or NULL if the call failed.
+ * */
+static json_object *zconnParseReply(struct zconnCtx *ctx, json_object *request, char *method, struct ResponseStream *response)
+{
+    json_object *jobj = zconnParseResponse(ctx, request, response);
+    if (!jobj)
+        return NULL;
+
+    json_object *result = zconnReplyResult(ctx, method, jobj);
+    json_object_put(jobj);
+    return result;
+}
+
+/**
+ * Post a request (a single call or a batch) on the session handle, or replay the response recorded for it when replaying.
+ * @param [in]  ctx         client context.
+ * @param [in]  jobj        request body
+ * @param [in]  method      name of the call for the debug output
+ * @param [out] chunk       response stream the response is parsed into. Must have been initialised.
+ * @return                  1 if the response was received, 0 if the transfer failed.
+ * */
+static int zconnPost(struct zconnCtx *ctx, json_object *jobj, char *method, struct ResponseStream *chunk)
+{
+    CURLcode res;
+
+    if (ctx->fixtureMode == FIXTURE_REPLAY)
+        return zconnFixtureReplay(ctx, jobj, method, chunk);
+
+    /* get the session handle. Created on first use if the caller has not already done so. */
+    if (!ctx->session.curl && !zconnInit(ctx))
+        return 0;
+    CURL *curl = ctx->session.curl;
+
+    const char *data = json_object_to_json_string(jobj);
+
+    /* post binary data */
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+
+    /* we pass our 'chunk' struct to the callback function */
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+
+    curl_easy_setopt(curl, CURLOPT_URL, ctx->endpoint);
+
+    int attempt;
+    for (attempt = 0;; attempt++)
+    {
+        double queued = zconnLimitWait(ctx);
+
+        if (g_zDebugMode)
+            printf("DEBUG: zconnResp.curl_easy_perform\n");
+
+        res = curl_easy_perform(curl); /* post away! */
+
+        if (g_zDebugMode)
+            printf("DEBUG: zconnResp.curl_easy_perform complete\n");
+        zconnRecordTiming(ctx, curl, method, chunk->size, queued);
+
+        if (zconnLimitFeedback(ctx, curl, method) && attempt < LIMIT_RETRIES)
+        {
+            // Refused by a busy frontend. Try again once the hold off has passed.
+            ctx->limit.retries++;
+            if (!zconnStreamReset(chunk))
+                return 0;
+            continue;
+        }
+
+        /* Check for errors */
+        if (res != CURLE_OK)
+        {
+            fprintf(stderr, "curl_easy_perform() failed: %s\n",
+                    curl_easy_strerror(res));
+            return 0;
+        }
+        break;
+    }
+    if (g_zDebugMode)
+        printf("DEBUG: zconnResp.curl_easy_perform CURLE_OK\n");
+    return 1;
+}
+
+/**
+ * Get a response from the zabbix API
+ * @param [in]  ctx         client context.
+ * @param [in]  method      Zabbix API method name such as user.login or host.get
+ * @param [in]  params      parameters specific to a given method. For example user.login requires username and password
+ * */
+json_object *zconnResp(struct zconnCtx *ctx, char *method, json_object *params)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: zconnResp [%s]\n",method);
+    struct json_object *result = NULL; // return object
+
+    json_object *jobj = zconnRequest(ctx, method, params);
+    if (!jobj)
+        return NULL;
+
+    // Parser for the response from the API
+    struct ResponseStream chunk;
+    if (!zconnStreamInit(&chunk))
+    {
+        fprintf(stderr, "Out of memory attempting to create response parser");
+        json_object_put(jobj);
+        return NULL;
+    }
+
+    /*
+    * Once posted, our chunk has parsed all chunk.size bytes of the response from the Zabbix API */
+    if (zconnPost(ctx, jobj, method, &chunk))
+        result = zconnParseReply(ctx, jobj, method, &chunk);
+
+    /* always cleanup. The handle itself is kept for the next call. */
+    json_object_put(jobj);
+    zconnStreamFree(&chunk);
+    return result;
+}
+
+/**
+ * Prepare an empty batch.
+ * */
+static void zconnBatchInit(struct zconnBatch *batch)
+{
+    batch->requests = json_object_new_array();
+    batch->results = NULL;
+    batch->count = 0;
+    batch->failed = 0;
+}
+
+/**
+ * Queue a call in a batch.
+ * @param [in]  ctx         client context.
+ * @param [in]  method      Zabbix API method name
+ * @param [in]  params      parameters for the method. Ownership is taken.
+ * @return                  index of the call in the batch, used to get its result once the batch has been run.
+ * */
+static int zconnBatchAdd(struct zconnCtx *ctx, struct zconnBatch *batch, char *method, json_object *params)
+{
+    json_object *jobj = zconnRequest(ctx, method, params);
+    if (!jobj)
+    {
+        batch->failed = 1; // The batch cannot be run without this call.
+        return -1;
+    }
+    json_object_array_add(batch->requests, jobj);
+    return batch->count++;
+}
+
+/**
+ * Hand the replies to a batch out to its calls, matching each reply to its call by ID.
+ * Replies are allowed to come back in any order (JSON-RPC 2.0 does not guarantee the order).
+ * @param [in]  ctx         client context.
+ * @param [in]  reply       array of replies returned for the batch.
+ * @return                  1 if every call succeeded, 0 if not.
+ * */
+static int zconnBatchReplies(struct zconnCtx *ctx, struct zconnBatch *batch, json_object *reply)
+{
+    int i;
+    int ok = 1;
+    json_object *jobjTmp;
+    json_object *index = json_object_new_object(); // call ID to position in the batch
+
+    for (i = 0; i < batch->count; i++)
+    {
+        json_object_object_get_ex(json_object_array_get_idx(batch->requests, i), "id", &jobjTmp);
+        json_object_object_add(index, json_object_get_string(jobjTmp), json_object_new_int(i));
+    }
+
+    if (!json_object_is_type(reply, json_type_array))
+    {
+        // A batch the server could not accept as a whole is answered with a single error.
+        zconnReplyResult(ctx, "batch", reply);
+        ok = 0;
+    }
+    else
+    {
+        for (i = 0; i < (int)json_object_array_length(reply); i++)
+        {
+            json_object *jreply = json_object_array_get_idx(reply, i);
+            if (!json_object_object_get_ex(jreply, "id", &jobjTmp) || !json_object_object_get_ex(index, json_object_get_string(jobjTmp), &jobjTmp))
+                continue;
+            int call = json_object_get_int(jobjTmp);
+            json_object_object_get_ex(json_object_array_get_idx(batch->requests, call), "method", &jobjTmp);
+            json_object_put(batch->results[call]);
+            batch->results[call] = zconnReplyResult(ctx, (char *)json_object_get_string(jobjTmp), jreply);
+        }
+        for (i = 0; i < batch->count; i++)
+            if (!batch->results[i])
+                ok = 0;
+    }
+    json_object_put(index);
+    return ok;
+}
+
+/**
+ * Parse the response to a batch and hand the results out to its calls.
+ * @param [in]  ctx         client context.
+ * @param [in]  chunk       response stream that has received the complete response to the batch.
+ * @return                  1 if every call succeeded, 0 if not.
+ * */
+static int zconnBatchComplete(struct zconnCtx *ctx, struct zconnBatch *batch, struct ResponseStream *chunk)
+{
+    int ok = 0;
+
+    batch->results = calloc(batch->count + 1, sizeof *batch->results);
+    if (!batch->results)
+    {
+        fprintf(stderr, "Out of memory attempting to create batch results");
+        return 0;
+    }
+
+    json_object *reply = zconnParseResponse(ctx, batch->requests, chunk);
+    if (reply)
+        ok = zconnBatchReplies(ctx, batch, reply);
+    json_object_put(reply);
+    return ok;
+}
+
+/**
+ * Send the calls queued in a batch as a single JSON-RPC batch request (one HTTP round trip).
+ * @return      1 if every call succeeded, 0 if not. The results of the calls that succeeded are available either way.
+ * */
+static int zconnBatchRun(struct zconnCtx *ctx, struct zconnBatch *batch)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: zconnBatchRun %i calls\n", batch->count);
+    int ok = 0;
+    char method[32];
+
+    if (batch->failed || batch->count == 0)
+        return (batch->failed) ? 0 : 1;
+
+    struct ResponseStream chunk;
+    if (!zconnStreamInit(&chunk))
+    {
+        fprintf(stderr, "Out of memory attempting to create response parser");
+        return 0;
+    }
+
+    snprintf(method, sizeof method, "batch of %i", batch->count);
+    if (zconnPost(ctx, batch->requests, method, &chunk))
+        ok = zconnBatchComplete(ctx, batch, &chunk);
+    zconnStreamFree(&chunk);
+    return ok;
+}
+
+/**
+ * Take the result of a call from a batch that has been run.
+ * @param [in]  call        index of the call returned by zconnBatchAdd.
+ * @return                  result of the call (caller must put) or NULL if the call failed.
+ * */
+static json_object *zconnBatchResult(struct zconnBatch *batch, int call)
+{
+    if (!batch->results || call < 0 || call >= batch->count)
+        return NULL;
+    json_object *result = batch->results[call];
+    batch->results[call] = NULL;
+    return result;
+}
+
+/**
+ * Free the calls and any results not taken from a batch.
+ * */
+static void zconnBatchFree(struct zconnBatch *batch)
+{
+    int i;
+    if (batch->results)
+        for (i = 0; i < batch->count; i++)
+            json_object_put(batch->results[i]);
+    free(batch->results);
+    json_object_put(batch->requests);
+    batch->results = NULL;
+    batch->requests = NULL;
+    batch->count = 0;
+}
+
+/**
+ * Reuse the session cached for a user, if the Zabbix server still accepts it.
+ * The session is checked with user.checkAuthentication, which is far cheaper for the server than a user.login.
+ * @param [in] ctx      client context.
+ * @param [in] key      user and end point the session was cached under.
+ * @return              1 if the cached session is valid and now in use, 0 if a login is needed.
+ * */
+static int zconnCachedSession(struct zconnCtx *ctx, const char *key)
+{
+    json_object *jobjTmp;
+    pthread_mutex_lock(&sessionFileLock);
+    json_object *sessions = zconnReadJsonFile(ctx->sessionFile);
+    pthread_mutex_unlock(&sessionFileLock);
+    if (!sessions || !json_object_object_get_ex(sessions, key, &jobjTmp) || json_object_get_string_len(jobjTmp) >= (int)sizeof ctx->authId)
+    {
+        json_object_put(sessions);
+        return 0;
+    }
+
+    char sessionId[sizeof ctx->authId];
+    strcpy(sessionId, json_object_get_string(jobjTmp));
+    json_object_put(sessions);
+
+    json_object *params = json_object_new_object();
+    json_object_object_add(params, "sessionid", json_object_new_string(sessionId));
+    json_object *result = zconnResp(ctx, "user.checkAuthentication", params);
+    if (!result)
+        return 0;
+    json_object_put(result);
+
+    strcpy(ctx->authId, sessionId);
+    if (g_zDebugMode)
+        printf("DEBUG: zconnAuth reusing cached session for %s\n", key);
+    return 1;
+}
+
+/**
+ * Record the session of a user in the session file, for the next run to reuse.
+ * The file is replaced in one step (written alongside and renamed) so that runs reading it at the same time never see
+ * part of a file. It is only readable by its owner as it holds live sessions.
+ * @param [in] ctx      client context.
+ * @param [in] key      user and end point to cache the session under.
+ * */
+static void zconnSaveSession(struct zconnCtx *ctx, const char *key)
+{
+    char tmpFile[sizeof ctx->sessionFile + 16];
+    snprintf(tmpFile, sizeof tmpFile, "%s.%ld", ctx->sessionFile, (long)getpid());
+
+    pthread_mutex_lock(&sessionFileLock);
+    json_object *sessions = zconnReadJsonFile(ctx->sessionFile);
+    if (!sessions || !json_object_is_type(sessions, json_type_object))
+    {
+        json_object_put(sessions);
+        sessions = json_object_new_object();
+    }
+    json_object_object_add(sessions, key, json_object_new_string(ctx->authId));
+
+    int fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *fp = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (!fp)
+    {
+        if (fd >= 0)
+            close(fd);
+        fprintf(stderr, "Could not open session file for writing\n");
+    }
+    else
+    {
+        fprintf(fp, "%s", json_object_to_json_string_ext(sessions, JSON_C_TO_STRING_PLAIN));
+        if (fclose(fp) != 0 || rename(tmpFile, ctx->sessionFile) != 0)
+        {
+            fprintf(stderr, "Could not write session file\n");
+            remove(tmpFile);
+        }
+    }
+    pthread_mutex_unlock(&sessionFileLock);
+    json_object_put(sessions);
+}
+
+int zconnAuth(struct zconnCtx *ctx, char *user, char *pw)
+{
+    // An API token needs no login. It is sent as a header with every call.
+    if (ctx->token[0] != '\0')
+        return 1;
+
+    // Reuse the session from a previous run where possible. Sessions are cached by user and end point.
+    char key[sizeof ctx->endpoint + 130];
+    snprintf(key, sizeof key, "%s@%s", user, ctx->endpoint);
+    if (ctx->sessionFile[0] != '\0' && zconnCachedSession(ctx, key))
+        return 1;
+
+    /*data = "{\"jsonrpc\": \"2.0\",\"method\": \"user.login\",\"params\": {\"user\": \"Admin\",\"password\": \"zabbix\"},\"id\": 1,\"auth\": null}";*/
+    json_object *params = json_object_new_object();
+
+    // Parameter list for the JSON POST
+    json_object_object_add(params, "user", json_object_new_string(user));
+    json_object_object_add(params, "password", json_object_new_string(pw));
+
+    json_object *result = zconnResp(ctx, "user.login", params);
+    int success = (result) ? 1 : 0;
+    json_object_put(result);
+
+    if (success && ctx->sessionFile[0] != '\0')
+        zconnSaveSession(ctx, key);
+    return success;
+}
+
+struct zMapCol zconnGetMaps(struct zconnCtx *ctx)
+{
+    // Get all maps from the server
+    struct zMapCol ret;
+    ret.count = 0;
+    ret.zMaps = NULL;
+
+    json_object *params = json_object_new_object();
+    json_object_object_add(params, "output", json_object_new_string("extend"));
+    json_object *result = zconnResp(ctx, "map.get", params);
+    json_object *jobjTmp;
+    if (result)
+    {
+
+        int count = json_object_array_length(result); // number of maps returned from API
+        int i;                                        // loop itterator
+        int strlen;                                   // string length
+        json_object *jMap;
+
+        ret.zMaps = malloc(count * sizeof(struct zMap));
+        if (!ret.zMaps)
+        {
+            // Return object with zero count.
+            json_object_put(result);
+            return ret;
+        }
+        ret.count = count;
+
+        for (i = 0; i < count; i++)
+        {
+            jMap = json_object_array_get_idx(result, i);
+
+            json_object_object_get_ex(jMap, "sysmapid", &jobjTmp);
+            ret.zMaps[i].sysId = json_object_get_int(jobjTmp);
+
+            // copy map name to new memory as the json_object_put will release the memory.
+            json_object_object_get_ex(jMap, "name", &jobjTmp);
+            strlen = json_object_get_string_len(jobjTmp);
+            ret.zMaps[i].name = malloc(strlen + 1);
+            if (ret.zMaps[i].name)
+            {
+                if (strlen > 0)
+                {
+                    strcpy(ret.zMaps[i].name, json_object_get_string(jobjTmp));
+                }
+                else
+                {
+                    ret.zMaps[i].name = '\0';
+                }
+            }
+            else
+            {
+                json_object_put(result);
+                fprintf(stderr, "Out of memory attempting to create extra space for maps returned from Zabbix.");
+                return ret;
+            }
+        }
+
+        json_object_put(result);
+        return ret;
+    }
+    else
+    {
+        return ret;
+    }
+}
+
+/**
+ * Find a map by name.
+ * @param [in] ctx          client context.
+ * @param [in] name         name of the map
+ * @param [in] withLayout   if 1 then the map size, selements and links are included, otherwise just the map ID.
+ * @return                  map.get result, an array holding the map or an empty array if there is no map of that name.
+ *                          NULL if the call fails. Caller must put.
+ * */
+static json_object *zconnFindMap(struct zconnCtx *ctx, char *name, int withLayout)
+{
+    json_object *params = json_object_new_object();
+    json_object *outputParam = json_object_new_array_ext(5);
+    json_object *filterParam = json_object_new_object();
+
+    json_object_array_add(outputParam, json_object_new_string("sysmapid"));
+    json_object_array_add(outputParam, json_object_new_string("name"));
+    json_object_object_add(filterParam, "name", json_object_new_string(name));
+    json_object_object_add(params, "output", outputParam);
+    json_object_object_add(params, "filter", filterParam);
+
+    if (withLayout)
+    {
+        json_object *selementsParam = json_object_new_array_ext(7);
+        json_object *linksParam = json_object_new_array_ext(4);
+
+        json_object_array_add(outputParam, json_object_new_string("width"));
+        json_object_array_add(outputParam, json_object_new_string("height"));
+        json_object_array_add(outputParam, json_object_new_string("label_type"));
+
+        json_object_array_add(selementsParam, json_object_new_string("selementid"));
+        json_object_array_add(selementsParam, json_object_new_string("elementtype"));
+        json_object_array_add(selementsParam, json_object_new_string("elements"));
+        json_object_array_add(selementsParam, json_object_new_string("iconid_off"));
+        json_object_array_add(selementsParam, json_object_new_string("label"));
+        json_object_array_add(selementsParam, json_object_new_string("x"));
+        json_object_array_add(selementsParam, json_object_new_string("y"));
+
+        json_object_array_add(linksParam, json_object_new_string("linkid"));
+        json_object_array_add(linksParam, json_object_new_string("selementid1"));
+        json_object_array_add(linksParam, json_object_new_string("selementid2"));
+        json_object_array_add(linksParam, json_object_new_string("label"));
+
+        json_object_object_add(params, "selectSelements", selementsParam);
+        json_object_object_add(params, "selectLinks", linksParam);
+    }
+    return zconnResp(ctx, "map.get", params);
+}
+
+void zconnDeleteMapById(struct zconnCtx *ctx, int id)
+{
+    // Delete map by ID
+    json_object *idArr = json_object_new_array_ext(1);
+    json_object_array_add(idArr, json_object_new_int(id));
+    json_object *response = zconnResp(ctx, "map.delete", idArr);
+    json_object_put(response);
+}
+
+void zconnDeleteMapByName(struct zconnCtx *ctx, char *name)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: zconnDeleteMapByName [%s]\n",name);
+    // Delete map by name
+    json_object *maps = zconnFindMap(ctx, name, 0);
+    json_object *jobjTmp;
+
+    if (maps && json_object_array_length(maps) > 0)
+    {
+        // match found
+        json_object_object_get_ex(json_object_array_get_idx(maps, 0), "sysmapid", &jobjTmp);
+        zconnDeleteMapById(ctx, json_object_get_int(jobjTmp));
+    }
+    json_object_put(maps);
+}
+
+struct linkedDevice zconnNewLinkedDevice()
+{
+    // Blank copy of Linked Device structure
+    struct linkedDevice ret;
+    ret.msap = 0;
+    ret.locPortName = 0; // empty string
+    ret.remChassisId = 0;
+    ret.remChassisIdType = 0; // invalid enum
+    ret.remHostName = 0;
+    ret.remHostDesc = 0;
+    ret.remPortId = 0;
+    ret.remPortIdType = 0; // invalid enum
+    ret.remPortDesc = 0;
+    return ret;
+}
+
+struct host zconnNewHost()
+{
+    // Blank copy of Host structure
+    struct host ret;
+    ret.id = 0;
+    ret.zabbixId = 0;
+    ret.name = 0; // empty string
+    ret.interfaces = NULL;
+    ret.interfaceCount = 0;
+    ret.devicesCount = 0;
+    ret.linkedDevices = NULL;
+    ret.chassisId = 0;
+    ret.chassisIdType = 0;
+    ret.sysDesc = 0;
+    return ret;
+}
+
+/**
+ * Index of the linked devices of the host being parsed, by MSAP number.
+ * Open addressing with linear probing. Slots are stamped with the host they belong to, so moving on to the next host empties
+ * the index without clearing it.
+ * */
+struct msapIndex
+{
+    struct
+    {
+        int host;  /**< host the slot belongs to. Slots of any other host are empty. */
+        int msap;  /**< MSAP number */
+        int index; /**< position of the linked device in the host's linkedDevices */
+    } *slots;
+    int size;  /**< number of slots. A power of 2. */
+    int count; /**< slots in use for the current host */
+    int host;  /**< host being indexed */
+};
+
+/**
+ * Slot of an MSAP number in the index: the slot holding it, or the empty slot it would go in.
+ * */
+static int zconnMsapSlot(struct msapIndex *ix, int msap)
+{
+    int i = (int)(((unsigned int)msap * 2654435761u) & (unsigned int)(ix->size - 1)); // Knuth's multiplicative hash
+    while (ix->slots[i].host == ix->host && ix->slots[i].msap != msap)
+        i = (i + 1) & (ix->size - 1);
+    return i;
+}
+
+/**
+ * Allocate an empty index.
+ * @param [in] size     number of slots. Must be a power of 2.
+ * @return              1 if success, 0 if out of memory.
+ * */
+static int zconnMsapInit(struct msapIndex *ix, int size)
+{
+    int i;
+    void *slots = calloc(size, sizeof *ix->slots);
+    if (!slots)
+        return 0;
+    free(ix->slots);
+    ix->slots = slots;
+    ix->size = size;
+    ix->count = 0;
+    for (i = 0; i < size; i++)
+        ix->slots[i].host = -1;
+    return 1;
+}
+
+/**
+ * Start indexing the linked devices of a new host.
+ * */
+static void zconnMsapReset(struct msapIndex *ix, int host)
+{
+    ix->host = host;
+    ix->count = 0;
+}
+
+/**
+ * Find the linked device with an MSAP number.
+ * @return      position of the linked device in the host's linkedDevices, or -1 if the host has none with the MSAP.
+ * */
+static int zconnMsapFind(struct msapIndex *ix, int msap)
+{
+    int i = zconnMsapSlot(ix, msap);
+    return (ix->slots[i].host == ix->host) ? ix->slots[i].index : -1;
+}
+
+/**
+ * Add a linked device to the index, doubling the index once it is half full.
+ * @param [in] h        host being indexed, whose linked devices are put back in the index when it grows.
+ * @param [in] index    position of the new linked device in the host's linkedDevices.
+ * @return              1 if success, 0 if out of memory.
+ * */
+static int zconnMsapAdd(struct msapIndex *ix, struct host *h, int index)
+{
+    int i;
+
+    if ((ix->count + 1) * 2 > ix->size)
+    {
+        if (!zconnMsapInit(ix, ix->size * 2))
+            return 0;
+        for (i = 0; i < index; i++)
+            zconnMsapAdd(ix, h, i); // Cannot grow again, the new size holds twice as many.
+    }
+
+    i = zconnMsapSlot(ix, h->linkedDevices[index].msap);
+    ix->slots[i].host = ix->host;
+    ix->slots[i].msap = h->linkedDevices[index].msap;
+    ix->slots[i].index = index;
+    ix->count++;
+    return 1;
+}
+
+/**
+ * Hosts being parsed by a pool of threads. The threads take blocks of hosts in turn until none are left, so a thread given
+ * hosts with few items goes on to take more.
+ * The hosts are either a json-c array or, when read straight from a file, spans of the raw JSON text.
+ * */
+struct zconnHostParse
+{
+    json_object *jhosts; /**< array of hosts, only read by the threads. NULL when parsing raw JSON. */
+    char **raw;          /**< start of each host in the raw JSON, with one more entry marking the end of the last. NULL when parsing a json-c array. */
+    struct host *hosts;  /**< parsed hosts, preallocated with one per array entry. Each thread fills the entries of its blocks. */
+    int count;           /**< number of hosts */
+    atomic_int next;     /**< first host of the next block to be taken */
+};
+
+/**
+ * A thread parsing hosts. Everything it changes is its own, or in the entries of hosts it has taken.
+ * */
+struct zconnHostParser
+{
+    struct zconnHostParse *parse;
+    struct zarena *arena;      /**< arena the linked devices are taken from. Each thread has its own, as an arena is not thread safe. */
+    pthread_t thread;
+    int started;               /**< set if the thread was started */
+    struct msapIndex msapIx;   /**< linked devices of the host being parsed by MSAP */
+    int ldSize;                /**< linked devices allocated for the host being parsed. Grows geometrically. */
+    int ifSize;                /**< interfaces allocated for the host being parsed. Grows geometrically. */
+};
+
+/**
+ * Integer value of an item or host ID held as text, as json_object_get_int gives for a string.
+ * Anything that does not start with a number is 0.
+ * */
+static int zconnValueInt(const char *value)
+{
+    char *end;
+    long long v = strtoll(value, &end, 10);
+    if (end == value)
+        return 0;
+    if (v > INT32_MAX)
+        return INT32_MAX;
+    if (v < INT32_MIN)
+        return INT32_MIN;
+    return (int)v;
+}
+
+/**
+ * Start parsing a host.
+ * @param [in] i    position of the host in the array, used to stamp the linked devices index.
+ * */
+static void zconnStartHost(struct zconnHostParser *parser, struct host *h, int i)
+{
+    *h = zconnNewHost();
+    parser->ldSize = 0;
+    parser->ifSize = 0;
+    zconnMsapReset(&parser->msapIx, i);
+}
+
+/**
+ * Finish parsing a host, giving back the unused parts of its interfaces and linked devices buffers to the arena for the
+ * next host. Shrinking does not move them, and only gives back the last thing taken from the arena.
+ * */
+static void zconnEndHost(struct zconnHostParser *parser, struct host *h)
+{
+    if (h->devicesCount > 0 && h->devicesCount < parser->ldSize)
+    {
+        h->linkedDevices = zarenaRealloc(parser->arena, h->linkedDevices,
+                                         parser->ldSize * sizeof(struct linkedDevice),
+                                         h->devicesCount * sizeof(struct linkedDevice));
+    }
+    if (h->interfaceCount > 0 && h->interfaceCount < parser->ifSize)
+    {
+        h->interfaces = zarenaRealloc(parser->arena, h->interfaces,
+                                      parser->ifSize * sizeof(struct ipAddr),
+                                      h->interfaceCount * sizeof(struct ipAddr));
+    }
+}
+
+/**
+ * Add an interface IP address to a host. The address is parsed once here, so later stages work on it in binary.
+ * Interfaces without an IP address (e.g. those using DNS only) are left out.
+ * @param [in] ip   the IP address as text.
+ * */
+static void zconnAddInterface(struct zconnHostParser *parser, struct host *h, const char *ip)
+{
+    struct ipAddr addr;
+
+    if (!ip || !ipParse(ip, &addr))
+    {
+        if (g_zDebugMode && ip && *ip)
+            printf("DEBUG: host %i interface '%s' is not an IP address\n", h->id, ip);
+        return;
+    }
+    if (h->interfaceCount == parser->ifSize)
+    {
+        // Most hosts have a single interface.
+        parser->ifSize = (parser->ifSize > 0) ? parser->ifSize * 2 : 1;
+        struct ipAddr *tmpPtr = zarenaRealloc(parser->arena, h->interfaces,
+                                              h->interfaceCount * sizeof(struct ipAddr),
+                                              parser->ifSize * sizeof(struct ipAddr));
+        if (!tmpPtr)
+        {
+            fprintf(stderr, "Out of memory while attempting to expand the interfaces buffer");
+            exit(1); // failure
+        }
+        h->interfaces = tmpPtr;
+    }
+    h->interfaces[h->interfaceCount++] = addr;
+}
+
+/**
+ * Add an item of a host: either a field of one of its linked devices or of the host itself.
+ * @param [in] name     item name. Not empty.
+ * @param [in] key      item key, or NULL if the item has none.
+ * @param [in] value    last value of the item, or NULL if the item has none.
+ * */
+static void zconnAddItem(struct zconnHostParser *parser, struct host *h, const char *name, const char *key, const char *value)
+{
+    struct itemClass ic;     // what the item key or name says about the item
+    int keyed;               // set if the item was classified by its key
+    int msap;                // Device Media Service Access Point for the local connection of the remote port.
+    struct linkedDevice *ld; // Linked Device
+    int k;
+
+    // Classify the item: MSAP number (set if this is a reference to a remote connection), local port and the
+    // field the item holds. By its key where possible as the key format is fixed, otherwise from its name in one pass.
+    keyed = key && classifyItemKey(key, &ic);
+    if (!keyed)
+        classifyItemName(name, &ic);
+    msap = ic.msap;
+
+    if (msap > 0)
+    {
+        // MSAP value parsed. Check to see if LinkedDevices already contains a reference to the matching remote device.
+        // This is acheived by looking the MSAP up in the index of the host's linked devices.
+        k = zconnMsapFind(&parser->msapIx, msap);
+        if (k >= 0)
+            ld = &(h->linkedDevices[k]); // matching linked device found already recorded against host
+        else
+        {
+            // Linked device was not found so we need to create it. The buffer doubles when full so that a host
+            // with many neighbours is not copied once for each of them.
+            if (h->devicesCount == parser->ldSize)
+            {
+                parser->ldSize = (parser->ldSize > 0) ? parser->ldSize * 2 : 4;
+                struct linkedDevice *tmpPtr = zarenaRealloc(parser->arena, h->linkedDevices,
+                                                            h->devicesCount * sizeof(struct linkedDevice),
+                                                            parser->ldSize * sizeof(struct linkedDevice));
+                if (!tmpPtr)
+                {
+                    fprintf(stderr, "Out of memory while attempting to expand the linked devices buffer");
+                    exit(1); // failure
+                }
+                h->linkedDevices = tmpPtr;
+            }
+            h->devicesCount++;
+            h->linkedDevices[h->devicesCount - 1] = zconnNewLinkedDevice();
+
+            // populate new linked Device - MSAP
+            ld = &(h->linkedDevices[h->devicesCount - 1]);
+            ld->msap = msap;
+            if (!zconnMsapAdd(&parser->msapIx, h, h->devicesCount - 1))
+            {
+                fprintf(stderr, "Out of memory while attempting to expand the linked devices index");
+                exit(1); // failure
+            }
+
+            // populate new linked Device - Local Port Details. The key only has the port number, so the port name
+            // is taken from the item name where it has one.
+            if (keyed)
+                findItemPort(name, &ic);
+            if (ic.port)
+                ld->locPortName = zstrInternLen(ic.port, ic.portLen);
+        }
+        // Copy the value into the field of the linked devices struct the item name says it holds.
+        if (ic.field != itemField_None && value)
+        {
+            switch (ic.field)
+            {
+            case itemField_RemChassisIdType:
+                ld->remChassisIdType = zconnValueInt(value);
+                break;
+            case itemField_RemChassisId:
+                ld->remChassisId = zstrIntern(value);
+                break;
+            case itemField_RemHostDesc:
+                ld->remHostDesc = zstrIntern(value);
+                break;
+            case itemField_RemHostName:
+                ld->remHostName = zstrIntern(value);
+                break;
+            case itemField_RemPortIdType:
+                ld->remPortIdType = zconnValueInt(value);
+                break;
+            case itemField_RemPortId:
+                ld->remPortId = zstrIntern(value);
+                break;
+            case itemField_RemPortDesc:
+                ld->remPortDesc = zstrIntern(value);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    else
+    {
+        // MSAP not found or not valid. Data probably relates to the local host device instead.
+        if (ic.field != itemField_None && value)
+        {
+            switch (ic.field)
+            {
+            case itemField_ChassisIdType:
+                h->chassisIdType = zconnValueInt(value);
+                break;
+            case itemField_ChassisId:
+                h->chassisId = zstrIntern(value);
+                break;
+            case itemField_SysDesc: // Not used by Zabbix Mapper directly but useful to the bitmap renderer if used.
+                h->sysDesc = zstrIntern(value);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Parse a host from its json-c object.
+ * @param [in] i    position of the host in the array.
+ * */
+static void zconnParseHost(struct zconnHostParser *parser, json_object *jhost, struct host *h, int i)
+{
+    int j; // loop itterator.
+    json_object *jobjTmp;
+    json_object *interface;
+    json_object *interfaceIp;
+    int interfaceCount;
+    int itemCount;
+    json_object *jitem;     // host item, not just any random item :)
+    json_object *jitems;    // Host items collection.
+    json_object *jitemName; // Name of a given item
+    json_object *jitemKey;  // Key of a given item
+    const char *value;
+
+    zconnStartHost(parser, h, i);
+    if (json_object_object_get_ex(jhost, "hostid", &jobjTmp))
+        h->id = json_object_get_int(jobjTmp);
+    h->zabbixId = h->id; // Copy the device Id and host Id as they are the same for hosts pulled FROM Zabbix
+
+    if (json_object_object_get_ex(jhost, "host", &jobjTmp))
+        h->name = zstrIntern(json_object_get_string(jobjTmp));
+
+    if (json_object_object_get_ex(jhost, "interfaces", &jobjTmp))
+    {
+        // IP addresses
+        interfaceCount = json_object_array_length(jobjTmp);
+        for (j = 0; j < interfaceCount; j++)
+        {
+            interface = json_object_array_get_idx(jobjTmp, j);
+            if (json_object_object_get_ex(interface, "ip", &interfaceIp))
+                zconnAddInterface(parser, h, json_object_get_string(interfaceIp));
+        }
+    }
+
+    if (json_object_object_get_ex(jhost, "items", &jitems))
+    {
+        // host items collection
+        itemCount = json_object_array_length(jitems);
+        for (j = 0; j < itemCount; j++)
+        {
+            jitem = json_object_array_get_idx(jitems, j);
+            if (json_object_object_get_ex(jitem, "name", &jitemName) && json_object_get_string_len(jitemName) > 0)
+            {
+                value = NULL;
+                if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
+                    value = (jobjTmp) ? json_object_get_string(jobjTmp) : ""; // null is taken as empty
+                zconnAddItem(parser, h, json_object_get_string(jitemName),
+                             json_object_object_get_ex(jitem, "key_", &jitemKey) ? json_object_get_string(jitemKey) : NULL,
+                             value);
+            }
+        }
+    }
+    zconnEndHost(parser, h);
+}
+
+/**
+ * A value found in raw JSON.
+ * */
+struct zconnScanned
+{
+    char *start; /**< first character. For a string, the one after the opening quote. NULL if the value was not found. */
+    char *end;   /**< one after the last character. For a string, the closing quote. */
+    int string;        /**< set if the value is a string */
+    int escaped;       /**< set if the string has escapes */
+};
+
+/**
+ * Skip white space in raw JSON.
+ * */
+static char *zconnScanSpace(char *p, char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+/**
+ * Skip a string in raw JSON.
+ * @param [in] p        the opening quote.
+ * @param [out] v       set to the contents of the string. May be NULL.
+ * @return              the character after the closing quote, or NULL if the string is not terminated.
+ * */
+static char *zconnScanString(char *p, char *end, struct zconnScanned *v)
+{
+    char *start = ++p;
+    char *q;
+    int n;
+
+    // The closing quote is the first without an odd number of backslashes before it. memchr finds quotes far faster than
+    // looking at each character in turn.
+    while ((q = memchr(p, '"', end - p)))
+    {
+        for (n = 0; q - n > start && q[-n - 1] == '\\'; n++)
+            ;
+        if (n % 2 == 0)
+            break;
+        p = q + 1;
+    }
+    if (!q)
+        return NULL;
+    if (v)
+    {
+        v->start = start;
+        v->end = q;
+        v->string = 1;
+        v->escaped = (memchr(start, '\\', q - start) != NULL);
+    }
+    return q + 1;
+}
+
+/**
+ * Characters that matter when skipping over an object or array in raw JSON.
+ * */
+static const char zconnScanSpecial[256] = {['"'] = 1, ['{'] = 1, ['}'] = 1, ['['] = 1, [']'] = 1};
+
+/**
+ * Skip a value in raw JSON, of any type. Objects and arrays are skipped by counting brackets, without looking at what is in them.
+ * @param [in] p        the first character of the value.
+ * @param [out] v       set to the text of the value. May be NULL.
+ * @return              the character after the value, or NULL if it is not valid.
+ * */
+static char *zconnScanValue(char *p, char *end, struct zconnScanned *v)
+{
+    char *start = p;
+    int depth = 0;
+
+    if (p >= end)
+        return NULL;
+    if (*p == '"')
+        return zconnScanString(p, end, v);
+    if (*p == '{' || *p == '[')
+    {
+        do
+        {
+            if (*p == '"')
+            {
+                if (!(p = zconnScanString(p, end, NULL)))
+                    return NULL;
+            }
+            else
+            {
+                if (*p == '{' || *p == '[')
+                    depth++;
+                else if (*p == '}' || *p == ']')
+                    depth--;
+                p++;
+            }
+            while (depth > 0 && p < end && !zconnScanSpecial[(unsigned char)*p])
+                p++;
+        } while (depth > 0 && p < end);
+        if (depth > 0)
+            return NULL;
+    }
+    else
+    {
+        // number, true, false or null
+        while (p < end && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || *p == '-' || *p == '+' || *p == '.' || *p == 'E'))
+            p++;
+        if (p == start)
+            return NULL;
+    }
+    if (v)
+    {
+        v->start = start;
+        v->end = p;
+        v->string = 0;
+        v->escaped = 0;
+    }
+    return p;
+}
+
+/**
+ * Append a character to a text buffer as UTF-8.
+ * */
+static char *zconnPutUtf8(char *out, unsigned int c)
+{
+    if (c < 0x80)
+        *out++ = (char)c;
+    else if (c < 0x800)
+    {
+        *out++ = (char)(0xc0 | (c >> 6));
+        *out++ = (char)(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000)
+    {
+        *out++ = (char)(0xe0 | (c >> 12));
+        *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (c & 0x3f));
+    }
+    else
+    {
+        *out++ = (char)(0xf0 | (c >> 18));
+        *out++ = (char)(0x80 | ((c >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (c & 0x3f));
+    }
+    return out;
+}
+
+/**
+ * Read the 4 hex digits of a \u escape.
+ * @return      the code unit, or -1 if they are not hex digits.
+ * */
+static int zconnHex4(char *p, char *end)
+{
+    int i, c = 0;
+    if (end - p < 4)
+        return -1;
+    for (i = 0; i < 4; i++)
+    {
+        c <<= 4;
+        if (p[i] >= '0' && p[i] <= '9')
+            c |= p[i] - '0';
+        else if (p[i] >= 'a' && p[i] <= 'f')
+            c |= p[i] - 'a' + 10;
+        else if (p[i] >= 'A' && p[i] <= 'F')
+            c |= p[i] - 'A' + 10;
+        else
+            return -1;
+    }
+    return c;
+}
+
+/**
+ * Get the text of a value found in raw JSON, as json_object_get_string gives it. Strings have their escapes decoded,
+ * null is empty and anything else is its JSON text.
+ * The text is decoded and terminated where it lies in the JSON, as decoding never makes it longer. So no copy is made, but
+ * the value must only be asked for once the scanner is past the end of it, as the character after the value is overwritten.
+ * @param [out] len     set to the length of the text.
+ * @return              the text, terminated, or NULL if the value was not found.
+ * */
+static char *zconnScanText(struct zconnScanned *v, size_t *len)
+{
+    char *text = v->start;
+    char *p = v->start;
+    char *out;
+    int c, lo;
+
+    if (!p)
+        return NULL;
+    if (!v->string && v->end - p == 4 && memcmp(p, "null", 4) == 0)
+        p = v->end;
+    out = text;
+
+    if (!v->escaped)
+        out += v->end - p;
+    else
+    {
+        while (p < v->end)
+        {
+            if (*p != '\\')
+            {
+                *out++ = *p++;
+                continue;
+            }
+            p++;
+            switch (*p++)
+            {
+            case 'b':
+                *out++ = '\b';
+                break;
+            case 'f':
+                *out++ = '\f';
+                break;
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 'r':
+                *out++ = '\r';
+                break;
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'u':
+                if ((c = zconnHex4(p, v->end)) < 0)
+                    break;
+                p += 4;
+                if (c >= 0xd800 && c < 0xdc00 && v->end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    (lo = zconnHex4(p + 2, v->end)) >= 0xdc00 && lo < 0xe000)
+                {
+                    // surrogate pair
+                    c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                    p += 6;
+                }
+                out = zconnPutUtf8(out, c);
+                break;
+            default:
+                *out++ = p[-1]; // \" \\ \/
+                break;
+            }
+        }
+    }
+    *out = '\0';
+    *len = out - text;
+    return text;
+}
+
+/**
+ * Check if a key found in raw JSON is a given name.
+ * */
+static int zconnScanKeyIs(struct zconnScanned *k, char *name, size_t len)
+{
+    return (size_t)(k->end - k->start) == len && memcmp(k->start, name, len) == 0;
+}
+
+/**
+ * Scan the members of a JSON object in raw JSON one at a time.
+ * @param [in,out] p    start of the object, moved past each member in turn.
+ * @param [out] key     set to the key of the member.
+ * @param [out] value   set to the first character of the value of the member.
+ * @return              1 if a member was found, 0 at the end of the object, -1 if the object is not valid.
+ * */
+static int zconnScanMember(char **p, char *end, struct zconnScanned *key, char **value)
+{
+    char *q = zconnScanSpace(*p, end);
+
+    if (q < end && (*q == '{' || *q == ','))
+        q = zconnScanSpace(q + 1, end);
+    if (q < end && *q == '}')
+    {
+        *p = q + 1;
+        return 0;
+    }
+    if (q >= end || *q != '"' || !(q = zconnScanString(q, end, key)))
+        return -1;
+    q = zconnScanSpace(q, end);
+    if (q >= end || *q != ':')
+        return -1;
+    *value = zconnScanSpace(q + 1, end);
+    *p = *value;
+    return 1;
+}
+
+/**
+ * Scan the elements of a JSON array in raw JSON one at a time.
+ * @param [in,out] p    start of the array, moved to each element in turn.
+ * @return              1 if an element was found, 0 at the end of the array, -1 if the array is not valid.
+ * */
+static int zconnScanElement(char **p, char *end)
+{
+    char *q = zconnScanSpace(*p, end);
+
+    if (q < end && (*q == '[' || *q == ','))
+        q = zconnScanSpace(q + 1, end);
+    if (q < end && *q == ']')
+    {
+        *p = q + 1;
+        return 0;
+    }
+    if (q >= end)
+        return -1;
+    *p = q;
+    return 1;
+}
+
+/**
+ * Scan an item of a host in raw JSON. The members used are remembered and then added as one, as they can be in any order.
+ * @param [in] p    start of the item.
+ * @return          the character after the item, or NULL if it is not valid.
+ * */
+static char *zconnScanItem(struct zconnHostParser *parser, struct host *h, char *p, char *end)
+{
+    struct zconnScanned key, name = {NULL}, itemKey = {NULL}, value = {NULL};
+    struct zconnScanned *v;
+    char *val;
+    char *nameText, *keyText, *valueText;
+    size_t len;
+    int r;
+
+    if (*p != '{')
+        return zconnScanValue(p, end, NULL);
+    while ((r = zconnScanMember(&p, end, &key, &val)) > 0)
+    {
+        v = NULL;
+        if (zconnScanKeyIs(&key, "name", 4))
+            v = &name;
+        else if (zconnScanKeyIs(&key, "key_", 4))
+            v = &itemKey;
+        else if (zconnScanKeyIs(&key, "lastvalue", 9))
+            v = &value;
+        if (!(p = zconnScanValue(val, end, v)))
+            return NULL;
+    }
+    if (r < 0)
+        return NULL;
+
+    // Only items with a name, as a string, are used.
+    if (name.start && name.string && name.end > name.start)
+    {
+        nameText = zconnScanText(&name, &len);
+        keyText = zconnScanText(&itemKey, &len);
+        valueText = zconnScanText(&value, &len);
+        zconnAddItem(parser, h, nameText, keyText, valueText);
+    }
+    return p;
+}
+
+/**
+ * Scan an interface of a host in raw JSON, adding its IP address to the host.
+ * @param [in] p    start of the interface.
+ * @return          the character after the interface, or NULL if it is not valid.
+ * */
+static char *zconnScanInterface(struct zconnHostParser *parser, struct host *h, char *p, char *end)
+{
+    struct zconnScanned key, ip = {NULL};
+    char *val;
+    size_t len;
+    int r;
+
+    if (*p != '{')
+        return zconnScanValue(p, end, NULL);
+    while ((r = zconnScanMember(&p, end, &key, &val)) > 0)
+    {
+        if (!(p = zconnScanValue(val, end, zconnScanKeyIs(&key, "ip", 2) ? &ip : NULL)))
+            return NULL;
+    }
+    if (r < 0)
+        return NULL;
+    zconnAddInterface(parser, h, zconnScanText(&ip, &len));
+    return p;
+}
+
+/**
+ * Parse a host from raw JSON, without building json-c objects. Only the members used by the mapper are looked at,
+ * the rest are skipped over.
+ * @param [in] p    start of the host.
+ * @param [in] end  end of the host.
+ * @param [in] i    position of the host in the array.
+ * */
+static void zconnScanHost(struct zconnHostParser *parser, char *p, char *end, struct host *h, int i)
+{
+    struct zconnScanned key, v, name = {NULL};
+    char *val;
+    char *text;
+    size_t len;
+    int r, e;
+
+    zconnStartHost(parser, h, i);
+    if (*p != '{')
+        return;
+    while ((r = zconnScanMember(&p, end, &key, &val)) > 0)
+    {
+        if (zconnScanKeyIs(&key, "interfaces", 10) && *val == '[')
+        {
+            // IP addresses
+            p = val;
+            while ((e = zconnScanElement(&p, end)) > 0)
+            {
+                if (!(p = zconnScanInterface(parser, h, p, end)))
+                    break;
+            }
+        }
+        else if (zconnScanKeyIs(&key, "items", 5) && *val == '[')
+        {
+            // host items collection
+            p = val;
+            while ((e = zconnScanElement(&p, end)) > 0)
+            {
+                if (!(p = zconnScanItem(parser, h, p, end)))
+                    break;
+            }
+        }
+        else
+        {
+            if (!(p = zconnScanValue(val, end, &v)))
+                break;
+            if (zconnScanKeyIs(&key, "hostid", 6))
+                h->id = zconnValueInt(v.start); // The number stops at the closing quote, so needs no decoding.
+            else if (zconnScanKeyIs(&key, "host", 4))
+                name = v; // Decoded once the scanner is past it.
+            continue;
+        }
+        if (!p || e < 0)
+            break;
+    }
+    if ((text = zconnScanText(&name, &len)))
+        h->name = zstrInternLen(text, len);
+    h->zabbixId = h->id; // Copy the device Id and host Id as they are the same for hosts pulled FROM Zabbix
+    zconnEndHost(parser, h);
+}
+
+/**
+ * Parse blocks of hosts until none are left.
+ * Thread function.
+ * @param [in] arg      struct zconnHostParser of the thread.
+ * */
+static void *zconnParseHostBlocks(void *arg)
+{
+    struct zconnHostParser *parser = arg;
+    struct zconnHostParse *parse = parser->parse;
+    int i; // loop itterator.
+    int first, last; // block of hosts taken
+    json_object *jhost;
+
+    // Only needed while parsing, so not taken from the arena.
+    parser->msapIx.slots = NULL;
+    parser->msapIx.host = -1;
+    if (!zconnMsapInit(&parser->msapIx, MSAP_INDEX_SIZE))
+    {
+        fprintf(stderr, "Out of memory attempting to create linked devices index");
+        exit(1); // failure
+    }
+
+    while ((first = atomic_fetch_add(&parse->next, PARSE_BLOCK_SIZE)) < parse->count)
+    {
+        last = (first + PARSE_BLOCK_SIZE < parse->count) ? first + PARSE_BLOCK_SIZE : parse->count;
+        for (i = first; i < last; i++)
+        {
+            if (parse->raw)
+                zconnScanHost(parser, parse->raw[i], parse->raw[i + 1], &parse->hosts[i], i);
+            else if ((jhost = json_object_array_get_idx(parse->jhosts, i)))
+                zconnParseHost(parser, jhost, &parse->hosts[i], i);
+        }
+    }
+    free(parser->msapIx.slots);
+    return NULL;
+}
+
+/**
+ * Parse hosts across a pool of threads.
+ * @param [in] parse        hosts to parse, with the count set.
+ * @param [in] threads      number of threads. 0 for one per core.
+ * */
+static struct hostCol zconnRunHostParsers(struct zconnHostParse *parse, int threads)
+{
+    int i;
+    struct zconnHostParser *parsers;
+
+    struct hostCol hosts;
+    hosts.count = parse->count;
+    hosts.arena = zarenaNew(); // everything belonging to the hosts is taken from here, and freed with it
+    hosts.hosts = (hosts.arena) ? zarenaAlloc(hosts.arena, hosts.count * sizeof(struct host)) : NULL;
+
+    if (!hosts.hosts)
+    {
+        fprintf(stderr, "Out of memory attempting to create hosts collection");
+        exit(1); // failure
+    }
+
+    // One thread per core unless told otherwise, but no more than there are blocks of hosts for.
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > PARSE_THREADS_MAX)
+        threads = PARSE_THREADS_MAX;
+    if (threads > (hosts.count + PARSE_BLOCK_SIZE - 1) / PARSE_BLOCK_SIZE)
+        threads = (hosts.count + PARSE_BLOCK_SIZE - 1) / PARSE_BLOCK_SIZE;
+    if (threads < 1)
+        threads = 1;
+
+    parsers = malloc(threads * sizeof *parsers);
+    if (!parsers)
+    {
+        fprintf(stderr, "Out of memory attempting to create host parsers");
+        exit(1); // failure
+    }
+    parse->hosts = hosts.hosts;
+    atomic_init(&parse->next, 0);
+
+    // The calling thread is the first parser and uses the arena of the hosts. The others get their own.
+    for (i = 0; i < threads; i++)
+    {
+        parsers[i].parse = parse;
+        parsers[i].arena = (i == 0) ? hosts.arena : zarenaNew();
+        parsers[i].started = 0;
+        if (i > 0 && parsers[i].arena)
+            parsers[i].started = (pthread_create(&parsers[i].thread, NULL, zconnParseHostBlocks, &parsers[i]) == 0);
+    }
+    zconnParseHostBlocks(&parsers[0]);
+    for (i = 1; i < threads; i++)
+    {
+        if (parsers[i].started)
+            pthread_join(parsers[i].thread, NULL);
+        zarenaAdopt(hosts.arena, parsers[i].arena); // The linked devices now belong to the hosts.
+    }
+    free(parsers);
+
+    if (g_zDebugMode)
+        printf("DEBUG: zconnParseHosts %i hosts across %i threads\n", hosts.count, threads);
+    return hosts;
+}
+
+struct hostCol zconnParseHosts(json_object *jhosts, int threads)
+{
+    // Convert a JSON object representation of hosts into a struct hostCol (host collection) representation.
+    if (g_zDebugMode)
+            printf("DEBUG: zconnParseHosts\n");
+    struct zconnHostParse parse;
+
+    parse.jhosts = jhosts;
+    parse.raw = NULL;
+    parse.count = json_object_array_length(jhosts);
+    return zconnRunHostParsers(&parse, threads);
+}
+
+/**
+ * Parse an array of hosts straight from raw JSON, as read from a file or received from the API. json-c objects are never
+ * built: the array is split into hosts in one pass, then each host is scanned for the members the mapper uses by the
+ * pool of parsing threads.
+ * The strings used are decoded where they lie rather than copied out, so the text is changed. Only strings not already
+ * interned are copied, into the string table.
+ * The JSON is expected to be what Zabbix or zabbix-map wrote. It is not checked as thoroughly as json-c would.
+ * @param [in,out] json     the JSON text. Changed by the parse and of no further use.
+ * @param [in] len          length of the text.
+ * @param [in] threads      number of threads. 0 for one per core.
+ * @return                  the hosts. Empty if the text is not an array of hosts.
+ * */
+static struct hostCol zconnScanHosts(char *json, size_t len, int threads)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: zconnScanHosts\n");
+    struct zconnHostParse parse;
+    struct hostCol ret; // Default NULL object
+    char *end = json + len;
+    char *p = zconnScanSpace(json, end);
+    int size = 0;
+    int r;
+
+    ret.count = 0;
+    ret.hosts = NULL;
+    ret.arena = NULL;
+    if (p >= end || *p != '[')
+    {
+        fprintf(stderr, "Error: expected an array of hosts\n");
+        return ret;
+    }
+
+    parse.jhosts = NULL;
+    parse.raw = NULL;
+    parse.count = 0;
+    while ((r = zconnScanElement(&p, end)) > 0)
+    {
+        if (parse.count + 1 >= size)
+        {
+            size = (size > 0) ? size * 2 : 256;
+            char **tmpPtr = realloc(parse.raw, size * sizeof *parse.raw);
+            if (!tmpPtr)
+            {
+                fprintf(stderr, "Out of memory attempting to split the hosts");
+                exit(1); // failure
+            }
+            parse.raw = tmpPtr;
+        }
+        parse.raw[parse.count++] = p;
+        if (!(p = zconnScanValue(p, end, NULL)))
+            break;
+        parse.raw[parse.count] = p;
+    }
+    if (r != 0 || zconnScanSpace(p, end) != end)
+    {
+        fprintf(stderr, "Error: hosts are not valid JSON\n");
+        free(parse.raw);
+        return ret;
+    }
+
+    if (parse.count > 0)
+        ret = zconnRunHostParsers(&parse, threads);
+    free(parse.raw);
+    return ret;
+}
+
+/**
+ * Find the result of a call in a raw JSON-RPC response.
+ * @param [in] json         the response text.
+ * @param [in] len          length of the text.
+ * @param [out] result      set to the first character of the result.
+ * @param [out] resultEnd   set to the character after the result.
+ * @return                  1 if the response has a result that is an array, 0 if not (e.g. an error).
+ * */
+static int zconnScanResult(char *json, size_t len, char **result, char **resultEnd)
+{
+    struct zconnScanned key;
+    char *end = json + len;
+    char *p = zconnScanSpace(json, end);
+    char *value;
+
+    if (p >= end || *p != '{')
+        return 0;
+    while (zconnScanMember(&p, end, &key, &value) > 0)
+    {
+        if (!(p = zconnScanValue(value, end, NULL)))
+            return 0;
+        if (zconnScanKeyIs(&key, "result", 6))
+        {
+            *result = value;
+            *resultEnd = p;
+            return (*value == '[');
+        }
+    }
+    return 0;
+}
+
+struct hostCol zconnGetHostsFromFile(char *fileName, int threads)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: zconnGetHostsFromFile\n");
+    struct hostCol ret; // Default NULL object
+    ret.count = 0;
+    ret.hosts = NULL;
+    ret.arena = NULL;
+
+    // The whole file is read in and the hosts scanned straight from it, which takes far less memory and time than building
+    // json-c objects for every item only to read a few members of each.
+    FILE *infile = fopen(fileName, "r");
+    struct stat st;
+    char *json;
+    size_t len;
+
+    if (infile == NULL)
+        return ret;
+    if (fstat(fileno(infile), &st) != 0 || !(json = malloc(st.st_size + 1)))
+    {
+        fclose(infile);
+        return ret;
+    }
+    len = fread(json, 1, st.st_size, infile);
+    fclose(infile);
+    json[len] = '\0';
+
+    ret = zconnScanHosts(json, len, threads);
+    free(json);
+    return ret;
+}
+
+/**
+ * Build the parameters for a host.get call that returns the hosts along with the interfaces used by the mapper.
+ * The items are only included when they are not being narrowed with a separate item.get (see zconnItemParams).
+ * @param [in] ctx          client context.
+ * @param [in] hostIds      array of host IDs to restrict the call to, or NULL for all hosts. Ownership is taken.
+ * */
+static json_object *zconnHostParams(struct zconnCtx *ctx, json_object *hostIds)
+{
+    json_object *outputParam = json_object_new_array_ext(2);
+    json_object *interfacesParam = json_object_new_array_ext(2);
+
+    json_object_array_add(outputParam, json_object_new_string("hostid"));
+    json_object_array_add(outputParam, json_object_new_string("host"));
+
+    json_object_array_add(interfacesParam, json_object_new_string("interfaceid"));
+    json_object_array_add(interfacesParam, json_object_new_string("ip"));
+
+    // Build the request object
+    json_object *params = json_object_new_object();
+    json_object_object_add(params, "output", outputParam);
+    if (hostIds)
+        json_object_object_add(params, "hostids", hostIds);
+    json_object_object_add(params, "selectInterfaces", interfacesParam);
+
+    if (!ctx->narrowItems)
+    {
+        json_object *itemsParam = json_object_new_array_ext(6);
+        json_object_array_add(itemsParam, json_object_new_string("itemid"));
+        json_object_array_add(itemsParam, json_object_new_string("key_"));
+        json_object_array_add(itemsParam, json_object_new_string("name"));
+        json_object_array_add(itemsParam, json_object_new_string("lastvalue"));
+        json_object_array_add(itemsParam, json_object_new_string("lastclock"));
+        json_object_array_add(itemsParam, json_object_new_string("value_type"));
+        json_object_object_add(params, "selectItems", itemsParam);
+    }
+    return params;
+}
+
+/**
+ * Build the parameters for an item.get call that returns only the items used by the mapper (LLDP remote items,
+ * the local chassis items and the system description). Everything else a host has (CPU, traffic, etc.) stays on the server.
+ * When the items are not being narrowed every item of the hosts is returned.
+ * @param [in] ctx          client context.
+ * @param [in] hostIds      array of host IDs to restrict the call to, or NULL for all hosts. Ownership is taken.
+ * @param [in] listing      if 1 then only the item IDs, host IDs and the time of the last value are returned.
+ * */
+static json_object *zconnItemParams(struct zconnCtx *ctx, json_object *hostIds, int listing)
+{
+    int i;
+    json_object *outputParam = json_object_new_array_ext(7);
+
+    json_object_array_add(outputParam, json_object_new_string("itemid"));
+    json_object_array_add(outputParam, json_object_new_string("hostid"));
+    json_object_array_add(outputParam, json_object_new_string("lastclock"));
+    if (!listing)
+    {
+        json_object_array_add(outputParam, json_object_new_string("key_"));
+        json_object_array_add(outputParam, json_object_new_string("name"));
+        json_object_array_add(outputParam, json_object_new_string("value_type"));
+        json_object_array_add(outputParam, json_object_new_string("lastvalue"));
+    }
+
+    json_object *params = json_object_new_object();
+    json_object_object_add(params, "output", outputParam);
+    if (hostIds)
+        json_object_object_add(params, "hostids", hostIds);
+    if (ctx->narrowItems)
+    {
+        json_object *keysParam = json_object_new_array_ext(ITEM_KEY_COUNT);
+        json_object *searchParam = json_object_new_object();
+        for (i = 0; i < ITEM_KEY_COUNT; i++)
+            json_object_array_add(keysParam, json_object_new_string(itemKeys[i]));
+        json_object_object_add(searchParam, "key_", keysParam);
+        json_object_object_add(params, "search", searchParam);
+        json_object_object_add(params, "searchByAny", json_object_new_boolean(1));
+        json_object_object_add(params, "searchWildcardsEnabled", json_object_new_boolean(1));
+    }
+    json_object_object_add(params, "sortfield", json_object_new_string("itemid"));
+    return params;
+}
+
+/**
+ * Attach the items returned by item.get to the hosts returned by host.get, giving each host an "items" array in the
+ * same form that host.get selectItems would have produced.
+ * @param [in,out] hosts    host.get result. Each host has its items added.
+ * @param [in] items        item.get result. Each item must include its hostid.
+ * @return                  hosts, or NULL if either call failed. items is put in all cases and hosts is put on failure.
+ * */
+static json_object *zconnAttachItems(json_object *hosts, json_object *items)
+{
+    int i;
+    int count;
+    json_object *jobjTmp;
+    json_object *jhost;
+    json_object *jitems;
+
+    if (!hosts || !items)
+    {
+        json_object_put(hosts);
+        json_object_put(items);
+        return NULL;
+    }
+
+    // Index the hosts by host ID so that each item can find its host without searching.
+    json_object *byId = json_object_new_object();
+    count = json_object_array_length(hosts);
+    for (i = 0; i < count; i++)
+    {
+        jhost = json_object_array_get_idx(hosts, i);
+        jitems = json_object_new_array();
+        json_object_object_add(jhost, "items", jitems);
+        if (json_object_object_get_ex(jhost, "hostid", &jobjTmp))
+            json_object_object_add(byId, json_object_get_string(jobjTmp), json_object_get(jitems));
+    }
+
+    count = json_object_array_length(items);
+    for (i = 0; i < count; i++)
+    {
+        json_object *jitem = json_object_array_get_idx(items, i);
+        if (json_object_object_get_ex(jitem, "hostid", &jobjTmp) && json_object_object_get_ex(byId, json_object_get_string(jobjTmp), &jitems))
+        {
+            json_object_object_del(jitem, "hostid"); // Not part of the selectItems output.
+            json_object_array_add(jitems, json_object_get(jitem));
+        }
+    }
+
+    json_object_put(byId);
+    json_object_put(items);
+    return hosts;
+}
+
+/**
+ * List the IDs of all hosts, sorted by host ID.
+ * Cheap in comparison to getting the hosts as nothing but the ID is returned.
+ * @return      array of host ID strings or NULL on failure.
+ * */
+static json_object *zconnListHostIds(struct zconnCtx *ctx)
+{
+    int i;
+    json_object *jobjTmp;
+    json_object *params = json_object_new_object();
+    json_object *outputParam = json_object_new_array_ext(1);
+    json_object_array_add(outputParam, json_object_new_string("hostid"));
+    json_object_object_add(params, "output", outputParam);
+    json_object_object_add(params, "sortfield", json_object_new_string("hostid"));
+    json_object *result = zconnResp(ctx, "host.get", params);
+    if (!result)
+        return NULL;
+
+    int count = json_object_array_length(result);
+    json_object *ids = json_object_new_array_ext(count);
+    for (i = 0; i < count; i++)
+    {
+        json_object_object_get_ex(json_object_array_get_idx(result, i), "hostid", &jobjTmp);
+        json_object_array_add(ids, json_object_get(jobjTmp));
+    }
+    json_object_put(result);
+    return ids;
+}
+
+/**
+ * Compare two host IDs for sorting.
+ * */
+static int zconnCompareIds(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * List the IDs of the hosts that have an interface inside the given IP ranges, sorted by host ID.
+ * Uses hostinterface.get, which returns only the host ID and IP of each interface, so that the hosts outside the
+ * ranges never have to be requested at all.
+ * @param [in] ctx      client context.
+ * @param [in] ips      IP ranges to filter by.
+ * @return              array of host ID strings or NULL on failure.
+ * */
+static json_object *zconnFilterHostIds(struct zconnCtx *ctx, struct ipRanges *ips)
+{
+    int i;
+    int n = 0;
+    struct ipAddr ip;
+    char idTmp[21];
+    json_object *jobjTmp;
+    json_object *jif;
+
+    json_object *params = json_object_new_object();
+    json_object *outputParam = json_object_new_array_ext(2);
+    json_object_array_add(outputParam, json_object_new_string("hostid"));
+    json_object_array_add(outputParam, json_object_new_string("ip"));
+    json_object_object_add(params, "output", outputParam);
+    json_object *result = zconnResp(ctx, "hostinterface.get", params);
+    if (!result)
+        return NULL;
+
+    int count = json_object_array_length(result);
+    long long *hostIds = malloc((count + 1) * sizeof *hostIds);
+    if (!hostIds)
+    {
+        fprintf(stderr, "Out of memory attempting to filter hosts by IP address");
+        json_object_put(result);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        jif = json_object_array_get_idx(result, i);
+        if (!json_object_object_get_ex(jif, "ip", &jobjTmp) || !ipParse(json_object_get_string(jobjTmp), &ip))
+            continue; // DNS only
+        if (ipAddrInRanges(ips, &ip) && json_object_object_get_ex(jif, "hostid", &jobjTmp))
+            hostIds[n++] = json_object_get_int64(jobjTmp);
+    }
+    json_object_put(result);
+
+    // Sort so that hosts with several matching interfaces can be de-duplicated and the pages are in host ID order.
+    qsort(hostIds, n, sizeof *hostIds, zconnCompareIds);
+    json_object *ids = json_object_new_array_ext(n);
+    for (i = 0; i < n; i++)
+    {
+        if (i > 0 && hostIds[i] == hostIds[i - 1])
+            continue;
+        snprintf(idTmp, sizeof idTmp, "%lld", hostIds[i]);
+        json_object_array_add(ids, json_object_new_string(idTmp));
+    }
+    free(hostIds);
+
+    if (g_zDebugMode)
+        printf("DEBUG: zconnFilterHostIds %i interfaces, %i hosts in range\n", count, (int)json_object_array_length(ids));
+    return ids;
+}
+
+/**
+ * Queue the calls that get the given hosts, with their interfaces and the items used by the mapper, in a batch.
+ * When the items are narrowed this is a host.get and an item.get, otherwise a single host.get.
+ * @param [in] ctx      client context.
+ * @param [in] ids      array of host ID strings to get, or NULL for all hosts.
+ * @return              index of the host.get in the batch. The item.get, if any, follows it.
+ * */
+static int zconnBatchHosts(struct zconnCtx *ctx, struct zconnBatch *batch, json_object *ids)
+{
+    int call = zconnBatchAdd(ctx, batch, "host.get", zconnHostParams(ctx, (ids) ? json_object_get(ids) : NULL));
+    if (ctx->narrowItems)
+        zconnBatchAdd(ctx, batch, "item.get", zconnItemParams(ctx, (ids) ? json_object_get(ids) : NULL, 0));
+    return call;
+}
+
+/**
+ * Take the hosts queued by zconnBatchHosts from a batch that has been run, with their items attached.
+ * @return              array of hosts or NULL on failure.
+ * */
+static json_object *zconnBatchHostsResult(struct zconnCtx *ctx, struct zconnBatch *batch, int call)
+{
+    json_object *hosts = zconnBatchResult(batch, call);
+    if (ctx->narrowItems)
+        hosts = zconnAttachItems(hosts, zconnBatchResult(batch, call + 1));
+    return hosts;
+}
+
+/**
+ * Bounded lock-free queue of host pages waiting to be parsed.
+ * The network thread pushes each page as it arrives and the parser threads pop them. Each cell carries a sequence
+ * number so that a cell is claimed with a compare and swap on the head or tail rather than a lock. The semaphore only
+ * counts the pages in the queue so that idle parser threads sleep rather than spin.
+ * */
+struct zconnPageQueue
+{
+    struct
+    {
+        atomic_size_t seq;   /**< sequence number. Equal to the position when free to push, position + 1 when holding a page. */
+        int page;            /**< page number, -1 to stop the parser thread that pops it */
+        json_object *hosts;  /**< hosts in the page. Still owned by the network thread. */
+    } cells[PIPELINE_QUEUE_SIZE];
+    atomic_size_t head; /**< position of the next push */
+    atomic_size_t tail; /**< position of the next pop */
+    sem_t ready;        /**< number of pages in the queue */
+};
+
+/**
+ * A parser thread.
+ * */
+struct zconnParser
+{
+    pthread_t thread;
+    struct zconnPipeline *pipe; /**< pipeline the thread belongs to */
+    double busy;                /**< time spent parsing (seconds) */
+};
+
+/**
+ * Host pages being parsed by a pool of parser threads while the remaining pages are downloaded.
+ * */
+struct zconnPipeline
+{
+    struct zconnPageQueue queue;
+    struct hostCol *slices;      /**< hosts parsed from each page, in page order */
+    struct zconnParser *parsers; /**< parser threads */
+    int threadCount;             /**< number of parser threads running */
+};
+
+/**
+ * Push a page onto the queue.
+ * @return      1 if pushed, 0 if the queue is full.
+ * */
+static int zconnQueuePush(struct zconnPageQueue *q, int page, json_object *hosts)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;)
+    {
+        size_t seq = atomic_load_explicit(&q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return 0; // Full
+        else
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+    q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].page = page;
+    q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].hosts = hosts;
+    atomic_store_explicit(&q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].seq, pos + 1, memory_order_release);
+    sem_post(&q->ready);
+    return 1;
+}
+
+/**
+ * Pop a page from the queue, waiting for one to be pushed if the queue is empty.
+ * */
+static void zconnQueuePop(struct zconnPageQueue *q, int *page, json_object **hosts)
+{
+    while (sem_wait(&q->ready) != 0)
+        ; // Interrupted, wait again.
+
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;)
+    {
+        size_t seq = atomic_load_explicit(&q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+    *page = q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].page;
+    *hosts = q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].hosts;
+    atomic_store_explicit(&q->cells[pos & (PIPELINE_QUEUE_SIZE - 1)].seq, pos + PIPELINE_QUEUE_SIZE, memory_order_release);
+}
+
+/**
+ * Push a page onto the queue, waiting for the parser threads to make room if it is full.
+ * */
+static void zconnQueuePushWait(struct zconnPageQueue *q, int page, json_object *hosts)
+{
+    while (!zconnQueuePush(q, page, hosts))
+        sched_yield();
+}
+
+/**
+ * Parser thread. Parses pages from the queue into their slice of hosts until told to stop.
+ * Each page is a separate JSON object that nothing else writes to until the threads have been joined, so no locking is needed.
+ * */
+static void *zconnParserThread(void *arg)
+{
+    struct zconnParser *parser = arg;
+    struct zconnPipeline *pipe = parser->pipe;
+    int page;
+    json_object *hosts;
+    double start;
+
+    for (;;)
+    {
+        zconnQueuePop(&pipe->queue, &page, &hosts);
+        if (page < 0)
+            break;
+        start = zconnNow();
+        pipe->slices[page] = zconnParseHosts(hosts, 1); // The pages are already being parsed in parallel.
+        parser->busy += zconnNow() - start;
+    }
+    return NULL;
+}
+
+/**
+ * Start the parser threads for the given number of pages.
+ * @return      1 if success, 0 if the threads could not be started.
+ * */
+static int zconnPipelineStart(struct zconnPipeline *pipe, int pageCount, int threadCount)
+{
+    int i;
+    memset(pipe, 0, sizeof *pipe);
+    for (i = 0; i < PIPELINE_QUEUE_SIZE; i++)
+        atomic_init(&pipe->queue.cells[i].seq, i);
+    atomic_init(&pipe->queue.head, 0);
+    atomic_init(&pipe->queue.tail, 0);
+
+    pipe->slices = calloc(pageCount + 1, sizeof *pipe->slices);
+    pipe->parsers = calloc(threadCount, sizeof *pipe->parsers);
+    if (!pipe->slices || !pipe->parsers || sem_init(&pipe->queue.ready, 0, 0) != 0)
+    {
+        fprintf(stderr, "Out of memory attempting to create the parser threads");
+        free(pipe->slices);
+        free(pipe->parsers);
+        return 0;
+    }
+
+    for (i = 0; i < threadCount; i++)
+    {
+        pipe->parsers[i].pipe = pipe;
+        if (pthread_create(&pipe->parsers[i].thread, NULL, zconnParserThread, &pipe->parsers[i]) != 0)
+            break;
+        pipe->threadCount++;
+    }
+    if (pipe->threadCount == 0)
+    {
+        fprintf(stderr, "Could not start the parser threads");
+        sem_destroy(&pipe->queue.ready);
+        free(pipe->slices);
+        free(pipe->parsers);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Wait for the parser threads to parse every page that has been pushed and stop them.
+ * */
+static void zconnPipelineFinish(struct zconnPipeline *pipe)
+{
+    int i;
+    for (i = 0; i < pipe->threadCount; i++)
+        zconnQueuePushWait(&pipe->queue, -1, NULL);
+    for (i = 0; i < pipe->threadCount; i++)
+        pthread_join(pipe->parsers[i].thread, NULL);
+    sem_destroy(&pipe->queue.ready);
+}
+
+/**
+ * A page being transferred through the multi handle.
+ * */
+struct zconnPage
 {
-    strcpy(endpoint, ep);
-}
+    CURL *curl;
+    struct zconnBatch batch;     /**< calls for the page. Must live until the transfer completes as curl does not copy the request. */
+    struct ResponseStream chunk; /**< response from the API */
+    int page;                    /**< page number, -1 if the slot is free */
+    int active;                  /**< set while the page is in flight */
+    int attempts;                /**< times the page has been refused by a busy frontend */
+    double queued;               /**< time the page waited for the limits before it was sent (seconds) */
+};
 
-int instr(char *tofind, char *findin, uint start)
+/**
+ * Hand the response to a page out to its calls and free the slot for the next page.
+ * @param [in] ctx      client context.
+ * @param [in] slot     slot that has received the complete response to its page.
+ * @param [out] pages   hosts in each page. The page's hosts are set.
+ * @param [in] pipe     parser threads the page is handed to, or NULL.
+ * @return              1 if the page succeeded, 0 if not.
+ * */
+static int zconnPageComplete(struct zconnCtx *ctx, struct zconnPage *slot, json_object **pages, struct zconnPipeline *pipe)
 {
-    // Find a string in another string and return its position.
-    // return -1 if nothing found.
-    int i, j; // Loop itterators
+    int page = slot->page;
+    int ok = 1;
 
-    if (start > strlen(findin) - 1)
-        return -1;
+    zconnBatchComplete(ctx, &slot->batch, &slot->chunk);
+    pages[page] = zconnBatchHostsResult(ctx, &slot->batch, 0);
+    if (!pages[page])
+        ok = 0;
+    else if (pipe)
+        zconnQueuePushWait(&pipe->queue, page, pages[page]); // Parse while the other pages download.
 
-    for (i = start, j = 0; findin[i] != '\0' && tofind[j] != '\0'; i++)
-    {
-        if (findin[i] == tofind[j])
-            j++;
-        else
-            j = 0;
-    }
-    if (j == 0)
-        return -1;
-    else if (tofind[j] == '\0')
-        return i - j;
-    return -1; // ToFind is beyond the limit of FindIn.
+    zconnBatchFree(&slot->batch);
+    zconnStreamFree(&slot->chunk);
+    slot->page = -1;
+    return ok;
 }
 
 /**
- * Get a response from the zabbix API
- * @param [in]  method      Zabbix API method name such as user.login or host.get
- * @param [in]  params      parameters specific to a given method. For example user.login requires username and password
+ * Get the hosts from the Zabbix API in pages of pageSize hosts with up to pageParallel pages in flight at the same time.
+ * Each page is requested with hostids. When the items are narrowed the host.get and item.get for a page are sent
+ * together as one batch request.
+ * The pages are merged back into one array in the order of ids so the result has the same form as a single host.get.
+ * @param [in] ctx      client context.
+ * @param [in] ids      array of host ID strings to be fetched.
+ * @param [in] pageSize number of hosts per page.
+ * @param [in] pipe     parser threads each page is handed to as it arrives, or NULL. Stopped before returning.
+ * @return              array of hosts or NULL on failure.
  * */
-json_object *zconnResp(char *method, json_object *params)
+static json_object *zconnGetHostPages(struct zconnCtx *ctx, json_object *ids, int pageSize, struct zconnPipeline *pipe)
 {
     if (g_zDebugMode)
-            printf("DEBUG: zconnResp [%s]\n",method);
-    /* an authentication string would look like this  "{\"jsonrpc\": \"2.0\",\"method\": \"user.login\",\"params\": {\"user\": \"Admin\",\"password\": \"zabbix\"},\"id\": 1,\"auth\": null}";*/
-    static int connId = 0;             // private connection ID. Ensures that API response matches request.*/
-    static char authId[40];            // Authorisation ID
-    struct json_object *result = NULL; // return object
+        printf("DEBUG: zconnGetHostPages size %i, parallel %i\n", pageSize, ctx->pageParallel);
 
-    if (authId[0] == '\0' && strcmp("user.login", method) != 0)
+    int hostCount = json_object_array_length(ids);
+    if (hostCount == 0)
     {
-        fprintf(stderr, "Zabbix Response called for method other than authentication and without valid authentication value set.\n");
-        return NULL;
+        if (pipe)
+            zconnPipelineFinish(pipe);
+        return json_object_new_array(); // No hosts, nothing to request.
     }
+    int pageCount = (hostCount + pageSize - 1) / pageSize;
+    int slotCount = (ctx->pageParallel < pageCount) ? ctx->pageParallel : pageCount;
+    int i, j;                                               // loop itterators
+    int page;                                               // page number
+    int next = 0;                                           // next page to be requested
+    int running = 0;                                        // pages in flight
+    int retrying = 0;                                       // pages refused by a busy frontend, waiting to be sent again
+    double delay = 0.0;                                     // time until the limits allow another page
+    double waiting = 0.0;                                   // time the next page to send started waiting for the limits. 0 if none waiting.
+    int failed = 0;                                         // set if any of the pages fails
+    char method[32];                                        // name of the page for the debug output
+    json_object **pages = calloc(pageCount, sizeof *pages); // hosts in each page
+    struct zconnPage *slots = calloc(slotCount, sizeof *slots);
+    CURLM *multi = curl_multi_init();
 
-    connId++;
-
-    char connIdString[11];
-    sprintf(connIdString, "%i", connId);
-
-    json_object *jobj = json_object_new_object();
-    // JSON POST with parameters
-    json_object_object_add(jobj, "jsonrpc", json_object_new_string("2.0"));
-    json_object_object_add(jobj, "method", json_object_new_string(method));
-    if (params)
-        json_object_object_add(jobj, "params", params);
-
-    // Authentication ID should be null if attempting to authenticate
-    if (strcmp("user.login", method) == 0)
+    if (!pages || !slots || !multi)
     {
-        json_object_object_add(jobj, "auth", json_object_new_null());
+        fprintf(stderr, "Out of memory attempting to create host pages");
+        if (pipe)
+            zconnPipelineFinish(pipe);
+        free(pages);
+        free(slots);
+        if (multi)
+            curl_multi_cleanup(multi);
+        return NULL;
     }
-    else
+
+    for (i = 0; i < slotCount; i++)
     {
-        json_object_object_add(jobj, "auth", json_object_new_string(authId));
+        slots[i].curl = zconnNewHandle(ctx);
+        slots[i].page = -1;
+        if (!slots[i].curl)
+            failed = 1;
     }
 
-    json_object_object_add(jobj, "id", json_object_new_string(connIdString));
-
-    //printf("JSON request:\n%s\n", json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY_TAB));
-
-    CURL *curl;
-    CURLcode res;
-
-    /* get a curl handle */
-    curl = curl_easy_init();
-    if (curl)
+    while (!failed && (next < pageCount || running > 0 || retrying > 0))
     {
-        // Memory for the response from the API
-        struct MemoryStruct chunk;
-        chunk.memory = malloc(1); /* will be grown as needed by the realloc above */
-        chunk.size = 0;           /* no data at this point */
-
-        const char *data = json_object_to_json_string(jobj);
-
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-
-        /* post binary data */
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-
-        /* pass our list of custom made headers */
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        /* we pass our 'chunk' struct to the callback function */
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        curl_easy_setopt(curl, CURLOPT_URL, endpoint);
-
-        if (g_zDebugMode)
-            printf("DEBUG: zconnResp.curl_easy_perform\n");
-
-        res = curl_easy_perform(curl); /* post away! */
-
-        if (g_zDebugMode)
-            printf("DEBUG: zconnResp.curl_easy_perform complete\n");
-
-        json_object_put(jobj); // free the memory so that we can use it again for the response.
-
-        /* Check for errors */
-        if (res != CURLE_OK)
-        {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n",
-                    curl_easy_strerror(res));
-        }
-        else
+        // Start pages on any free slots, and send refused pages again, as far as the limits allow.
+        int allowed = zconnLimitInFlight(ctx, slotCount);
+        delay = 0.0;
+        for (i = 0; i < slotCount && running < allowed; i++)
         {
-            if (g_zDebugMode)
-            printf("DEBUG: zconnResp.curl_easy_perform CURLE_OK\n");
-            /*
-            * Now, our chunk.memory points to a memory block that is chunk.size
-            * and contains the response from the Zabbix API*/
-            int i = 0;
-
-            struct json_tokener *tok = json_tokener_new();
-            enum json_tokener_error jerr;
-            const char *mystring = chunk.memory;
-            int stringlen = chunk.size;
-            int val_type;
-            char *val_type_str;
-
-            if (g_zDebugMode)
-            {
-                if (stringlen < 5000)
-                {
-                    printf("DEBUG: curl response size: %i, curl response: %s\n", stringlen, mystring);
-                }
-                else
-                {
-                    printf("DEBUG: curl response size: %i\n", stringlen);
-                }
-            }
-                
+            if (slots[i].active || (slots[i].page == -1 && next >= pageCount))
+                continue;
+            if (waiting == 0.0)
+                waiting = zconnNow();
+            if ((delay = zconnLimitDelay(ctx)) > 0.0)
+                break;
 
-            stringlen++; // Include the '\0' if we know we're at the end of input
-            do
-            {
-                jobj = json_tokener_parse_ex(tok, mystring, stringlen);
-            } while ((jerr = json_tokener_get_error(tok)) == json_tokener_continue);
-            if (jerr != json_tokener_success)
+            if (slots[i].page == -1)
             {
-                fprintf(stderr, "Error: %s\n", json_tokener_error_desc(jerr));
-                return NULL;
-            }
-
-            if (g_zDebugMode)
-            printf("DEBUG: parseResult\n");
+                page = next;
+                json_object *pageIds = json_object_new_array_ext(pageSize);
+                for (j = page * pageSize; j < hostCount && j < (page + 1) * pageSize; j++)
+                    json_object_array_add(pageIds, json_object_get(json_object_array_get_idx(ids, j)));
 
-            // Debug print (uncomment line below to see all API responses).
-            //printf("response:\n%s\n", json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY_TAB));
+                zconnBatchInit(&slots[i].batch);
+                zconnBatchHosts(ctx, &slots[i].batch, pageIds);
+                json_object_put(pageIds);
+                if (slots[i].batch.failed || !zconnStreamInit(&slots[i].chunk))
+                {
+                    zconnBatchFree(&slots[i].batch);
+                    failed = 1;
+                    break;
+                }
+                slots[i].page = next++;
+                slots[i].attempts = 0;
 
-            // We got something from the remote server
-            struct json_object *zerr = NULL; // returned error
-            if (json_object_object_get_ex(jobj, "error", &zerr))
-            {
-                /* Error detected */
-                // TODO: Need to VALGRIND this bit
-                struct json_object *zerrMsg = json_object_object_get(zerr, "message");
-                struct json_object *zerrData = json_object_object_get(zerr, "data");
-                fprintf(stderr, "Error from Zabbix API. Message: %s, data: %s\n", json_object_get_string(zerrMsg), json_object_get_string(zerrData));
-            }
-            else
-            {
-                if (json_object_object_get_ex(jobj, "result", &result))
+                if (ctx->fixtureMode == FIXTURE_REPLAY)
                 {
-                    // Success
-                    json_object_get(result); // Increment the reference counter so that we maintain the reference after we put the parent
-                    if (strcmp("user.login", method) == 0)
+                    // Nothing to send. The page is complete once its recorded response has been read.
+                    waiting = 0.0;
+                    snprintf(method, sizeof method, "host page %i", page + 1);
+                    if (!zconnFixtureReplay(ctx, slots[i].batch.requests, method, &slots[i].chunk) || !zconnPageComplete(ctx, &slots[i], pages, pipe))
                     {
-                        // This is the response to the authentication query, so record the authentication response.
-                        const char *authStr = json_object_get_string(result);
-                        strcpy(authId, authStr);
+                        failed = 1;
+                        break;
                     }
+                    continue;
                 }
-            }
-            json_object_put(jobj);
-            json_tokener_free(tok);
-        }
-
-        /* always cleanup */
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers); /* free the header list */
-        free(chunk.memory);
-    }
-    return result;
-}
-
-int zconnAuth(char *user, char *pw)
-{
-    /*data = "{\"jsonrpc\": \"2.0\",\"method\": \"user.login\",\"params\": {\"user\": \"Admin\",\"password\": \"zabbix\"},\"id\": 1,\"auth\": null}";*/
-    json_object *params = json_object_new_object();
-
-    // Parameter list for the JSON POST
-    json_object_object_add(params, "user", json_object_new_string(user));
-    json_object_object_add(params, "password", json_object_new_string(pw));
 
-    json_object *result = zconnResp("user.login", params);
-    int success = (result) ? 1 : 0;
-    json_object_put(result);
-    return success;
-}
+                curl_easy_setopt(slots[i].curl, CURLOPT_POSTFIELDS, json_object_to_json_string(slots[i].batch.requests));
+                curl_easy_setopt(slots[i].curl, CURLOPT_WRITEDATA, (void *)&slots[i].chunk);
+                curl_easy_setopt(slots[i].curl, CURLOPT_URL, ctx->endpoint);
 
-struct zMapCol zconnGetMaps()
-{
-    // Get all maps from the server
-    struct zMapCol ret;
-    ret.count = 0;
-    ret.zMaps = NULL;
+                if (g_zDebugMode)
+                    printf("DEBUG: zconnGetHostPages requesting page %i of %i\n", page + 1, pageCount);
+            }
+            else
+                retrying--;
 
-    json_object *params = json_object_new_object();
-    json_object_object_add(params, "output", json_object_new_string("extend"));
-    json_object *result = zconnResp("map.get", params);
-    json_object *jobjTmp;
-    if (result)
-    {
+            slots[i].queued = zconnNow() - waiting;
+            waiting = 0.0;
+            curl_multi_add_handle(multi, slots[i].curl);
+            slots[i].active = 1;
+            running++;
+        }
 
-        int count = json_object_array_length(result); // number of maps returned from API
-        int i;                                        // loop itterator
-        int strlen;                                   // string length
-        json_object *jMap;
+        int stillRunning;
+        curl_multi_perform(multi, &stillRunning);
+        if (stillRunning || delay > 0.0)
+            curl_multi_poll(multi, NULL, 0, (delay > 0.0 && delay < 1.0) ? (int)(delay * 1000) + 1 : 1000, NULL);
 
-        ret.zMaps = malloc(count * sizeof(struct zMap));
-        if (!ret.zMaps)
+        // Collect the pages that have completed.
+        CURLMsg *msg;
+        int msgsLeft;
+        while ((msg = curl_multi_info_read(multi, &msgsLeft)))
         {
-            // Return object with zero count.
-            json_object_put(result);
-            return ret;
-        }
-        ret.count = count;
+            if (msg->msg != CURLMSG_DONE)
+                continue;
 
-        for (i = 0; i < count; i++)
-        {
-            jMap = json_object_array_get_idx(result, i);
+            for (i = 0; i < slotCount; i++)
+                if (slots[i].curl == msg->easy_handle)
+                    break;
 
-            json_object_object_get_ex(jMap, "sysmapid", &jobjTmp);
-            ret.zMaps[i].sysId = json_object_get_int(jobjTmp);
+            page = slots[i].page;
+            CURLcode result = msg->data.result; // msg is not valid once the handle is removed
+            snprintf(method, sizeof method, "host page %i", page + 1);
+            zconnRecordTiming(ctx, slots[i].curl, method, slots[i].chunk.size, slots[i].queued);
+            curl_multi_remove_handle(multi, slots[i].curl);
+            slots[i].active = 0;
+            running--;
 
-            // copy map name to new memory as the json_object_put will release the memory.
-            json_object_object_get_ex(jMap, "name", &jobjTmp);
-            strlen = json_object_get_string_len(jobjTmp);
-            ret.zMaps[i].name = malloc(strlen + 1);
-            if (ret.zMaps[i].name)
+            if (zconnLimitFeedback(ctx, slots[i].curl, "host page") && slots[i].attempts < LIMIT_RETRIES) // Pages share one baseline
             {
-                if (strlen > 0)
-                {
-                    strcpy(ret.zMaps[i].name, json_object_get_string(jobjTmp));
-                }
-                else
-                {
-                    ret.zMaps[i].name = '\0';
-                }
+                // Refused by a busy frontend. The page stays on its slot to be sent again once the limits allow.
+                slots[i].attempts++;
+                ctx->limit.retries++;
+                retrying++;
+                zconnStreamFree(&slots[i].chunk);
+                if (!zconnStreamInit(&slots[i].chunk))
+                    failed = 1;
+                continue;
             }
-            else
+
+            if (result != CURLE_OK)
             {
-                json_object_put(result);
-                fprintf(stderr, "Out of memory attempting to create extra space for maps returned from Zabbix.");
-                return ret;
+                fprintf(stderr, "%s failed: %s\n", method, curl_easy_strerror(result));
+                failed = 1;
+                zconnBatchFree(&slots[i].batch);
+                zconnStreamFree(&slots[i].chunk);
+                slots[i].page = -1;
             }
+            else if (!zconnPageComplete(ctx, &slots[i], pages, pipe))
+                failed = 1;
         }
+    }
 
-        json_object_put(result);
-        return ret;
+    // The parser threads read the pages so must have finished with them before they are merged.
+    if (pipe)
+        zconnPipelineFinish(pipe);
+
+    // Merge the pages into a single array, in page order.
+    json_object *result = NULL;
+    if (!failed)
+    {
+        result = json_object_new_array_ext(hostCount);
+        for (page = 0; page < pageCount; page++)
+            for (j = 0; j < (int)json_object_array_length(pages[page]); j++)
+                json_object_array_add(result, json_object_get(json_object_array_get_idx(pages[page], j)));
     }
-    else
+
+    // Tidy up. Slots that are still in use (only on failure) are removed from the multi handle first.
+    for (i = 0; i < slotCount; i++)
     {
-        return ret;
+        if (slots[i].page != -1)
+        {
+            if (slots[i].active)
+                curl_multi_remove_handle(multi, slots[i].curl);
+            zconnBatchFree(&slots[i].batch);
+            zconnStreamFree(&slots[i].chunk);
+        }
+        if (slots[i].curl)
+            curl_easy_cleanup(slots[i].curl);
     }
+    for (i = 0; i < pageCount; i++)
+        json_object_put(pages[i]);
+    curl_multi_cleanup(multi);
+    free(slots);
+    free(pages);
+    return result;
 }
 
-void zconnDeleteMapById(int id)
+/**
+ * Get hosts, with their interfaces and the items used by the mapper, from the Zabbix API.
+ * Uses a single host.get (batched with an item.get when the items are narrowed) or pages of them when paging is set.
+ * @param [in] ctx      client context.
+ * @param [in] ids      array of host ID strings to get, or NULL for all hosts.
+ * @return              array of hosts or NULL on failure.
+ * */
+static json_object *zconnGetHosts(struct zconnCtx *ctx, json_object *ids)
 {
-    // Delete map by ID
-    json_object *idArr = json_object_new_array_ext(1);
-    json_object_array_add(idArr, json_object_new_int(id));
-    json_object *response = zconnResp("map.delete", idArr);
-    json_object_put(response);
+    json_object *result;
+    if (ids && json_object_array_length(ids) == 0)
+        result = json_object_new_array(); // Nothing to get.
+    else if (ctx->pageSize > 0)
+    {
+        json_object *pageIds = (ids) ? json_object_get(ids) : zconnListHostIds(ctx);
+        result = (pageIds) ? zconnGetHostPages(ctx, pageIds, ctx->pageSize, NULL) : NULL;
+        json_object_put(pageIds);
+    }
+    else if (ctx->narrowItems)
+    {
+        // The host.get and item.get are independent so are sent together.
+        struct zconnBatch batch;
+        zconnBatchInit(&batch);
+        int call = zconnBatchHosts(ctx, &batch, ids);
+        zconnBatchRun(ctx, &batch);
+        result = zconnBatchHostsResult(ctx, &batch, call);
+        zconnBatchFree(&batch);
+    }
+    else
+        result = zconnResp(ctx, "host.get", zconnHostParams(ctx, (ids) ? json_object_get(ids) : NULL));
+    return result;
 }
 
-void zconnDeleteMapByName(char *name)
+/**
+ * Get hosts from the Zabbix API with a single host.get, scanning them straight from the raw response.
+ * When the items come with the hosts and there are no pages, nothing has to be joined to the hosts, so no json-c objects
+ * need to be built for them at all. The hosts are written to the cache file just as they were received.
+ * @param [in] ctx          client context.
+ * @param [in] ids          array of host ID strings to get, or NULL for all hosts.
+ * @param [in] cacheFile    file the hosts are written to, or NULL. Left as it was if the hosts could not be got.
+ * @param [out] hosts       the hosts.
+ * @return                  1 if the hosts were got, 0 on failure.
+ * */
+static int zconnGetHostsRaw(struct zconnCtx *ctx, json_object *ids, char *cacheFile, struct hostCol *hosts)
 {
     if (g_zDebugMode)
-            printf("DEBUG: zconnDeleteMapByName [%s]\n",name);
-    // Delete map by name
-    struct zMapCol maps = zconnGetMaps();
-    int i; // loop itterator
+            printf("DEBUG: zconnGetHostsRaw\n");
+    int ok = 0;
+    char *result;
+    char *resultEnd;
 
-    for (i = 0; i < maps.count; i++)
+    json_object *jobj = zconnRequest(ctx, "host.get", zconnHostParams(ctx, (ids) ? json_object_get(ids) : NULL));
+    if (!jobj)
+        return 0;
+
+    struct ResponseStream chunk;
+    if (!zconnStreamInitRaw(&chunk))
+    {
+        fprintf(stderr, "Out of memory attempting to hold the response");
+        json_object_put(jobj);
+        return 0;
+    }
+
+    if (zconnPost(ctx, jobj, "host.get", &chunk))
     {
-        if (strcmp(maps.zMaps[i].name, name) == 0)
+        if (g_zDebugMode)
+            printf("DEBUG: curl response size: %zu, peak RSS %li KB\n", chunk.size, zconnPeakRss());
+        if (zconnScanResult(chunk.raw, chunk.size, &result, &resultEnd))
         {
-            // match found
-            zconnDeleteMapById(maps.zMaps[i].sysId);
-            break;
+            // Cached before the scan, which changes the text.
+            FILE *fp = (cacheFile) ? fopen(cacheFile, "w") : NULL;
+            if (cacheFile && !fp)
+                fprintf(stderr, "Could not open cache file for writing");
+            if (fp)
+            {
+                fwrite(result, 1, resultEnd - result, fp);
+                fclose(fp);
+            }
+            *hosts = zconnScanHosts(result, resultEnd - result, ctx->parseThreads);
+            ok = 1;
+        }
+        else
+        {
+            // Most likely an error. json-c and the usual handling make sense of it.
+            json_object *reply = json_tokener_parse(chunk.raw);
+            json_object_put((reply) ? zconnReplyResult(ctx, "host.get", reply) : NULL);
+            json_object_put(reply);
+            if (!reply)
+                fprintf(stderr, "Error: response to host.get is not valid JSON\n");
         }
     }
 
-    // Free memory in the maps collection
-    for (i = 0; i < maps.count; i++)
-        free(maps.zMaps[i].name);
-    free(maps.zMaps);
-}
-
-struct linkedDevice zconnNewLinkedDevice()
-{
-    // Blank copy of Linked Device structure
-    struct linkedDevice ret;
-    ret.msap = 0;
-    memset(ret.locPortName, '\0', 256);
-    memset(ret.remChassisId, '\0', 256);
-    ret.remChassisIdType = 0; // invalid enum
-    memset(ret.remHostName, '\0', 256);
-    memset(ret.remHostDesc, '\0', 256);
-    memset(ret.remPortId, '\0', 256);
-    ret.remPortIdType = 0; // invalid enum
-    memset(ret.remPortDesc, '\0', 256);
-    return ret;
-}
-
-struct host zconnNewHost()
-{
-    // Blank copy of Host structure
-    struct host ret;
-    ret.id = 0;
-    ret.zabbixId = 0;
-    int i;
-    memset(ret.name, '\0', 129);
-    for (i = 0; i < HOST_INTERFACE_MAX; i++)
-        memset(ret.interfaces[i], '\0', 17); // initialise the interface entry
-    ret.interfaceCount = 0;
-    ret.devicesCount = 0;
-    ret.linkedDevices = NULL;
-    memset(ret.chassisId, '\0', 256);
-    ret.chassisIdType = 0;
-    strcpy(ret.sysDesc,"");
-    return ret;
+    json_object_put(jobj);
+    zconnStreamFree(&chunk);
+    return ok;
 }
 
-struct hostCol zconnParseHosts(json_object *jhosts)
+/**
+ * Bring the hosts from a previous snapshot up to date rather than getting every host again.
+ * Added and removed hosts are found from a host listing, which is a host.get without items and so also gives the names
+ * and interfaces of the kept hosts afresh for little more than their IDs would cost.
+ * Added and removed items are found from an item listing of just the item ID, host ID and the time of the last value
+ * (lastclock), as recorded by the Zabbix server. Only new items and items whose lastclock differs from the snapshot are
+ * requested in full. Comparing the server's own times rather than asking for the values received since the snapshot was
+ * written means values that arrive late through a proxy, or clocks that differ between the mapper and the server, cannot
+ * leave a value out of date. An item renamed without a new value keeps its old name until it gets one or a full run.
+ * The new and changed items and the new hosts are independent and are batched, so the refresh takes three round trips.
+ * @param [in] ctx      client context.
+ * @param [in] cached   hosts from the snapshot, in the form returned by zconnGetHosts. Put in all cases.
+ * @param [in] ids      array of host ID strings wanted, or NULL for all hosts.
+ * @return              array of hosts in the same form and order as zconnGetHosts, or NULL on failure.
+ * */
+static json_object *zconnRefreshHosts(struct zconnCtx *ctx, json_object *cached, json_object *ids)
 {
-    // Convert a JSON object representation of hosts into a struct hostCol (host collection) representation.
     if (g_zDebugMode)
-            printf("DEBUG: zconnParseHosts\n");
-    int intTmp;
-    int i, j, k; // loop itterator.
-    json_object *jhost;
+        printf("DEBUG: zconnRefreshHosts\n");
+    int i, j;
+    int count;
+    int listed;
+    int keptItems = 0;
+    int removedHosts = 0;
+    int newItemCount = 0;
+    int removedItems = 0;
+    int updated = 0;
     json_object *jobjTmp;
-    struct host hostTmp;
-
-    struct hostCol hosts;
-    hosts.count = 0;
-    hosts.count = json_object_array_length(jhosts);
-    hosts.hosts = malloc(hosts.count * sizeof(struct host));
-
-    json_object *interface;
-    json_object *interfaceIp;
-    int interfaceCount;
-    int itemCount;
-    json_object *jitem;     // host item, not just any random item :)
-    json_object *jitems;    // Host items collection.
-    json_object *jitemName; // Name of a given item
-    char itemName[256];
-    char strTmp[256];        // temp string
-    int strStart, strEnd;    // String start and end
-    int msap;                // Device Media Service Access Point for the local connection of the remote port.
-    struct linkedDevice *ld; // Linked Device
-    int ldFound;             // Linked Device found when searching.
+    json_object *jclock;
+    json_object *jhost;
+    json_object *jitem;
+    json_object *jitems;
+    json_object *result = NULL;
+    json_object *listing = NULL;
+    json_object *newItems = NULL;
+    json_object *added = NULL;
+    json_object *hostIds = NULL;
+    int itemsCall = -1;
+    int hostsCall = -1;
+    struct zconnBatch batch = {NULL, NULL, 0, 0};
+    json_object *listParams = zconnHostParams(ctx, (ids) ? json_object_get(ids) : NULL);
+    json_object *hostList;
+    json_object *byId = json_object_new_object();   // host ID to host
+    json_object *itemById = json_object_new_object(); // item ID to item
+    json_object *keptIds = json_object_new_array();
+    json_object *newIds = json_object_new_array();
 
-    if (!hosts.hosts)
+    // List the hosts, with their names and interfaces but without items.
+    json_object_object_del(listParams, "selectItems");
+    json_object_object_add(listParams, "sortfield", json_object_new_string("hostid"));
+    hostList = zconnResp(ctx, "host.get", listParams);
+    if (!hostList)
+        goto freeExit;
+    hostIds = json_object_new_array_ext(json_object_array_length(hostList));
+    for (i = 0; i < (int)json_object_array_length(hostList); i++)
     {
-        fprintf(stderr, "Out of memory attempting to create hosts collection");
-        exit(1); // failure
+        if (json_object_object_get_ex(json_object_array_get_idx(hostList, i), "hostid", &jobjTmp))
+            json_object_array_add(hostIds, json_object_get(jobjTmp));
     }
 
-    for (i = 0; i < hosts.count; i++)
+    // Index the snapshot hosts and their items.
+    count = json_object_array_length(cached);
+    for (i = 0; i < count; i++)
     {
-        jhost = json_object_array_get_idx(jhosts, i);
-        if (jhost)
+        jhost = json_object_array_get_idx(cached, i);
+        if (json_object_object_get_ex(jhost, "hostid", &jobjTmp))
+            json_object_object_add(byId, json_object_get_string(jobjTmp), json_object_get(jhost));
+        if (!json_object_object_get_ex(jhost, "items", &jitems))
+            continue;
+        for (j = 0; j < (int)json_object_array_length(jitems); j++)
         {
-            hosts.hosts[i] = zconnNewHost();
-            if (json_object_object_get_ex(jhost, "hostid", &jobjTmp))
-                hosts.hosts[i].id = json_object_get_int(jobjTmp);
-            hosts.hosts[i].zabbixId = hosts.hosts[i].id; // Copy the device Id and host Id as they are the same for hosts pulled FROM Zabbix
-
-            if (json_object_object_get_ex(jhost, "host", &jobjTmp))
-                strcpy(hosts.hosts[i].name, json_object_get_string(jobjTmp));
-
-            if (json_object_object_get_ex(jhost, "interfaces", &jobjTmp))
-            {
-                // IP addresses
-                interfaceCount = json_object_array_length(jobjTmp);
-                if (interfaceCount > HOST_INTERFACE_MAX)
-                    fprintf(stderr, "Host %i contains more interfaces than the host struct is capable of accepting. Will assimilate as much data as possible.", hosts.hosts[i].id);
-
-                for (j = 0; j < interfaceCount; j++)
-                {
-                    interface = json_object_array_get_idx(jobjTmp, j);
-                    if (json_object_object_get_ex(interface, "ip", &interfaceIp))
-                    {
-                        // Copy IP address from JSON object to hosts interface entry.
-                        strcpy(hosts.hosts[i].interfaces[hosts.hosts[i].interfaceCount], json_object_get_string(interfaceIp));
-                        hosts.hosts[i].interfaceCount++;
-                    }
-                }
-            }
+            jitem = json_object_array_get_idx(jitems, j);
+            if (json_object_object_get_ex(jitem, "itemid", &jobjTmp))
+                json_object_object_add(itemById, json_object_get_string(jobjTmp), json_object_get(jitem));
+        }
+    }
 
+    // Split the wanted hosts into those already in the snapshot and those that are new. The kept hosts take their names
+    // and interfaces from the listing, as they may have been renamed or readdressed since the snapshot.
+    count = json_object_array_length(hostList);
+    for (i = 0; i < count; i++)
+    {
+        json_object *jlisted = json_object_array_get_idx(hostList, i);
+        if (!json_object_object_get_ex(jlisted, "hostid", &jobjTmp))
+            continue;
+        if (json_object_object_get_ex(byId, json_object_get_string(jobjTmp), &jhost))
+        {
+            json_object_array_add(keptIds, json_object_get(jobjTmp));
             if (json_object_object_get_ex(jhost, "items", &jitems))
-            {
-                // host items collection
-                itemCount = json_object_array_length(jitems);
-                for (j = 0; j < itemCount; j++)
-                {
-                    jitem = json_object_array_get_idx(jitems, j);
-
-                    if (json_object_object_get_ex(jitem, "name", &jitemName))
-                    {
-                        if (json_object_get_string_len(jitemName) > 0)
-                        {
-                            // Attempt to extract MSAP number from the item. If successful then this is a reference to a remote connection.
-                            memset(itemName, '\0', 256);
-                            strcpy(itemName, json_object_get_string(jitemName));
-
-                            msap = 0;
-
-                            // MSAP number will be inside the string in format "[MSAP 201]" so we want the 201 from it.
-                            strStart = instr("[MSAP", itemName, 0);
-                            strEnd = instr("]", itemName, strStart);
-
-                            if (strStart > -1 && strEnd >= (strStart + 6))
-                            {
-                                // MSAP string found. 6 to account for "[MSAP "
-                                strStart += 6;
-                                memset(strTmp, '\0', 256); // Initialise
-                                memcpy(strTmp, &itemName[strStart], (strEnd - strStart));
-                                msap = atoi(strTmp);
-                            }
-                            if (msap > 0)
-                            {
-                                // MSAP value parsed. Check to see if LinkedDevices already contains a reference to the matching remote device.
-                                // This is acheived by searching for a matching MSAP in the existing collection.
-                                ldFound = 0;
-                                for (k = 0; k < hosts.hosts[i].devicesCount; k++)
-                                {
-                                    if (hosts.hosts[i].linkedDevices[k].msap == msap)
-                                    {
-                                        // matching linked device found already recorded against host
-                                        ldFound = 1;
-                                        ld = &(hosts.hosts[i].linkedDevices[k]);
-                                        break;
-                                    }
-                                }
-                                if (ldFound == 0)
-                                {
-                                    // Linked device was not found so we need to create it.
-                                    struct linkedDevice *tmpPtr = realloc(hosts.hosts[i].linkedDevices, (hosts.hosts[i].devicesCount + 1) * sizeof(struct linkedDevice));
-                                    if (tmpPtr)
-                                    {
-                                        hosts.hosts[i].linkedDevices = tmpPtr;
-                                        hosts.hosts[i].devicesCount++;
-                                        hosts.hosts[i].linkedDevices[hosts.hosts[i].devicesCount - 1] = zconnNewLinkedDevice();
-                                    }
-                                    else
-                                    {
-                                        fprintf(stderr, "Out of memory while attempting to expand the linked devices buffer");
-                                        free(hosts.hosts);
-                                        exit(1); // failure
-                                    }
-                                    // populate new linked Device - MSAP
-                                    ld = &(hosts.hosts[i].linkedDevices[hosts.hosts[i].devicesCount - 1]);
-                                    ld->msap = msap;
-
-                                    // populate new linked Device - Local Port Details
-                                    strStart = instr("[Port - ", itemName, 0);
-                                    strEnd = instr("]", itemName, strStart);
-
-                                    if (strStart > -1 && strEnd >= (strStart + 8))
-                                    {
-                                        // Port string found. 8 to account for "[Port - "
-                                        strStart += 8;
-                                        memset(strTmp, '\0', 256); // Initialise
-                                        memcpy(strTmp, &itemName[strStart], (strEnd - strStart));
-                                        strcpy(ld->locPortName, strTmp);
-                                    }
-                                }
-                                // Search the item name for specific key words that indicate what the field is. If found,
-                                // copy the value into the appropriate field in the linked devices struct.
-                                if (instr("Chassis Info Type", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        ld->remChassisIdType = json_object_get_int(jobjTmp);
-                                }
-                                else if (instr("Chassis Info", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                    {
-                                        strcpy(ld->remChassisId, json_object_get_string(jobjTmp));
-                                    }
-                                }
-                                else if (instr("Host Desc", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(ld->remHostDesc, json_object_get_string(jobjTmp));
-                                }
-                                else if (instr("Host", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(ld->remHostName, json_object_get_string(jobjTmp));
-                                }
-                                else if (instr("Interface Info Type", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        ld->remPortIdType = json_object_get_int(jobjTmp);
-                                }
-                                else if (instr("Interface Info", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(ld->remPortId, json_object_get_string(jobjTmp));
-                                }
-                                else if (instr("Interface Desc", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(ld->remPortDesc, json_object_get_string(jobjTmp));
-                                }
-                            }
-                            else
-                            {
-                                // MSAP not found or not valid. Data probably relates to the local host device instead.
-                                if (instr("Chassis Id Type", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        hosts.hosts[i].chassisIdType = json_object_get_int(jobjTmp);
-                                }
-                                else if (instr("Chassis Id", itemName, 0) > -1)
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(hosts.hosts[i].chassisId, json_object_get_string(jobjTmp));
-                                }
-                                else if (instr("System description", itemName, 0) > -1) // Not used by Zabbix Mapper directly but useful to the bitmap renderer if used.
-                                {
-                                    if (json_object_object_get_ex(jitem, "lastvalue", &jobjTmp))
-                                        strcpy(hosts.hosts[i].sysDesc, json_object_get_string(jobjTmp));
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+                keptItems += json_object_array_length(jitems);
+            if (json_object_object_get_ex(jlisted, "host", &jobjTmp))
+                json_object_object_add(jhost, "host", json_object_get(jobjTmp));
+            if (json_object_object_get_ex(jlisted, "interfaces", &jobjTmp))
+                json_object_object_add(jhost, "interfaces", json_object_get(jobjTmp));
         }
+        else
+            json_object_array_add(newIds, json_object_get(jobjTmp));
     }
-    return hosts;
-}
+    json_object_put(hostList);
+    removedHosts = json_object_array_length(cached) - json_object_array_length(keptIds);
 
-struct hostCol zconnGetHostsFromFile(char *fileName)
-{
-    if (g_zDebugMode)
-            printf("DEBUG: zconnGetHostsFromFile\n");
-    /* declare a file pointer */
-    FILE *infile;
-    char *buffer;
-    long numbytes;
-    struct hostCol ret; // Default NULL object
-    ret.count = 0;
-    ret.hosts = NULL;
+    if (json_object_array_length(keptIds) > 0)
+        listing = zconnResp(ctx, "item.get", zconnItemParams(ctx, json_object_get(keptIds), 1));
+    else
+        listing = json_object_new_array();
+    if (!listing)
+        goto freeExit;
 
-    /* open an existing file for reading */
-    infile = fopen(fileName, "r");
+    // Find the items that are not in the snapshot and those with a value newer than (or just different to) the snapshot.
+    json_object *newItemIds = json_object_new_array();
+    listed = json_object_array_length(listing);
+    for (i = 0; i < listed; i++)
+    {
+        json_object *jlisted = json_object_array_get_idx(listing, i);
+        json_object_object_get_ex(jlisted, "itemid", &jobjTmp);
+        if (!json_object_object_get_ex(itemById, json_object_get_string(jobjTmp), &jitem))
+            newItemCount++;
+        else if (json_object_object_get_ex(jlisted, "lastclock", &jclock) && json_object_object_get_ex(jitem, "lastclock", &jobjTmp) &&
+                 strcmp(json_object_get_string(jclock), json_object_get_string(jobjTmp)) == 0)
+            continue; // Same value as the snapshot
+        else
+            updated++;
+        json_object_array_add(newItemIds, json_object_get(json_object_object_get(jlisted, "itemid")));
+    }
+    removedItems = keptItems - (listed - newItemCount);
 
-    /* quit if the file does not exist */
-    if (infile == NULL)
-        return ret;
+    // The new and changed items and the new hosts are independent, so are sent together. Hosts too many for one page are paged as normal.
+    int pagedHosts = (ctx->pageSize > 0 && (int)json_object_array_length(newIds) > ctx->pageSize);
+    zconnBatchInit(&batch);
+    if (json_object_array_length(newItemIds) > 0)
+    {
+        json_object *params = zconnItemParams(ctx, NULL, 0);
+        json_object_object_add(params, "itemids", json_object_get(newItemIds));
+        itemsCall = zconnBatchAdd(ctx, &batch, "item.get", params);
+    }
+    json_object_put(newItemIds);
+    if (json_object_array_length(newIds) > 0 && !pagedHosts)
+        hostsCall = zconnBatchHosts(ctx, &batch, newIds);
+    if (!zconnBatchRun(ctx, &batch))
+        goto freeExit;
+    newItems = (itemsCall >= 0) ? zconnBatchResult(&batch, itemsCall) : json_object_new_array();
+    if (pagedHosts)
+        added = zconnGetHosts(ctx, newIds);
+    else
+        added = (hostsCall >= 0) ? zconnBatchHostsResult(ctx, &batch, hostsCall) : json_object_new_array();
+    if (!added)
+        goto freeExit;
 
-    /* Get the number of bytes */
-    fseek(infile, 0L, SEEK_END);
-    numbytes = ftell(infile);
+    for (i = 0; i < (int)json_object_array_length(newItems); i++)
+    {
+        jitem = json_object_array_get_idx(newItems, i);
+        json_object_object_del(jitem, "hostid"); // Not part of the selectItems output.
+        json_object_object_get_ex(jitem, "itemid", &jobjTmp);
+        json_object_object_add(itemById, json_object_get_string(jobjTmp), json_object_get(jitem));
+    }
 
-    /* reset the file position indicator to the beginning of the file */
-    fseek(infile, 0L, SEEK_SET);
+    // Rebuild the items of each kept host in the order they were listed, which drops any removed items.
+    json_object *itemsByHost = json_object_new_object();
+    for (i = 0; i < (int)json_object_array_length(keptIds); i++)
+    {
+        json_object_object_get_ex(byId, json_object_get_string(json_object_array_get_idx(keptIds, i)), &jhost);
+        jitems = json_object_new_array();
+        json_object_object_add(jhost, "items", jitems);
+        json_object_object_add(itemsByHost, json_object_get_string(json_object_array_get_idx(keptIds, i)), json_object_get(jitems));
+    }
+    for (i = 0; i < listed; i++)
+    {
+        json_object *jlisted = json_object_array_get_idx(listing, i);
+        json_object_object_get_ex(jlisted, "itemid", &jobjTmp);
+        if (!json_object_object_get_ex(itemById, json_object_get_string(jobjTmp), &jitem))
+            continue; // Removed between the listing and the item.get
+        json_object_object_get_ex(jlisted, "hostid", &jobjTmp);
+        if (json_object_object_get_ex(itemsByHost, json_object_get_string(jobjTmp), &jitems))
+            json_object_array_add(jitems, json_object_get(jitem));
+    }
+    json_object_put(itemsByHost);
 
-    /* grab sufficient memory for the buffer to hold the text */
-    buffer = (char *)calloc(numbytes, sizeof(char));
+    // Put all of the hosts in the order they were listed.
+    for (i = 0; i < (int)json_object_array_length(added); i++)
+    {
+        jhost = json_object_array_get_idx(added, i);
+        if (json_object_object_get_ex(jhost, "hostid", &jobjTmp))
+            json_object_object_add(byId, json_object_get_string(jobjTmp), json_object_get(jhost));
+    }
+    result = json_object_new_array_ext(count = json_object_array_length(hostIds));
+    for (i = 0; i < count; i++)
+    {
+        if (json_object_object_get_ex(byId, json_object_get_string(json_object_array_get_idx(hostIds, i)), &jhost))
+            json_object_array_add(result, json_object_get(jhost));
+    }
 
-    /* memory error */
-    if (buffer == NULL)
-        return ret;
+    if (g_zDebugMode)
+        printf("DEBUG: zconnRefreshHosts %i hosts kept, %i added, %i removed. %i items added, %i removed, %i values updated\n",
+               (int)json_object_array_length(keptIds), (int)json_object_array_length(added), removedHosts, newItemCount, removedItems, updated);
 
-    /* copy all the text into the buffer */
-    fread(buffer, sizeof(char), numbytes, infile);
-    fclose(infile);
+freeExit:
+    zconnBatchFree(&batch);
+    json_object_put(added);
+    json_object_put(newItems);
+    json_object_put(listing);
+    json_object_put(newIds);
+    json_object_put(keptIds);
+    json_object_put(itemById);
+    json_object_put(byId);
+    json_object_put(hostIds);
+    json_object_put(cached);
+    return result;
+}
 
-    struct json_tokener *tok = json_tokener_new();
-    enum json_tokener_error jerr;
-    json_object *jobj;
+/**
+ * Get hosts from the Zabbix API in pages, parsing each page on a pool of parser threads as soon as it arrives so that
+ * parsing overlaps the download of the remaining pages.
+ * @param [in] ctx      client context.
+ * @param [in] ids      array of host ID strings to get, or NULL for all hosts.
+ * @param [out] hosts   parsed hosts, in the same order as the returned array. Not set on failure.
+ * @return              array of hosts or NULL on failure.
+ * */
+static json_object *zconnGetHostsPipelined(struct zconnCtx *ctx, json_object *ids, struct hostCol *hosts)
+{
+    int i;
+    int size = (ctx->pageSize > 0) ? ctx->pageSize : PIPELINE_PAGE_SIZE;
+    double start = zconnNow();
+    struct zconnPipeline pipe;
 
-    do
-    {
-        jobj = json_tokener_parse_ex(tok, buffer, numbytes);
-    } while ((jerr = json_tokener_get_error(tok)) == json_tokener_continue);
-    if (jerr != json_tokener_success)
+    json_object *pageIds = (ids) ? json_object_get(ids) : zconnListHostIds(ctx);
+    if (!pageIds)
+        return NULL;
+    int pageCount = (json_object_array_length(pageIds) + size - 1) / size;
+    if (!zconnPipelineStart(&pipe, pageCount, ctx->parserThreads))
     {
-        fprintf(stderr, "Error: %s\n", json_tokener_error_desc(jerr));
-        return ret;
+        json_object_put(pageIds);
+        return NULL;
     }
 
-    json_tokener_free(tok);
-
-    /* free the memory we used for the buffer */
-    free(buffer);
+    json_object *result = zconnGetHostPages(ctx, pageIds, size, &pipe);
+    json_object_put(pageIds);
 
-    if (jobj)
-        ret = zconnParseHosts(jobj);
+    // Join the slices together, in page order.
+    int count = 0;
+    for (i = 0; i < pageCount; i++)
+        count += pipe.slices[i].count;
+    struct zarena *arena = (result) ? zarenaNew() : NULL;
+    struct host *joined = (arena) ? zarenaAlloc(arena, (count + 1) * sizeof *joined) : NULL;
+    if (joined)
+    {
+        hosts->count = 0;
+        hosts->hosts = joined;
+        hosts->arena = arena;
+        for (i = 0; i < pageCount; i++)
+        {
+            memcpy(&joined[hosts->count], pipe.slices[i].hosts, pipe.slices[i].count * sizeof *joined);
+            hosts->count += pipe.slices[i].count;
+            zarenaAdopt(arena, pipe.slices[i].arena); // The linked devices now belong to the joined hosts.
+        }
+    }
+    else
+    {
+        if (result)
+            fprintf(stderr, "Out of memory attempting to join the parsed host pages");
+        zarenaFree(arena);
+        for (i = 0; i < pageCount; i++)
+            freeHostCol(&pipe.slices[i]);
+        json_object_put(result);
+        result = NULL;
+    }
 
-    json_object_put(jobj);
-    return ret;
-    //return jobj;
+    if (g_zDebugMode)
+    {
+        double busy = 0.0;
+        for (i = 0; i < pipe.threadCount; i++)
+            busy += pipe.parsers[i].busy;
+        printf("DEBUG: zconnGetHostsPipelined %i pages in %.3fs, %.3fs parsing across %i threads\n", pageCount, zconnNow() - start, busy, pipe.threadCount);
+    }
+    free(pipe.slices);
+    free(pipe.parsers);
+    return result;
 }
 
-struct hostCol zconnGetHostsFromAPI(char *cacheFile)
+struct hostCol zconnGetHostsFromAPI(struct zconnCtx *ctx, char *cacheFile)
 {
     if (g_zDebugMode)
             printf("DEBUG: zconnGetHostsFromAPI\n");
     struct hostCol ret; // Default NULL object
     ret.count = 0;
     ret.hosts = NULL;
+    ret.arena = NULL;
 
-    // Get hosts list from the Zabbix API.
-    // Build the parameters list
-    json_object *outputParam = json_object_new_array_ext(2);
-    json_object *interfacesParam = json_object_new_array_ext(2);
-    json_object *itemsParam = json_object_new_array_ext(4);
-
-    json_object_array_add(outputParam, json_object_new_string("hostid"));
-    json_object_array_add(outputParam, json_object_new_string("host"));
-
-    json_object_array_add(interfacesParam, json_object_new_string("interfaceid"));
-    json_object_array_add(interfacesParam, json_object_new_string("ip"));
-
-    json_object_array_add(itemsParam, json_object_new_string("itemid"));
-    json_object_array_add(itemsParam, json_object_new_string("name"));
-    json_object_array_add(itemsParam, json_object_new_string("lastvalue"));
-    json_object_array_add(itemsParam, json_object_new_string("value_type"));
-
-    // Build the request object
-    json_object *params = json_object_new_object();
-    json_object_object_add(params, "output", outputParam);
-    json_object_object_add(params, "selectInterfaces", interfacesParam);
-    json_object_object_add(params, "selectItems", itemsParam);
+    // When filtering by IP address, find the hosts in range first so that only those hosts are requested.
+    json_object *ids = NULL;
+    if (ctx->ipFilter)
+    {
+        ids = zconnFilterHostIds(ctx, ctx->ipFilter);
+        if (!ids)
+            return ret;
+    }
 
-    json_object *result = zconnResp("host.get", params);
-    if (cacheFile)
+    // Refresh the previous snapshot if there is one, otherwise get the hosts list from the Zabbix API.
+    json_object *result = NULL;
+    if (ctx->incremental && cacheFile)
+    {
+        json_object *cached = zconnReadJsonFile(cacheFile);
+        if (cached && json_object_is_type(cached, json_type_array))
+            result = zconnRefreshHosts(ctx, cached, ids);
+        else
+            json_object_put(cached);
+    }
+    int parsed = 0; // set if the hosts were parsed as they were downloaded
+    if (!result && ctx->parserThreads > 0)
+        parsed = (result = zconnGetHostsPipelined(ctx, ids, &ret)) != NULL;
+    else if (!result && !ctx->narrowItems && ctx->pageSize == 0 && ctx->fixtureMode != FIXTURE_RECORD && !(ids && json_object_array_length(ids) == 0))
+        zconnGetHostsRaw(ctx, ids, cacheFile, &ret); // Nothing to join, so nothing for json-c to do. Cached as received.
+    else if (!result)
+        result = zconnGetHosts(ctx, ids);
+    json_object_put(ids);
+    if (cacheFile && result) // A failed request leaves the previous cache in place.
     {
         FILE *fp;
         fp = fopen(cacheFile, "w");
@@ -741,44 +3796,82 @@ struct hostCol zconnGetHostsFromAPI(char *cacheFile)
         }
     }
 
-    if (result)
-        ret = zconnParseHosts(result);
+    if (result && !parsed)
+        ret = zconnParseHosts(result, ctx->parseThreads);
 
     json_object_put(result);
+    if (g_zDebugMode)
+        printf("DEBUG: zconnGetHostsFromAPI %i hosts, peak RSS %li KB\n", ret.count, zconnPeakRss());
     return ret;
 }
 
 /**
- * Create a map in Zabbix from the supplied host link data.
- * @param [in] hl       Host Link data that defines the map
- * @param [in] name     name of the map 
- * @param [in] w        width of the map
- * @param [in] h        height of the map
- * @param [in] linkLabels   if 1 then links will contain labels
- * @return              SysID - ID of the map that is created*/
-int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabels)
+ * Index the selements of a map already in Zabbix so that the hosts being mapped can keep their selement IDs.
+ * Host elements are indexed by host ID. Image elements (pseudo hosts and hubs) have no host so are indexed by label,
+ * with an array of selement IDs for labels used more than once.
+ * @param [in] selements    selements returned by map.get selectSelements.
+ * @param [out] maxId       highest selement ID in use.
+ * @return                  index object. Caller must put.
+ * */
+static json_object *zconnIndexSelements(json_object *selements, int *maxId)
 {
-    if (g_zDebugMode)
-            printf("DEBUG: createMap [%s]\n",name);
     int i;
-    int intMaxLen = 17;     // Maximum length of a string representation of an integer
-    char strTmp[intMaxLen]; // String representation of a number
-    if (w < 0.0 || h < 0.0)
-    {
-        fprintf(stderr, "Attempt to create a map of zero dimensions");
-        return 0;
-    }
-    if (hl->hosts.count < 1)
+    char key[160];
+    json_object *jobjTmp;
+    json_object *jids;
+    json_object *index = json_object_new_object();
+
+    *maxId = 0;
+    for (i = 0; selements && i < (int)json_object_array_length(selements); i++)
     {
-        fprintf(stderr, "Attempt to create a map with no hosts");
-        return 0;
+        json_object *selement = json_object_array_get_idx(selements, i);
+        json_object *jid;
+        if (!json_object_object_get_ex(selement, "selementid", &jid))
+            continue;
+        if (json_object_get_int(jid) > *maxId)
+            *maxId = json_object_get_int(jid);
+
+        if (json_object_object_get_ex(selement, "elementtype", &jobjTmp) && json_object_get_int(jobjTmp) == 0)
+        {
+            json_object_object_get_ex(selement, "elements", &jobjTmp);
+            if (!json_object_object_get_ex(json_object_array_get_idx(jobjTmp, 0), "hostid", &jobjTmp))
+                continue;
+            snprintf(key, sizeof key, "host:%s", json_object_get_string(jobjTmp));
+            json_object_object_add(index, key, json_object_get(jid));
+        }
+        else
+        {
+            json_object_object_get_ex(selement, "label", &jobjTmp);
+            snprintf(key, sizeof key, "image:%s", json_object_get_string(jobjTmp));
+            if (!json_object_object_get_ex(index, key, &jids))
+            {
+                jids = json_object_new_array();
+                json_object_object_add(index, key, jids);
+            }
+            json_object_array_add(jids, json_object_get(jid));
+        }
     }
+    return index;
+}
 
-    json_object *params = json_object_new_object();
-    json_object_object_add(params, "name", json_object_new_string(name));
-    json_object_object_add(params, "width", json_object_new_int(w));
-    json_object_object_add(params, "height", json_object_new_int(h));
-    json_object_object_add(params, "label_type", json_object_new_int(0));
+/**
+ * Add the selements and links for the supplied host link data to map.create or map.update parameters.
+ * @param [in,out] params   parameters the selements and links are added to.
+ * @param [in] hl           Host Link data that defines the map
+ * @param [in] linkLabels   if 1 then links will contain labels
+ * @param [in] existing     selements of the map already in Zabbix, or NULL for a new map. Hosts that are already on the
+ *                          map keep their selement ID and the other hosts are given IDs above those in use.
+ * */
+static void zconnMapElements(json_object *params, struct hostLink *hl, int linkLabels, json_object *existing)
+{
+    int i;
+    int intMaxLen = 17;     // Maximum length of a string representation of an integer
+    char strTmp[intMaxLen]; // String representation of a number
+    char key[160];
+    int maxId = 0;
+    json_object *jobjTmp;
+    json_object *index = (existing) ? zconnIndexSelements(existing, &maxId) : NULL;
+    json_object *selementIds = json_object_new_object(); // host ID to selement ID, used by the links
 
     // Add the hosts as selements
     json_object *selements = json_object_new_array_ext(hl->hosts.count);
@@ -786,15 +3879,50 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
     {
         struct host *h = &hl->hosts.hosts[i];
         json_object *selement = json_object_new_object();
+        json_object *selementId = NULL;
 
-        // selement ID
-        snprintf(strTmp, intMaxLen, "%i", h->id); // ID of the host, used for the selement ID
-        json_object_object_add(selement, "selementid", json_object_new_string(strTmp));
+        // selement ID. The ID of the host for a new map, or the existing element for the host when updating.
+        if (index)
+        {
+            if (h->zabbixId != 0)
+            {
+                snprintf(key, sizeof key, "host:%i", h->zabbixId);
+                if (json_object_object_get_ex(index, key, &jobjTmp))
+                {
+                    selementId = json_object_get(jobjTmp);
+                    json_object_object_del(index, key); // Each element is only used once.
+                }
+            }
+            else
+            {
+                snprintf(key, sizeof key, "image:%s", zstrGet(h->name));
+                if (json_object_object_get_ex(index, key, &jobjTmp) && json_object_array_length(jobjTmp) > 0)
+                {
+                    selementId = json_object_get(json_object_array_get_idx(jobjTmp, 0));
+                    json_object_array_del_idx(jobjTmp, 0, 1);
+                }
+            }
+            if (!selementId)
+            {
+                snprintf(strTmp, intMaxLen, "%i", ++maxId);
+                selementId = json_object_new_string(strTmp);
+            }
+        }
+        else
+        {
+            snprintf(strTmp, intMaxLen, "%i", h->id);
+            selementId = json_object_new_string(strTmp);
+        }
+        json_object_object_add(selement, "selementid", selementId);
+        snprintf(strTmp, intMaxLen, "%i", h->id);
+        json_object_object_add(selementIds, strTmp, json_object_get(selementId));
 
-        // host id inside an elements array
+        // host id inside an elements array. The Zabbix host, as the host IDs are renumbered when merging servers.
+        if (h->zabbixId != 0)
+            snprintf(strTmp, intMaxLen, "%i", h->zabbixId);
         json_object *elements = json_object_new_array_ext(1);
         json_object *hostId = json_object_new_object();
-        json_object_object_add(hostId, "hostid", json_object_new_string(strTmp));
+        json_object_object_add(hostId, "hostid", json_object_new_string(strTmp)); // ID of the host
         json_object_array_add(elements, hostId);
         json_object_object_add(selement, "elements", elements);
 
@@ -805,7 +3933,7 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
         snprintf(strTmp, intMaxLen, "%i", 2);
         json_object_object_add(selement, "iconid_off", json_object_new_string(strTmp));
 
-        json_object_object_add(selement, "label", json_object_new_string(h->name));
+        json_object_object_add(selement, "label", json_object_new_string(zstrGet(h->name)));
 
         // position of the host on the canvas
         json_object_object_add(selement, "x", json_object_new_int(h->xPos));
@@ -824,9 +3952,11 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
         // Create the link
         json_object *link = json_object_new_object();
         snprintf(strTmp, intMaxLen, "%i", l->a.hostId);
-        json_object_object_add(link, "selementid1", json_object_new_string(strTmp));
+        json_object_object_get_ex(selementIds, strTmp, &jobjTmp);
+        json_object_object_add(link, "selementid1", json_object_get(jobjTmp));
         snprintf(strTmp, intMaxLen, "%i", l->b.hostId);
-        json_object_object_add(link, "selementid2", json_object_new_string(strTmp));
+        json_object_object_get_ex(selementIds, strTmp, &jobjTmp);
+        json_object_object_add(link, "selementid2", json_object_get(jobjTmp));
 
         // Add the label to the link
         if(linkLabels==1)
@@ -870,13 +4000,13 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
 
             // Place the ports in the correct order in the labels negating the need to put the host names on the links too (takes up too much space).
             if(ha->yPos<hb->yPos)
-                strncat(label,l->a.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->a.portRef),labelMaxLen-strlen(label));
             else if (ha->yPos>hb->yPos)
-                strncat(label,l->b.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->b.portRef),labelMaxLen-strlen(label));
             else if (ha->xPos<hb->yPos)
-                strncat(label,l->a.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->a.portRef),labelMaxLen-strlen(label));
             else 
-                strncat(label,l->b.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->b.portRef),labelMaxLen-strlen(label));
 
             strncat(label,"]\n<->\n",labelMaxLen-strlen(label));
             //strncat(label,l->b.chassisId,labelMaxLen-strlen(label));
@@ -894,13 +4024,13 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
             strncat(label," [",labelMaxLen-strlen(label));
             // Place the ports in the correct order in the labels negating the need to put the host names on the links too (takes up too much space).
             if(ha->yPos<hb->yPos)
-                strncat(label,l->b.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->b.portRef),labelMaxLen-strlen(label));
             else if (ha->yPos>hb->yPos)
-                strncat(label,l->a.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->a.portRef),labelMaxLen-strlen(label));
             else if (ha->xPos<hb->yPos)
-                strncat(label,l->b.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->b.portRef),labelMaxLen-strlen(label));
             else 
-                strncat(label,l->a.portRef,labelMaxLen-strlen(label));
+                strncat(label,zstrGet(l->a.portRef),labelMaxLen-strlen(label));
 
             strncat(label,"]",labelMaxLen-strlen(label));
             json_object_object_add(link, "label", json_object_new_string(label));
@@ -910,7 +4040,214 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
     }
     json_object_object_add(params, "links", links);
 
-    json_object *result = zconnResp("map.create", params);
+    json_object_put(selementIds);
+    json_object_put(index);
+}
+
+/**
+ * Compare a field of a new map element (or link) with the same field of the one already in Zabbix.
+ * The API returns every field as a string so the values are compared as strings, with a missing field taken as empty.
+ * @return      1 if the field is the same, 0 if it has changed.
+ * */
+static int zconnSameField(json_object *a, json_object *b, const char *field)
+{
+    json_object *ja, *jb;
+    const char *strA = (json_object_object_get_ex(a, field, &ja)) ? json_object_get_string(ja) : ""; // A missing field is empty
+    const char *strB = (json_object_object_get_ex(b, field, &jb)) ? json_object_get_string(jb) : "";
+    return strcmp(strA, strB) == 0;
+}
+
+/**
+ * Key identifying the two ends of a link, regardless of the direction it was drawn in.
+ * */
+static void zconnLinkKey(json_object *link, char *key, size_t len)
+{
+    json_object *jobjTmp;
+    long long a = 0, b = 0;
+    if (json_object_object_get_ex(link, "selementid1", &jobjTmp))
+        a = json_object_get_int64(jobjTmp);
+    if (json_object_object_get_ex(link, "selementid2", &jobjTmp))
+        b = json_object_get_int64(jobjTmp);
+    snprintf(key, len, "%lld-%lld", (a < b) ? a : b, (a < b) ? b : a);
+}
+
+/**
+ * Reduce map.update parameters to the changes from the map already in Zabbix.
+ * map.update replaces the whole selements (and links) array, so every element that is kept must still be listed, but
+ * an unchanged element is sent with only its selementid and an unchanged link with only its linkid. The links are
+ * left out altogether if none of them changed, as are the size and label type of the map.
+ * @param [in,out] params   map.update parameters built by zconnMapElements against the existing map.
+ * @param [in] jmap         the map already in Zabbix, from zconnFindMap with its layout.
+ * @return                  number of changes. 0 if the map is already up to date and no update is needed.
+ * */
+static int zconnMapDiff(json_object *params, json_object *jmap)
+{
+    int i;
+    int count;
+    int changed = 0, added = 0, removed = 0;
+    int linksChanged = 0, linksAdded = 0, linksRemoved = 0;
+    char key[50];
+    json_object *jobjTmp;
+    json_object *selements;
+    json_object *links;
+    json_object *existing;
+    json_object *byId = json_object_new_object(); // existing selement ID to selement, and link ends to link
+
+    // Map size and label type
+    if (zconnSameField(params, jmap, "width") && zconnSameField(params, jmap, "height"))
+    {
+        json_object_object_del(params, "width");
+        json_object_object_del(params, "height");
+    }
+    else
+        changed++;
+    if (zconnSameField(params, jmap, "label_type"))
+        json_object_object_del(params, "label_type");
+    else
+        changed++;
+
+    // Elements
+    if (!json_object_object_get_ex(jmap, "selements", &existing) || !existing)
+        existing = json_object_new_array();
+    else
+        json_object_get(existing);
+    count = json_object_array_length(existing);
+    for (i = 0; i < count; i++)
+    {
+        json_object *selement = json_object_array_get_idx(existing, i);
+        if (json_object_object_get_ex(selement, "selementid", &jobjTmp))
+            json_object_object_add(byId, json_object_get_string(jobjTmp), json_object_get(selement));
+    }
+    json_object_object_get_ex(params, "selements", &selements);
+    for (i = 0; i < (int)json_object_array_length(selements); i++)
+    {
+        json_object *selement = json_object_array_get_idx(selements, i);
+        json_object *old;
+        json_object_object_get_ex(selement, "selementid", &jobjTmp);
+        if (!json_object_object_get_ex(byId, json_object_get_string(jobjTmp), &old))
+        {
+            added++;
+            continue;
+        }
+        count--; // Element kept
+
+        // Image elements have no host so the elements array is only compared for hosts.
+        json_object *jold = NULL, *jnew = NULL;
+        json_object_object_get_ex(old, "elements", &jold);
+        json_object_object_get_ex(selement, "elements", &jnew);
+        int sameHost = json_object_get_int(json_object_object_get(selement, "elementtype")) != 0 ||
+                       (json_object_is_type(jold, json_type_array) && json_object_array_length(jold) > 0 &&
+                        zconnSameField(json_object_array_get_idx(jnew, 0), json_object_array_get_idx(jold, 0), "hostid"));
+        if (sameHost && zconnSameField(selement, old, "elementtype") && zconnSameField(selement, old, "iconid_off") &&
+            zconnSameField(selement, old, "label") && zconnSameField(selement, old, "x") && zconnSameField(selement, old, "y"))
+        {
+            json_object *unchanged = json_object_new_object();
+            json_object_object_add(unchanged, "selementid", json_object_get(jobjTmp));
+            json_object_array_put_idx(selements, i, unchanged);
+        }
+        else
+            changed++;
+    }
+    removed = count;
+    json_object_put(existing);
+
+    // Links, matched by the elements at either end.
+    if (!json_object_object_get_ex(jmap, "links", &existing) || !existing)
+        existing = json_object_new_array();
+    else
+        json_object_get(existing);
+    count = json_object_array_length(existing);
+    for (i = 0; i < count; i++)
+    {
+        json_object *link = json_object_array_get_idx(existing, i);
+        zconnLinkKey(link, key, sizeof key);
+        if (!json_object_object_get_ex(byId, key, &jobjTmp))
+        {
+            jobjTmp = json_object_new_array();
+            json_object_object_add(byId, key, jobjTmp);
+        }
+        json_object_array_add(jobjTmp, json_object_get(link));
+    }
+    json_object_object_get_ex(params, "links", &links);
+    for (i = 0; i < (int)json_object_array_length(links); i++)
+    {
+        json_object *link = json_object_array_get_idx(links, i);
+        zconnLinkKey(link, key, sizeof key);
+        if (!json_object_object_get_ex(byId, key, &jobjTmp) || json_object_array_length(jobjTmp) == 0)
+        {
+            linksAdded++;
+            continue;
+        }
+        json_object *old = json_object_get(json_object_array_get_idx(jobjTmp, 0));
+        json_object_array_del_idx(jobjTmp, 0, 1); // Each existing link is only used once.
+        count--;
+
+        json_object *update = json_object_new_object();
+        json_object_object_get_ex(old, "linkid", &jobjTmp);
+        json_object_object_add(update, "linkid", json_object_get(jobjTmp));
+        if (!zconnSameField(link, old, "label"))
+        {
+            json_object_object_add(update, "label", json_object_new_string((json_object_object_get_ex(link, "label", &jobjTmp)) ? json_object_get_string(jobjTmp) : ""));
+            linksChanged++;
+        }
+        json_object_put(old);
+        json_object_array_put_idx(links, i, update);
+    }
+    linksRemoved = count;
+    json_object_put(existing);
+    if (linksChanged + linksAdded + linksRemoved == 0)
+        json_object_object_del(params, "links"); // Links stay as they are.
+
+    json_object_put(byId);
+    if (g_zDebugMode)
+        printf("DEBUG: zconnMapDiff elements %i changed, %i added, %i removed. links %i changed, %i added, %i removed\n",
+               changed, added, removed, linksChanged, linksAdded, linksRemoved);
+    return changed + added + removed + linksChanged + linksAdded + linksRemoved;
+}
+
+/**
+ * Check the dimensions and host count of a map before it is sent to Zabbix.
+ * @return      1 if the map can be sent, 0 if not.
+ * */
+static int zconnCheckMap(struct hostLink *hl, double w, double h)
+{
+    if (w < 0.0 || h < 0.0)
+    {
+        fprintf(stderr, "Attempt to create a map of zero dimensions");
+        return 0;
+    }
+    if (hl->hosts.count < 1)
+    {
+        fprintf(stderr, "Attempt to create a map with no hosts");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Create a map in Zabbix from the supplied host link data.
+ * @param [in] ctx      client context.
+ * @param [in] hl       Host Link data that defines the map
+ * @param [in] name     name of the map 
+ * @param [in] w        width of the map
+ * @param [in] h        height of the map
+ * @param [in] linkLabels   if 1 then links will contain labels
+ * @return              SysID - ID of the map that is created*/
+int createMap(struct zconnCtx *ctx, struct hostLink *hl, char *name, double w, double h, int linkLabels)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: createMap [%s]\n",name);
+    if (!zconnCheckMap(hl, w, h))
+        return 0;
+
+    json_object *params = json_object_new_object();
+    json_object_object_add(params, "name", json_object_new_string(name));
+    json_object_object_add(params, "width", json_object_new_int(w));
+    json_object_object_add(params, "height", json_object_new_int(h));
+    json_object_object_add(params, "label_type", json_object_new_int(0));
+    zconnMapElements(params, hl, linkLabels, NULL);
+
+    json_object *result = zconnResp(ctx, "map.create", params);
     int mapId = 0;
     if (result)
     {
@@ -922,21 +4259,73 @@ int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabel
     return mapId;
 }
 
+int updateMap(struct zconnCtx *ctx, struct hostLink *hl, char *name, double w, double h, int linkLabels)
+{
+    if (g_zDebugMode)
+            printf("DEBUG: updateMap [%s]\n",name);
+    if (!zconnCheckMap(hl, w, h))
+        return 0;
+
+    json_object *maps = zconnFindMap(ctx, name, 1);
+    if (!maps)
+        return 0; // Lookup failed. Do not risk creating a second map of the same name.
+    if (json_object_array_length(maps) == 0)
+    {
+        json_object_put(maps);
+        return createMap(ctx, hl, name, w, h, linkLabels);
+    }
+
+    json_object *jmap = json_object_array_get_idx(maps, 0);
+    json_object *jobjTmp;
+    json_object *params = json_object_new_object();
+    json_object_object_get_ex(jmap, "sysmapid", &jobjTmp);
+    json_object_object_add(params, "sysmapid", json_object_get(jobjTmp));
+    json_object_object_add(params, "width", json_object_new_int(w));
+    json_object_object_add(params, "height", json_object_new_int(h));
+    json_object_object_add(params, "label_type", json_object_new_int(0));
+    json_object_object_get_ex(jmap, "selements", &jobjTmp);
+    zconnMapElements(params, hl, linkLabels, jobjTmp);
+
+    // Send only what has changed. Nothing is sent if the map is already up to date.
+    size_t fullSize = strlen(json_object_to_json_string(params));
+    int changes = zconnMapDiff(params, jmap);
+    size_t diffSize = strlen(json_object_to_json_string(params));
+    json_object_object_get_ex(jmap, "sysmapid", &jobjTmp);
+    int mapId = json_object_get_int(jobjTmp);
+    json_object_put(maps);
+    if (changes == 0)
+    {
+        if (g_zDebugMode)
+            printf("DEBUG: updateMap [%s] is up to date, %zu byte map.update not sent\n", name, fullSize);
+        json_object_put(params);
+        return mapId;
+    }
+
+    double before = ctx->session.totalTime;
+    json_object *result = zconnResp(ctx, "map.update", params);
+    if (!result)
+        mapId = 0;
+    else if (g_zDebugMode)
+    {
+        // The frontend processes each element sent, so the time a full update would have taken is estimated pro rata.
+        double t = ctx->session.totalTime - before;
+        printf("DEBUG: updateMap [%s] %i changes, sent %zu of %zu bytes, %.3fs (est. %.3fs saved)\n", name, changes, diffSize, fullSize, t,
+               (diffSize > 0) ? t * (double)(fullSize - diffSize) / diffSize : 0.0);
+    }
+    json_object_put(result);
+    return mapId;
+}
+
 /**
- * Free all memory related to a hosts collection.
+ * Free all memory related to a hosts collection, including any links found between the hosts.
  * Does not free the host collection object itself
  * */
 void freeHostCol(struct hostCol *hosts)
 {
     if (g_zDebugMode)
             printf("DEBUG: freeHostCol\n");
-    int i; // loop itterator.
-    if (hosts->count > 0)
-    {
-        for (i = 0; i < hosts->count; i++)
-        {
-            free(hosts->hosts[i].linkedDevices);
-        }
-        free(hosts->hosts);
-    }
+    zarenaFree(hosts->arena); // The hosts, linked devices and links all come from the arena.
+    hosts->arena = NULL;
+    hosts->hosts = NULL;
+    hosts->count = 0;
 }
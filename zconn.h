@@ -32,33 +32,186 @@
  * */
 
 #include "zdata.h"
+#include "ip.h"
 
 /**
- * Sets the API end point to be used by all future API calls.
+ * Client context for one Zabbix server.
+ * Every API call is made through a context, which holds the end point, the authorisation, the connection and the
+ * settings below. Contexts share nothing, so several sessions (to the same or different servers) can run in parallel
+ * threads, one context per thread.
+ * */
+struct zconnCtx;
+
+/**
+ * Creates a client context with the default settings. No connection is made until zconnInit or the first API call.
+ * @return              new context, to be freed with zconnFree. NULL if out of memory.
+ * */
+struct zconnCtx *zconnNew();
+
+/**
+ * Frees a client context, closing its connection first if still open.
+ * @param [in] ctx      context created by zconnNew. May be NULL.
+ * */
+void zconnFree(struct zconnCtx *ctx);
+
+/**
+ * Sets the API end point to be used by all future API calls made through the context.
+ * @param [in] ctx      client context.
  * @param [in] ep       end point name. e.g. "http://localhost/api_jsonrpc.php" which is also the default value
+ * @return              0 if fails (the end point is longer than 255 characters and is not set), 1 if success
+ * */
+int setEndpoint(struct zconnCtx *ctx, char *ep);
+
+/**
+ * Sets the API token used to authorise calls in place of a user login.
+ * The token is sent as a bearer (Authorization) header with every call, so no user.login is made and no password is sent.
+ * @param [in] ctx      client context.
+ * @param [in] token    API token created in Zabbix. Empty to log in with a user and password (the default).
  * */
-void setEndpoint(char *ep);
+void setToken(struct zconnCtx *ctx, char *token);
+
+/**
+ * Sets the file used to cache sessions between runs.
+ * zconnAuth reuses the session cached for the user and end point, checking it with a single user.checkAuthentication call,
+ * and only logs in when there is no cached session or it is no longer valid. New sessions are written back to the file.
+ * @param [in] ctx      client context.
+ * @param [in] fileName session cache file. Empty for no cache (the default).
+ * */
+void setSessionCache(struct zconnCtx *ctx, char *fileName);
+
+/**
+ * Sets the limits on the calls made to the end point, protecting the frontend.
+ * Calls are paced by a token bucket (allowing up to a second of calls at once) and capped in number in flight. Both
+ * limits are scaled down when the frontend answers 429 or 5xx or its latency rises, and back up while it is healthy.
+ * A 429 or 5xx also holds off every call (for the Retry-After time if given) and the call is retried up to 3 times.
+ * In debug mode the time each call waited for the limits is printed.
+ * @param [in] ctx          client context.
+ * @param [in] rate         calls per second. 0 (the default) for no limit.
+ * @param [in] maxInFlight  most calls in flight at the same time. 0 (the default) for no limit other than the paging.
+ * */
+void setRateLimit(struct zconnCtx *ctx, double rate, int maxInFlight);
+
+/**
+ * Sets the directory API responses are recorded to, or replayed from in place of calling the API.
+ * Each response is kept in its own file named by the method and a hash of the end point, methods and parameters of the
+ * request, so a replay needs the same end point and settings as the run that recorded it. Replaying needs no Zabbix
+ * server or network, so fetching, parsing and publishing can be timed on their own.
+ * @param [in] ctx      client context.
+ * @param [in] dir      fixture directory. Must exist.
+ * @param [in] replay   1 to replay the responses in dir, 0 to record them to dir.
+ * */
+void setFixtures(struct zconnCtx *ctx, char *dir, int replay);
+
+/**
+ * Sets the paging used when getting hosts from the API.
+ * Large estates can be requested in pages of hosts, with several pages in flight at the same time, rather than one
+ * very large host.get. The merged result is the same as a single call, ordered by host ID.
+ * @param [in] ctx      client context.
+ * @param [in] size     number of hosts per page. 0 (the default) gets all hosts in a single call.
+ * @param [in] parallel number of pages requested at the same time. Default 4.
+ * */
+void setPaging(struct zconnCtx *ctx, int size, int parallel);
+
+/**
+ * Sets the IP ranges used to select hosts when getting hosts from the API.
+ * The host IDs with an interface in range are found with hostinterface.get and only those hosts are requested.
+ * Hosts without an IPv4 interface in range are left out, including hosts with no interfaces and DNS-only or IPv6-only hosts
+ * (see ipAddrInRanges).
+ * @param [in] ctx      client context.
+ * @param [in] ips      IP ranges. Must remain valid until the hosts have been requested. NULL for all hosts.
+ * */
+void setIpFilter(struct zconnCtx *ctx, struct ipRanges *ips);
+
+/**
+ * Sets whether only the items used by the mapper are requested from the API.
+ * When set (the default) the hosts are requested without items and the LLDP, chassis and system description items are
+ * requested with a separate item.get filtered by item key, so items the mapper does not use never leave the server.
+ * @param [in] ctx      client context.
+ * @param [in] narrow   1 to request only the mapper items, 0 to request every item of every host.
+ * */
+void setNarrowItems(struct zconnCtx *ctx, int narrow);
+
+/**
+ * Sets the number of threads that parse host pages while the remaining pages are downloaded.
+ * When set, hosts are requested in pages (of the -pagesize, or 250 hosts if no page size is set) and each page is
+ * handed to a pool of parser threads as soon as it arrives, so parsing overlaps the download rather than following it.
+ * @param [in] ctx      client context.
+ * @param [in] threads  number of parser threads. 0 (the default) parses the hosts once they have all been downloaded.
+ * */
+void setPipeline(struct zconnCtx *ctx, int threads);
+
+/**
+ * Sets the number of threads that parse the hosts once they have all been downloaded (or read from the cache file).
+ * Each thread takes blocks of hosts in turn. Not used for pages being parsed by the pipeline, which are already in parallel.
+ * @param [in] ctx      client context.
+ * @param [in] threads  number of parser threads. 0 (the default) for one per core.
+ * */
+void setParseThreads(struct zconnCtx *ctx, int threads);
+
+/**
+ * Sets whether hosts from the API are refreshed incrementally.
+ * When set and the cache file holds a previous snapshot, only the hosts and items added since the snapshot, and the items
+ * whose last value differs from the snapshot (by lastclock), are requested in full. Removed hosts and items are dropped.
+ * Host names and interfaces are refreshed every time, but an item renamed without a new value keeps its old name.
+ * Without a snapshot every host is requested as normal.
+ * @param [in] ctx      client context.
+ * @param [in] incr     1 to refresh the snapshot in the cache file, 0 (the default) to get every host each time.
+ * */
+void setIncremental(struct zconnCtx *ctx, int incr);
+
+/**
+ * Opens the connection used by all future API calls made through the context.
+ * The connection is a keep-alive connection to the end point along with a DNS and TLS session cache so that
+ * each API call does not need to open a new connection. Called automatically by the first API call if not called beforehand.
+ * @param [in] ctx      client context.
+ * @return              0 if fails, 1 if success
+ * */
+int zconnInit(struct zconnCtx *ctx);
+
+/**
+ * Closes the connection opened by zconnInit. The context can still be used and will connect again on the next API call.
+ * In debug mode the call timings and the time saved by reusing the connection are printed.
+ * @param [in] ctx      client context.
+ * */
+void zconnCleanup(struct zconnCtx *ctx);
 
 /**
  * Authenticates a user against given credentials.
+ * Not needed, and no call is made, when an API token is set. A valid session from the session cache is reused.
+ * @param[in]   ctx     client context.
  * @param[in]   user    The user name.
  * @param[in]   pw      The password in clear text.
  * @return              0 if fails, 1 if success
  * */
-int zconnAuth(char *user ,char *pw);
-struct zMapCol zconnGetMaps();
+int zconnAuth(struct zconnCtx *ctx, char *user ,char *pw);
+struct zMapCol zconnGetMaps(struct zconnCtx *ctx);
 
 /**
  * Deletes a map according to its name.
  * fails silently if the name is not found.
+ * @param [in]  ctx     client context.
  * @param [in]  name    name of the map
  * */
-void zconnDeleteMapByName(char *name);
+void zconnDeleteMapByName(struct zconnCtx *ctx, char *name);
 struct host zconnNewHost();
 void freeHostCol(struct hostCol *hosts);
-struct hostCol zconnGetHostsFromFile(char *fileName);
-struct hostCol zconnGetHostsFromAPI(char *cacheFile);
-int createMap(struct hostLink *hl, char *name, double w, double h, int linkLabels);
+struct hostCol zconnGetHostsFromFile(char *fileName, int threads);
+struct hostCol zconnGetHostsFromAPI(struct zconnCtx *ctx, char *cacheFile);
+int createMap(struct zconnCtx *ctx, struct hostLink *hl, char *name, double w, double h, int linkLabels);
+
+/**
+ * Update a map in Zabbix from the supplied host link data, creating it if there is no map of that name.
+ * The map is found with a map.get filtered by name and sent back with a single map.update, so the map keeps its ID.
+ * Hosts already on the map keep their map element, matched by host ID (or by label for pseudo hosts and hubs).
+ * @param [in] ctx      client context.
+ * @param [in] hl       Host Link data that defines the map
+ * @param [in] name     name of the map
+ * @param [in] w        width of the map
+ * @param [in] h        height of the map
+ * @param [in] linkLabels   if 1 then links will contain labels
+ * @return              SysID - ID of the map that is updated or created. 0 if fails.
+ * */
+int updateMap(struct zconnCtx *ctx, struct hostLink *hl, char *name, double w, double h, int linkLabels);
 
 #endif
 
@@ -30,9 +30,9 @@
  * \file zdata.h
  * */
 
-#ifndef HOST_INTERFACE_MAX
-#define HOST_INTERFACE_MAX 10
-#endif
+#include "zstr.h"
+#include "zarena.h"
+#include "ip.h"
 
 /**
  * Enumerator for the types of device chassis identifiers. 
@@ -86,25 +86,25 @@ struct zMapCol
 struct linkedDevice
 {
     int msap;                            /**< Device Media Service Access Point for the local connection of the remote port. */
-    char locPortName[256];               /**< name of the local port that reported this linked device. */
-    char remChassisId[256];              /**< Chassis ID for the remotely connection device */
+    zstr locPortName;                    /**< name of the local port that reported this linked device. */
+    zstr remChassisId;                   /**< Chassis ID for the remotely connection device */
     enum chassisIdType remChassisIdType; /**< The type of data held in remChassisId */
-    char remHostName[256];               /**< name of the remote host */
-    char remHostDesc[256];               /**< Description of the remote host */
-    char remPortId[256];                 /**< Address or identifier of the port on the remote connected Host that is connected to our local interface.*/
+    zstr remHostName;                    /**< name of the remote host */
+    zstr remHostDesc;                    /**< Description of the remote host */
+    zstr remPortId;                      /**< Address or identifier of the port on the remote connected Host that is connected to our local interface.*/
     enum portIdType remPortIdType;       /**< The type of data help in remPortID */
-    char remPortDesc[256];               /**< Description of the remote port. Useful for labels and diagnostics */
+    zstr remPortDesc;                    /**< Description of the remote port. Useful for labels and diagnostics */
 };
 
 struct host
 {
-    char name[129];
+    zstr name;
     int id;                                  /**< Id of this data item (can exist only in this connector if creating a new host to be copied to Zabbix) */
     int zabbixId;                            /**< Id of the device in Zabbix (host Id). A host created in this C code but not existing in Zabbix (E.g. Pseudo Host) would have an ID but no Zabbix ID. */
-    char sysDesc[256];                      /**<System Description. Not needed by Zabbix Mapper core functionality, but the bitmap renderer (where used) can use this field to select better icons if provided.*/
-    char interfaces[HOST_INTERFACE_MAX][17]; /**< Array of IP addresses for the host */
+    zstr sysDesc;                            /**<System Description. Not needed by Zabbix Mapper core functionality, but the bitmap renderer (where used) can use this field to select better icons if provided.*/
+    struct ipAddr *interfaces;               /**< IP addresses of the host's interfaces, parsed when the host is read. */
     int interfaceCount;
-    char chassisId[256];                /**< Chassis ID for the device. E.g. MAC address for the switch or computer */
+    zstr chassisId;                     /**< Chassis ID for the device. E.g. MAC address for the switch or computer */
     enum chassisIdType chassisIdType;   /**< What type of chassis ID is known for this host (see chassisId) */
     struct linkedDevice *linkedDevices; /**< remote devices found typically via LLDP. */
     int devicesCount;
@@ -121,6 +121,7 @@ struct hostCol
 {
     int count;
     struct host *hosts;
+    struct zarena *arena; /**< Owns the hosts, their linked devices and the links found between them. NULL if nothing allocated. */
 };
 
 /**
@@ -130,8 +131,8 @@ struct hostCol
 struct linkElement
 {
     int hostId;          /**< host ID. NOT the zabbixId, which could be separate. */
-    char chassisId[256]; /**< reference to the chassis of the host. */
-    char portRef[256];   /**< reference to the port on the host. */
+    zstr chassisId;      /**< reference to the chassis of the host. */
+    zstr portRef;        /**< reference to the port on the host. */
 };
 
 /**
@@ -0,0 +1,306 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+#include "zitem.h"
+#include <string.h>
+#include <pthread.h>
+
+#define ITEM_STATE_MAX 160 // States in the automaton. Enough for every character of the key words plus the root.
+#define ITEM_WORD_MSAP 0   // Index of "[MSAP" in itemWords
+#define ITEM_WORD_PORT 1   // Index of "[Port - " in itemWords
+#define ITEM_WORD_REMOTE 2 // Index of the first key word of a linked device field
+#define ITEM_WORD_LOCAL 9  // Index of the first key word of a host field
+#define ITEM_WORD_COUNT 12
+
+/**
+ * Key words searched for in item names, with the field each one gives.
+ * Within the remote and local groups the key words are in order of precedence, the most specific first.
+ * */
+static const struct
+{
+    const char *word;
+    enum itemField field;
+} itemWords[ITEM_WORD_COUNT] = {
+    {"[MSAP", itemField_None},
+    {"[Port - ", itemField_None},
+    {"Chassis Info Type", itemField_RemChassisIdType},
+    {"Chassis Info", itemField_RemChassisId},
+    {"Host Desc", itemField_RemHostDesc},
+    {"Host", itemField_RemHostName},
+    {"Interface Info Type", itemField_RemPortIdType},
+    {"Interface Info", itemField_RemPortId},
+    {"Interface Desc", itemField_RemPortDesc},
+    {"Chassis Id Type", itemField_ChassisIdType},
+    {"Chassis Id", itemField_ChassisId},
+    {"System description", itemField_SysDesc}};
+
+static unsigned char itemNext[ITEM_STATE_MAX][256]; // Next state for each state and character. State 0 is the root.
+static unsigned short itemOut[ITEM_STATE_MAX];      // Key words (bit per index in itemWords) that end at each state.
+static pthread_once_t itemOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Build the Aho-Corasick automaton for the key words.
+ * The key words are put in a trie, then the failure links are found breadth first and folded into the transitions, so the
+ * scan follows exactly one transition per character.
+ * */
+static void buildItemAutomaton()
+{
+    int fail[ITEM_STATE_MAX];
+    int queue[ITEM_STATE_MAX];
+    int head = 0, tail = 0;
+    int states = 1;
+    int i, c, s, t;
+    const char *p;
+
+    // Trie of the key words. 0 marks a missing transition while building, as nothing leads back to the root.
+    for (i = 0; i < ITEM_WORD_COUNT; i++)
+    {
+        s = 0;
+        for (p = itemWords[i].word; *p != '\0'; p++)
+        {
+            c = (unsigned char)*p;
+            if (itemNext[s][c] == 0)
+                itemNext[s][c] = states++;
+            s = itemNext[s][c];
+        }
+        itemOut[s] |= 1 << i;
+    }
+
+    // Failure links. Missing transitions take the transition of the failure state, which is already complete as it is shallower.
+    for (c = 0; c < 256; c++)
+    {
+        if ((t = itemNext[0][c]) != 0)
+        {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail)
+    {
+        s = queue[head++];
+        itemOut[s] |= itemOut[fail[s]]; // Key words ending at a suffix of this state also end here.
+        for (c = 0; c < 256; c++)
+        {
+            if ((t = itemNext[s][c]) != 0)
+            {
+                fail[t] = itemNext[fail[s]][c];
+                queue[tail++] = t;
+            }
+            else
+                itemNext[s][c] = itemNext[fail[s]][c];
+        }
+    }
+}
+
+void classifyItemName(const char *name, struct itemClass *ic)
+{
+    const char *p;
+    const char *msapAt = NULL, *msapEnd = NULL; // "[MSAP" and the first "]" after it
+    const char *portAt = NULL, *portEnd = NULL; // "[Port - " and the first "]" after it
+    unsigned int found = 0;                     // key words found, bit per index in itemWords
+    int s = 0;
+    int i;
+
+    pthread_once(&itemOnce, buildItemAutomaton);
+
+    ic->msap = 0;
+    ic->port = NULL;
+    ic->portLen = 0;
+    ic->field = itemField_None;
+
+    for (p = name; *p != '\0'; p++)
+    {
+        if (*p == ']')
+        {
+            if (msapAt && !msapEnd)
+                msapEnd = p;
+            if (portAt && !portEnd)
+                portEnd = p;
+        }
+        s = itemNext[s][(unsigned char)*p];
+        if (itemOut[s])
+        {
+            if ((itemOut[s] & (1 << ITEM_WORD_MSAP)) && !msapAt)
+                msapAt = p - 4; // strlen("[MSAP") - 1
+            if ((itemOut[s] & (1 << ITEM_WORD_PORT)) && !portAt)
+                portAt = p - 7; // strlen("[Port - ") - 1
+            found |= itemOut[s];
+        }
+    }
+
+    // MSAP number will be inside the string in format "[MSAP 201]" so we want the 201 from it.
+    if (msapAt && msapEnd && msapEnd >= msapAt + 6)
+    {
+        int sign = 1;
+        for (p = msapAt + 6; p < msapEnd && (*p == ' ' || *p == '\t'); p++)
+            ;
+        if (p < msapEnd && (*p == '-' || *p == '+'))
+            sign = (*p++ == '-') ? -1 : 1;
+        for (; p < msapEnd && *p >= '0' && *p <= '9'; p++)
+            ic->msap = ic->msap * 10 + (*p - '0');
+        ic->msap *= sign;
+    }
+
+    if (portAt && portEnd)
+    {
+        ic->port = portAt + 8;
+        ic->portLen = (int)(portEnd - ic->port);
+    }
+
+    // Items with an MSAP number are for a linked device, the others for the host itself.
+    int first = (ic->msap > 0) ? ITEM_WORD_REMOTE : ITEM_WORD_LOCAL;
+    int last = (ic->msap > 0) ? ITEM_WORD_LOCAL : ITEM_WORD_COUNT;
+    for (i = first; i < last; i++)
+    {
+        if (found & (1u << i))
+        {
+            ic->field = itemWords[i].field;
+            break;
+        }
+    }
+}
+
+#define ITEM_KEY_PARAM_MAX 4 // Key parameters looked at. The LLDP remote keys have the port number and MSAP index as the 3rd and 4th.
+#define ITEM_KEY_PORT 2      // Index of the port number parameter of an LLDP remote key
+#define ITEM_KEY_MSAP 3      // Index of the MSAP index parameter of an LLDP remote key
+#define ITEM_KEY_COUNT 11
+
+/**
+ * Item keys (without their parameters) and the field each one gives.
+ * */
+static const struct
+{
+    const char *key;
+    int len;
+    int remote; /**< 1 for LLDP remote keys, which must have an MSAP index */
+    enum itemField field;
+} itemKeyFields[ITEM_KEY_COUNT] = {
+    {"lldp.rem.chassis.id", 19, 1, itemField_RemChassisId},
+    {"lldp.rem.chassis.type", 21, 1, itemField_RemChassisIdType},
+    {"lldp.rem.sysname", 16, 1, itemField_RemHostName},
+    {"lldp.rem.sys.desc", 17, 1, itemField_RemHostDesc},
+    {"lldp.rem.port.id", 16, 1, itemField_RemPortId},
+    {"lldp.rem.port.type", 18, 1, itemField_RemPortIdType},
+    {"lldp.rem.port.desc", 18, 1, itemField_RemPortDesc},
+    {"SNMP-Chassis-Id", 15, 0, itemField_ChassisId},
+    {"SNMP-Chassis-Id-Type", 20, 0, itemField_ChassisIdType},
+    {"system.descr", 12, 0, itemField_SysDesc},
+    {"sysDescr", 8, 0, itemField_SysDesc}};
+
+/**
+ * Split the parameters of an item key, following the Zabbix key syntax: parameters are separated by commas, may be
+ * quoted (with \" inside quotes) and may be arrays in square brackets.
+ * @param [in] p        first character after the opening '['.
+ * @param [out] params  start of each of the first ITEM_KEY_PARAM_MAX parameters, without any quotes.
+ * @param [out] lens    length of each of those parameters.
+ * @return              number of those parameters found.
+ * */
+static int splitItemKeyParams(const char *p, const char **params, int *lens)
+{
+    int n = 0;
+    int depth = 0; // depth of array parameters
+
+    while (*p != '\0' && n < ITEM_KEY_PARAM_MAX)
+    {
+        while (*p == ' ')
+            p++;
+        if (*p == '"')
+        {
+            // Quoted parameter. Ends at the next unescaped quote.
+            params[n] = ++p;
+            while (*p != '\0' && *p != '"')
+                p += (*p == '\\' && p[1] == '"') ? 2 : 1;
+            lens[n] = (int)(p - params[n]);
+            n++;
+            if (*p == '"')
+                p++;
+            while (*p == ' ')
+                p++;
+        }
+        else
+        {
+            params[n] = p;
+            while (*p != '\0' && (depth > 0 || (*p != ',' && *p != ']')))
+            {
+                if (*p == '[')
+                    depth++;
+                else if (*p == ']')
+                    depth--;
+                p++;
+            }
+            lens[n] = (int)(p - params[n]);
+            n++;
+        }
+        if (*p != ',')
+            break; // ']' or the end of the key
+        p++;
+    }
+    return n;
+}
+
+int classifyItemKey(const char *key, struct itemClass *ic)
+{
+    const char *params[ITEM_KEY_PARAM_MAX];
+    int lens[ITEM_KEY_PARAM_MAX];
+    const char *p;
+    int len;
+    int i;
+
+    for (p = key; *p != '\0' && *p != '['; p++)
+        ;
+    len = (int)(p - key);
+
+    for (i = 0; i < ITEM_KEY_COUNT; i++)
+        if (itemKeyFields[i].len == len && memcmp(itemKeyFields[i].key, key, len) == 0)
+            break;
+    if (i == ITEM_KEY_COUNT)
+        return 0;
+
+    ic->msap = 0;
+    ic->port = NULL;
+    ic->portLen = 0;
+    ic->field = itemKeyFields[i].field;
+    if (!itemKeyFields[i].remote)
+        return 1;
+
+    // LLDP remote item. The MSAP index tells the linked devices apart so is required.
+    if (*p != '[' || splitItemKeyParams(p + 1, params, lens) <= ITEM_KEY_MSAP)
+        return 0;
+    for (p = params[ITEM_KEY_MSAP], len = 0; len < lens[ITEM_KEY_MSAP] && *p >= '0' && *p <= '9'; p++, len++)
+        ic->msap = ic->msap * 10 + (*p - '0');
+    if (len == 0 || len != lens[ITEM_KEY_MSAP] || ic->msap <= 0)
+        return 0; // Not a number, e.g. an unexpanded {#REM_IDX}.
+
+    ic->port = params[ITEM_KEY_PORT];
+    ic->portLen = lens[ITEM_KEY_PORT];
+    return 1;
+}
+
+int findItemPort(const char *name, struct itemClass *ic)
+{
+    const char *start = strstr(name, "[Port - ");
+    const char *end;
+
+    if (!start || !(end = strchr(start + 8, ']')))
+        return 0;
+    ic->port = start + 8;
+    ic->portLen = (int)(end - ic->port);
+    return 1;
+}
@@ -0,0 +1,93 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+#ifndef ZITEM_HEADER
+#define ZITEM_HEADER
+/**
+ * Zabbix Items.
+ *
+ * Classifies Zabbix item names, telling the connector which host or linked device field an item holds.
+ * */
+
+/**
+ * \file zitem.h
+ * */
+
+/**
+ * The host or linked device field an item holds.
+ * The remote fields are only given for items of a linked device (an item with an MSAP number), the local fields for the others.
+ * */
+enum itemField
+{
+    itemField_None = 0,
+    itemField_RemChassisIdType = 1, /**< "Chassis Info Type" */
+    itemField_RemChassisId = 2,     /**< "Chassis Info" */
+    itemField_RemHostDesc = 3,      /**< "Host Desc" */
+    itemField_RemHostName = 4,      /**< "Host" */
+    itemField_RemPortIdType = 5,    /**< "Interface Info Type" */
+    itemField_RemPortId = 6,        /**< "Interface Info" */
+    itemField_RemPortDesc = 7,      /**< "Interface Desc" */
+    itemField_ChassisIdType = 8,    /**< "Chassis Id Type" */
+    itemField_ChassisId = 9,        /**< "Chassis Id" */
+    itemField_SysDesc = 10          /**< "System description" */
+};
+
+/**
+ * What an item name says about the item. The port name points into the item name rather than being copied.
+ * */
+struct itemClass
+{
+    int msap;              /**< MSAP number from "[MSAP 201]". 0 if there is none, in which case the item is for the host itself. */
+    const char *port;      /**< local port name from "[Port - Gi0/1]", not terminated. NULL if there is none. */
+    int portLen;           /**< length of the local port name */
+    enum itemField field;  /**< field the item holds */
+};
+
+/**
+ * Classify an item name in a single pass over it.
+ * Every key word is searched for at once by an Aho-Corasick automaton, so the name is read once however many key words
+ * there are. Where several key words are found the most specific wins (e.g. "Chassis Info Type" over "Chassis Info").
+ * Thread safe.
+ * @param [in] name     item name. e.g. "[Port - Gi0/1] - [MSAP 1] - [ Connect to ] Chassis Info"
+ * @param [out] ic      classification of the item.
+ * */
+void classifyItemName(const char *name, struct itemClass *ic);
+
+/**
+ * Classify an item by its key. Keys have a fixed format, unlike names which can be changed in the template, so are tried first.
+ * LLDP remote keys carry the port number and MSAP index as parameters:
+ * lldp.rem.chassis.id[{HOST.CONN},{$SNMP_COMMUNITY},{#PORT_NUM},{#REM_IDX},...]
+ * The port is given as the port number. Use findItemPort for the port name, which is only in the item name.
+ * Thread safe.
+ * @param [in] key      item key. e.g. "lldp.rem.sysname[10.0.0.1,public,1,1,]"
+ * @param [out] ic      classification of the item. Only valid if the key was recognised.
+ * @return              1 if the key was recognised, 0 if not (an unknown key or an LLDP remote key without an MSAP index),
+ *                      in which case the item should be classified by its name.
+ * */
+int classifyItemKey(const char *key, struct itemClass *ic);
+
+/**
+ * Find the local port name in an item name, of the form "[Port - Gi0/1]".
+ * @param [in] name     item name.
+ * @param [out] ic      port and portLen are set if the name has a port. Nothing else is changed.
+ * @return              1 if the name has a port, 0 if not.
+ * */
+int findItemPort(const char *name, struct itemClass *ic);
+#endif
@@ -23,63 +23,132 @@
 #include <stdio.h>
 #include "zmap.h"
 extern int g_zDebugMode;
-char *stripSeparators(char *input)
+
+/**
+ * Index of hosts by chassis ID, in the form used to match them (see chassisKey). Open addressing with linear probing.
+ * */
+struct chassisIndex
+{
+    zstr *keys; /**< chassis ID key of each slot. 0 marks a free slot, as hosts without a chassis ID are not indexed. */
+    int *hosts; /**< position of the host with the key */
+    int size;   /**< number of slots. A power of 2, at least twice the number of hosts. */
+};
+
+/**
+ * Chassis ID of a host or linked device in the form hosts are matched on: without separators and ignoring case, so that
+ * "00:1A-2b" and "001a2b" are the same device. The same form is used when linking hosts and when merging the hosts of
+ * several servers.
+ * */
+static zstr chassisKey(zstr chassisId)
+{
+    return zstrStripLower(chassisId);
+}
+
+/**
+ * Allocate an empty index for a number of hosts.
+ * @return      1 if success, 0 if out of memory.
+ * */
+static int chassisIndexInit(struct chassisIndex *ix, int count)
+{
+    ix->size = 16;
+    while (ix->size < count * 2)
+        ix->size *= 2;
+    ix->keys = calloc(ix->size, sizeof *ix->keys);
+    ix->hosts = malloc(ix->size * sizeof *ix->hosts);
+    return ix->keys && ix->hosts;
+}
+
+static void chassisIndexFree(struct chassisIndex *ix)
 {
-    // Remove seperators from a string.
-    // used for comparing strings.
-    int n = strlen(input);
-    char *ret = calloc(n + 2, 1);
-    char check;
-    int i = 0; // loop itterator.
-    int o = 0; // forward looking offset;
-    while (i + o < n)
+    free(ix->keys);
+    free(ix->hosts);
+}
+
+/**
+ * Slot of a key in the index: the slot holding it, or the free slot it would go in.
+ * */
+static int chassisIndexSlot(struct chassisIndex *ix, zstr key)
+{
+    int i = (int)((key * 2654435761u) & (unsigned int)(ix->size - 1)); // Knuth's multiplicative hash
+    while (ix->keys[i] != 0 && ix->keys[i] != key)
+        i = (i + 1) & (ix->size - 1);
+    return i;
+}
+
+/**
+ * Find the host with a chassis ID key.
+ * @return      position of the host, or -1 if there is none.
+ * */
+static int chassisIndexFind(struct chassisIndex *ix, zstr key)
+{
+    int i;
+    if (key == 0)
+        return -1;
+    i = chassisIndexSlot(ix, key);
+    return (ix->keys[i] == key) ? ix->hosts[i] : -1;
+}
+
+/**
+ * Add a host to the index. A host already holding the key is kept, so the first host with a chassis ID is the one found.
+ * */
+static void chassisIndexAdd(struct chassisIndex *ix, zstr key, int host)
+{
+    int i;
+    if (key == 0)
+        return;
+    i = chassisIndexSlot(ix, key);
+    if (ix->keys[i] == 0)
     {
-        check = input[i + o];
-        if (check == ' ' || check == ':' || check == '-')
-        {
-            o++;
-            continue;
-        }
-        ret[i] = input[i + o];
-        i++;
+        ix->keys[i] = key;
+        ix->hosts[i] = host;
     }
-    ret[i + 1] = '\0'; // ensure terminator.
-    return ret;
 }
 
 struct linkCol findAllLinks(struct hostCol *hosts)
 {
     // Find all links between hosts.
     // this is actually clearer than creating object links due to removing the need to relink objects as the connections are discovered.
+    // The links are taken from the arena of the hosts, so are freed with them.
     int i, j, k;
     int size = 10;
     struct linkCol ret;
     ret.count = 0;
-    ret.links = malloc(size * sizeof(struct link));
+    ret.links = zarenaAlloc(hosts->arena, size * sizeof(struct link));
     struct link *linkColTmp;
     struct linkElement *a;
     struct linkElement *b;
     struct linkedDevice *ld;
+    struct chassisIndex ix; // hosts by chassis ID
+    if (!chassisIndexInit(&ix, hosts->count) || !ret.links)
+    {
+        fprintf(stderr, "Out of memory attempting to find host links");
+        chassisIndexFree(&ix);
+        return ret;
+    }
+    for (k = 0; k < hosts->count; k++)
+        chassisIndexAdd(&ix, chassisKey(hosts->hosts[k].chassisId), k);
 
     for (i = 0; i < hosts->count; i++)
     {
-        if (strlen(hosts->hosts[i].chassisId) > 0)
+        if (hosts->hosts[i].chassisId != 0)
             for (j = 0; j < hosts->hosts[i].devicesCount; j++)
             {
-                if (strlen(hosts->hosts[i].linkedDevices[j].remChassisId) > 0)
+                if (hosts->hosts[i].linkedDevices[j].remChassisId != 0)
                 {
 
                     // Check for space
                     if (size == ret.count)
                     {
-                        // Increase size of return variable
-                        size += 10;
-                        linkColTmp = realloc(ret.links, size * sizeof(struct link));
+                        // Increase size of return variable. Nothing else is taken from the arena meanwhile, so it grows in place
+                        // until the chunk is full. Doubling keeps the copies down when it is not.
+                        linkColTmp = zarenaRealloc(hosts->arena, ret.links, size * sizeof(struct link), 2 * size * sizeof(struct link));
+                        size *= 2;
                         if (linkColTmp)
                             ret.links = linkColTmp;
                         else
                         {
                             fprintf(stderr, "Out of memory attempting to create space for host link");
+                            chassisIndexFree(&ix);
                             return ret;
                         }
                     }
@@ -89,35 +158,21 @@ struct linkCol findAllLinks(struct hostCol *hosts)
                     ld = &(hosts->hosts[i].linkedDevices[j]);
                     a->hostId = hosts->hosts[i].id;
                     b->hostId = 0;
-                    strcpy(a->chassisId, hosts->hosts[i].chassisId);
-                    strcpy(a->portRef, ld->locPortName);
-
-                    strcpy(b->chassisId, ld->remChassisId);
-                    strcpy(b->portRef, ld->remPortId);
+                    a->chassisId = hosts->hosts[i].chassisId;
+                    a->portRef = ld->locPortName;
 
-                    char *leftStrTmp = {0};
-                    char *rightStrTmp = stripSeparators(b->chassisId);
+                    b->chassisId = ld->remChassisId;
+                    b->portRef = ld->remPortId;
 
                     // Try to find a host that matches the other side of the equation.
-                    for (k = 0; k < hosts->count; k++)
-                    {
-                        leftStrTmp = stripSeparators(hosts->hosts[k].chassisId);
-
-                        if (strcmp(leftStrTmp, rightStrTmp) == 0)
-                        {
-                            // match found
-                            b->hostId = hosts->hosts[k].id;
-                            free(leftStrTmp);
-                            break;
-                        }
-
-                        free(leftStrTmp);
-                    }
-                    free(rightStrTmp);
+                    k = chassisIndexFind(&ix, chassisKey(b->chassisId));
+                    if (k >= 0)
+                        b->hostId = hosts->hosts[k].id; // match found
                     ret.count++;
                 }
             }
     }
+    chassisIndexFree(&ix);
 
     /* Remove connections in two directions (where a==>b and b==>a).
     For example, if host 123 is connected to host 456, we will have two entries in the table as so:
@@ -174,6 +229,121 @@ int zconnFreeId(struct hostCol *hosts)
     return j;
 }
 
+/**
+ * Fold a duplicate of a host (the same device seen by another Zabbix server) into the host.
+ * Interfaces and linked devices not already known for the host are added. The duplicate keeps ownership of its own memory.
+ * @param [in] h        host to merge into
+ * @param [in] dup      duplicate of the host
+ * @param [in] arena    arena of the merged hosts, for the extra linked devices
+ * */
+static void mergeHost(struct host *h, struct host *dup, struct zarena *arena)
+{
+    int i, j;
+    if (dup->interfaceCount > 0)
+    {
+        struct ipAddr *ifTmp = zarenaRealloc(arena, h->interfaces, h->interfaceCount * sizeof(struct ipAddr),
+                                             (h->interfaceCount + dup->interfaceCount) * sizeof(struct ipAddr));
+        if (!ifTmp)
+        {
+            fprintf(stderr, "Out of memory attempting to merge the interfaces of host %s", zstrGet(h->name));
+            return;
+        }
+        h->interfaces = ifTmp;
+    }
+    for (i = 0; i < dup->interfaceCount; i++)
+    {
+        for (j = 0; j < h->interfaceCount; j++)
+            if (memcmp(&h->interfaces[j], &dup->interfaces[i], sizeof(struct ipAddr)) == 0)
+                break;
+        if (j == h->interfaceCount)
+            h->interfaces[h->interfaceCount++] = dup->interfaces[i];
+    }
+
+    if (h->sysDesc == 0)
+        h->sysDesc = dup->sysDesc;
+
+    if (dup->devicesCount == 0)
+        return;
+    struct linkedDevice *ldTmp = zarenaRealloc(arena, h->linkedDevices, h->devicesCount * sizeof(struct linkedDevice),
+                                               (h->devicesCount + dup->devicesCount) * sizeof(struct linkedDevice));
+    if (!ldTmp)
+    {
+        fprintf(stderr, "Out of memory attempting to merge the linked devices of host %s", zstrGet(h->name));
+        return;
+    }
+    h->linkedDevices = ldTmp;
+    int known = h->devicesCount; // only the devices already on the host need checking
+    for (i = 0; i < dup->devicesCount; i++)
+    {
+        for (j = 0; j < known; j++)
+            if (h->linkedDevices[j].locPortName == dup->linkedDevices[i].locPortName &&
+                h->linkedDevices[j].remChassisId == dup->linkedDevices[i].remChassisId)
+                break;
+        if (j == known)
+            h->linkedDevices[h->devicesCount++] = dup->linkedDevices[i];
+    }
+}
+
+struct hostCol mergeHostCols(struct hostCol *cols, int n, int target)
+{
+    // Merge the hosts from several Zabbix servers into one collection.
+    // The target server goes first so that a device seen by several servers keeps the host (and Zabbix ID) of the target.
+    struct hostCol ret;
+    ret.count = 0;
+    int i, j, k, c, total = 0, dups = 0;
+    for (i = 0; i < n; i++)
+        total += cols[i].count;
+    ret.arena = zarenaNew(); // takes over the arenas of the collections, so everything is freed together
+    ret.hosts = (ret.arena) ? zarenaAlloc(ret.arena, total * sizeof(struct host)) : NULL;
+    struct chassisIndex ix; // merged hosts by chassis ID
+    if (!chassisIndexInit(&ix, total) || !ret.hosts)
+    {
+        fprintf(stderr, "Out of memory attempting to merge hosts");
+        zarenaFree(ret.arena);
+        chassisIndexFree(&ix);
+        ret.arena = NULL;
+        ret.hosts = NULL;
+        return ret;
+    }
+
+    for (k = 0; k < n; k++)
+    {
+        c = (k == 0) ? target : ((k <= target) ? k - 1 : k);
+        for (i = 0; i < cols[c].count; i++)
+        {
+            struct host *h = &cols[c].hosts[i];
+            zstr key = chassisKey(h->chassisId);
+            j = chassisIndexFind(&ix, key);
+            if (j >= 0)
+            {
+                // Already seen on another server.
+                mergeHost(&ret.hosts[j], h, ret.arena);
+                dups++;
+                continue;
+            }
+
+            // Hosts are renumbered so that the IDs from different servers cannot collide.
+            // Only hosts from the target server exist there, so the others have no Zabbix ID on the map.
+            ret.hosts[ret.count] = *h;
+            ret.hosts[ret.count].id = ret.count + 1;
+            if (c != target)
+                ret.hosts[ret.count].zabbixId = 0;
+            chassisIndexAdd(&ix, key, ret.count);
+            ret.count++;
+        }
+        zarenaAdopt(ret.arena, cols[c].arena);
+        cols[c].arena = NULL;
+        cols[c].hosts = NULL;
+        cols[c].count = 0;
+    }
+
+    chassisIndexFree(&ix);
+
+    if (g_zDebugMode)
+        printf("DEBUG: mergeHostCols %i hosts from %i servers, %i duplicates merged, %i hosts\n", total, n, dups, ret.count);
+    return ret;
+}
+
 struct hostCol *addPseudoHosts(struct hostCol *hosts, struct linkCol *links)
 {
     if (g_zDebugMode)
@@ -199,7 +369,7 @@ struct hostCol *addPseudoHosts(struct hostCol *hosts, struct linkCol *links)
                 // only hosts that are pseudo hosts will not have a zabbixID set
                 if (hosts->hosts[j].zabbixId == 0)
                 {
-                    if (strcmp(hosts->hosts[j].chassisId, (links->links[i].a.hostId == 0 ? links->links[i].a.chassisId : links->links[i].b.chassisId)) == 0)
+                    if (hosts->hosts[j].chassisId == (links->links[i].a.hostId == 0 ? links->links[i].a.chassisId : links->links[i].b.chassisId))
                     {
                         // We have found an existing match
                         if (links->links[i].a.hostId == 0)
@@ -224,16 +394,17 @@ struct hostCol *addPseudoHosts(struct hostCol *hosts, struct linkCol *links)
                 // check if there is sufficient size and resize if not.
                 if (size == hosts->count)
                 {
-                    size += 5; // prevent calling this too often.
-                    struct host *hostsTmp = realloc(hosts->hosts, size * sizeof *(hosts->hosts));
+                    // Doubled as it is copied whenever it cannot grow in place in the arena.
+                    struct host *hostsTmp = zarenaRealloc(hosts->arena, hosts->hosts, size * sizeof *(hosts->hosts), (size + 5) * 2 * sizeof *(hosts->hosts));
                     if (hostsTmp)
                         hosts->hosts = hostsTmp;
                     else
                         return hosts;
+                    size = (size + 5) * 2;
                 }
                 h = &(hosts->hosts[hosts->count]); // pointer to new host
                 *h = zconnNewHost();
-                strcpy(h->chassisId, (links->links[i].a.hostId == 0 ? links->links[i].a.chassisId : links->links[i].b.chassisId));
+                h->chassisId = (links->links[i].a.hostId == 0 ? links->links[i].a.chassisId : links->links[i].b.chassisId);
                 h->id = zconnFreeId(hosts);
 
                 // Link this host
@@ -243,7 +414,7 @@ struct hostCol *addPseudoHosts(struct hostCol *hosts, struct linkCol *links)
                     links->links[i].b.hostId = h->id;
 
                 // Name
-                strcpy(h->name, h->chassisId);
+                h->name = h->chassisId;
 
                 hosts->count++;
             }
@@ -252,15 +423,13 @@ struct hostCol *addPseudoHosts(struct hostCol *hosts, struct linkCol *links)
     return hosts;
 }
 
-void setPseudoPortString(char str[256], int portId)
+void setPseudoPortString(zstr *str, int portId)
 {
     // Generate string for a pseudo hub port.
     // pp = pseudo port.
     char strTmp[15];
-    memset(str, '\0', 256);
-    strcat(str, "pp");
-    sprintf(strTmp, "%i", portId);
-    strcat(str, strTmp);
+    sprintf(strTmp, "pp%i", portId);
+    *str = zstrIntern(strTmp);
 }
 
 void addPseudoHubs(struct hostLink *hostsLinks)
@@ -324,7 +493,7 @@ void addPseudoHubs(struct hostLink *hostsLinks)
                 // i is traversing the b side of the links
                 jLe = &(hostsLinks->links.links[j - hostsLinks->links.count].b);
             }
-            if (iLe->hostId == jLe->hostId && strcmp(iLe->portRef, jLe->portRef) == 0 && strcmp(iLe->portRef, "") != 0)
+            if (iLe->hostId == jLe->hostId && iLe->portRef == jLe->portRef && iLe->portRef != 0)
             {
                 // Two devices are connected to the same host on the same port. We need to insert a hub here.
                 if (pseudoHub == NULL)
@@ -332,9 +501,11 @@ void addPseudoHubs(struct hostLink *hostsLinks)
                     //we need to add a new pseudo hub
                     if (hostsLinks->hosts.count == hostsSize)
                     {
-                        // We need to resize the hosts collection to accept more host objects.
-                        hostsSize += 5;
-                        hostTmpPtr = realloc(hostsLinks->hosts.hosts, hostsSize * sizeof *(hostsLinks->hosts.hosts));
+                        // We need to resize the hosts collection to accept more host objects. Doubled as the hosts and links take
+                        // turns growing, so neither can grow in place in the arena.
+                        hostTmpPtr = zarenaRealloc(hostsLinks->hosts.arena, hostsLinks->hosts.hosts, hostsSize * sizeof *(hostsLinks->hosts.hosts),
+                                                   (hostsSize + 5) * 2 * sizeof *(hostsLinks->hosts.hosts));
+                        hostsSize = (hostsSize + 5) * 2;
                         if (!hostTmpPtr)
                         {
                             fprintf(stderr, "Out of memory trying to allocate space for more hosts");
@@ -346,7 +517,7 @@ void addPseudoHubs(struct hostLink *hostsLinks)
                     hostsLinks->hosts.count++;
                     *pseudoHub = zconnNewHost();
                     pseudoHub->id = zconnFreeId(&hostsLinks->hosts);
-                    strcpy(pseudoHub->name, "pseudo hub");
+                    pseudoHub->name = zstrIntern("pseudo hub");
                 }
 
                 // Now that we have a new pseudo hub (new host we will use as a hub). We now need to point all devices
@@ -356,11 +527,11 @@ void addPseudoHubs(struct hostLink *hostsLinks)
                 // From our example, iLe would be line 2 and jLe would be line 3. Sticking with the example, we are about to change
                 // SW4.P5 reference on the a side of line 3 to point to the pseudo hub
                 jLe->hostId = pseudoHub->id;
-                strcpy(jLe->chassisId, pseudoHub->name);
+                jLe->chassisId = pseudoHub->name;
 
                 // Ensure that all connections to the pseudo hub are to unique ports (prevents this hub being picked up as
                 // requiring a new pseudo hub in subsequent scans).
-                setPseudoPortString(jLe->portRef, pseudoPort);
+                setPseudoPortString(&jLe->portRef, pseudoPort);
 
                 pseudoPort++;
             }
@@ -371,26 +542,25 @@ void addPseudoHubs(struct hostLink *hostsLinks)
             // First remember the device that iLe is connected to.
             // From our example, iLe would be line 2 Sticking with the example, we are about to copy the a side
             // reference (SW4.P5) before we change it
-            strcpy(commonLink.chassisId, iLe->chassisId);
-            commonLink.hostId = iLe->hostId;
-            strcpy(commonLink.portRef, iLe->portRef);
+            commonLink = *iLe;
 
             // now point iLe to the pseudo host
             // From our example, iLe would be line 2 Sticking with the example, we are about to change
             // SW4.P5 reference on the a side of line 2 to point to the pseudo hub
             iLe->hostId = pseudoHub->id;
-            strcpy(iLe->chassisId, pseudoHub->name);
+            iLe->chassisId = pseudoHub->name;
             // Ensure that all connections to the pseudo hub are to unique ports (prevents this hub being picked up as
             // requiring a new pseudo hub in subsequent scans).
-            setPseudoPortString(iLe->portRef, pseudoPort);
+            setPseudoPortString(&iLe->portRef, pseudoPort);
             pseudoPort++;
 
             // Now create a new link which creates a connection between our new pseudo host and the common hosts that iLe and jLe were pointing to (common device would be SW4.P5 from our example).
             if (hostsLinks->links.count == linksSize)
             {
                 // We need to resize the links collection to accept more host objects.
-                linksSize += 5;
-                linkTmpPtr = realloc(hostsLinks->links.links, linksSize * sizeof *(hostsLinks->links.links));
+                linkTmpPtr = zarenaRealloc(hostsLinks->hosts.arena, hostsLinks->links.links, linksSize * sizeof *(hostsLinks->links.links),
+                                           (linksSize + 5) * 2 * sizeof *(hostsLinks->links.links));
+                linksSize = (linksSize + 5) * 2;
                 if (!linkTmpPtr)
                 {
                     fprintf(stderr, "Out of memory trying to allocate space for more links");
@@ -403,14 +573,12 @@ void addPseudoHubs(struct hostLink *hostsLinks)
 
             // first connect the new link to the pseudo hub
             newLink->a.hostId = pseudoHub->id;
-            strcpy(newLink->a.chassisId, pseudoHub->name);
+            newLink->a.chassisId = pseudoHub->name;
 
-            setPseudoPortString(newLink->a.portRef, pseudoPort);
+            setPseudoPortString(&newLink->a.portRef, pseudoPort);
 
             // Now connect the new other side of the link to the common device (SW4.P5 from our example)
-            newLink->b.hostId = commonLink.hostId;
-            strcpy(newLink->b.chassisId, commonLink.chassisId);
-            strcpy(newLink->b.portRef, commonLink.portRef);
+            newLink->b = commonLink;
 
             // If I was traversing the right hand side (b side) of the links when we added this new link in then
             // we need to adjust its current position as the addition of the new link will have invalidated the position.
@@ -425,19 +593,20 @@ void printHosts(struct hostCol *hosts)
 {
     // debug tool. print out the contents of hosts so that we can check for correct parsing.
     int i, j; // loop itterators.
+    char ipTmp[IP_ADDR_STRLEN];
     printf("***** Hosts *****\n");
     for (i = 0; i < hosts->count; i++)
     {
         // list Host data
-        printf("host %i [%i] with name '%s'\n", hosts->hosts[i].id, hosts->hosts[i].zabbixId, hosts->hosts[i].name);
-        printf("\tChassis ID: '%s' ", hosts->hosts[i].chassisId);
+        printf("host %i [%i] with name '%s'\n", hosts->hosts[i].id, hosts->hosts[i].zabbixId, zstrGet(hosts->hosts[i].name));
+        printf("\tChassis ID: '%s' ", zstrGet(hosts->hosts[i].chassisId));
         printf("ID Type: %i\n", hosts->hosts[i].chassisIdType);
         printf("x position: %.1f\ty position: %.1f\n", hosts->hosts[i].xPos, hosts->hosts[i].yPos);
         printf("\tHas %i interface%s:\n", hosts->hosts[i].interfaceCount, (hosts->hosts[i].interfaceCount == 1) ? "" : "s");
         for (j = 0; j < hosts->hosts[i].interfaceCount; j++)
         {
             // List interfaces
-            printf("\t\t%i: %s\n", j, hosts->hosts[i].interfaces[j]);
+            printf("\t\t%i: %s\n", j, ipFormat(&hosts->hosts[i].interfaces[j], ipTmp, sizeof ipTmp));
         }
         printf("\tHas %i linked device%s:\n", hosts->hosts[i].devicesCount, (hosts->hosts[i].devicesCount == 1) ? "" : "s");
         if (hosts->hosts[i].devicesCount > 0)
@@ -449,7 +618,7 @@ void printHosts(struct hostCol *hosts)
         {
             // List linked devices
 
-            printf("\t\t%i\t%i\t[%s]-->[%s]\n", j, hosts->hosts[i].linkedDevices[j].msap, hosts->hosts[i].linkedDevices[j].locPortName, hosts->hosts[i].linkedDevices[j].remPortId);
+            printf("\t\t%i\t%i\t[%s]-->[%s]\n", j, hosts->hosts[i].linkedDevices[j].msap, zstrGet(hosts->hosts[i].linkedDevices[j].locPortName), zstrGet(hosts->hosts[i].linkedDevices[j].remPortId));
         }
         printf("\n");
     }
@@ -461,7 +630,7 @@ void printLinks(struct linkCol *links)
     printf("***** Links *****\n");
     for (i = 0; i < links->count; i++)
     {
-        printf("a:HostId: %i[%s][%s], b:HostId: %i[%s][%s]\n", links->links[i].a.hostId, links->links[i].a.chassisId, links->links[i].a.portRef, links->links[i].b.hostId, links->links[i].b.chassisId, links->links[i].b.portRef);
+        printf("a:HostId: %i[%s][%s], b:HostId: %i[%s][%s]\n", links->links[i].a.hostId, zstrGet(links->links[i].a.chassisId), zstrGet(links->links[i].a.portRef), links->links[i].b.hostId, zstrGet(links->links[i].b.chassisId), zstrGet(links->links[i].b.portRef));
     }
 }
 
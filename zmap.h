@@ -41,6 +41,17 @@ struct padding
     double left;
 };
 
+/**
+ * Merge the hosts from several Zabbix servers into a single collection.
+ * A device seen by more than one server (matched by chassis ID, ignoring separators and case) becomes one host holding
+ * the interfaces and linked devices from every server. Hosts are renumbered so their IDs are unique across servers.
+ * Only hosts from the target server keep their Zabbix ID, as the map is published there.
+ * @param [in] cols     host collections, one per server. Emptied, as their hosts are moved into the result.
+ * @param [in] n        number of host collections
+ * @param [in] target   index of the collection from the server that the map is published to
+ * @return              merged host collection
+ * */
+struct hostCol mergeHostCols(struct hostCol *cols, int n, int target);
 void printHosts(struct hostCol *hosts);
 void printLinks(struct linkCol *links);
 struct hostLink *mapHosts(struct hostLink *hl, int phubs, int phosts);
@@ -0,0 +1,264 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+#include "zstr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ZSTR_STRIPES 64         // Parts of the table, each with its own lock, so threads interning at once rarely wait. Must be a power of 2.
+#define ZSTR_STRIPE_BITS 6      // Low bits of a handle giving its stripe. log2(ZSTR_STRIPES).
+#define ZSTR_BLOCK_SIZE 4096    // Strings per block of entries. Blocks never move, so strings can be read without the lock.
+#define ZSTR_BLOCK_MAX 1024     // Blocks of entries per stripe. Enough for 2^28 distinct strings.
+#define ZSTR_CHUNK_SIZE 65536   // Characters per chunk of string storage.
+#define ZSTR_TABLE_SIZE 256     // Initial size of the hash table of a stripe. Doubled when half full.
+#define ZSTR_UNKNOWN 0xffffffff // Chassis ID form not worked out yet.
+
+/**
+ * An interned string.
+ * */
+struct zstrEntry
+{
+    const char *str; /**< the string */
+    uint32_t len;    /**< length of the string */
+    uint32_t hash;   /**< hash of the string */
+    zstr lower;      /**< handle of the string without separators in lower case. ZSTR_UNKNOWN until asked for. */
+};
+
+/**
+ * Part of the string table. A string is held by the stripe picked by its hash, and its handle is its position in the stripe
+ * followed by the stripe number.
+ * */
+struct zstrStripe
+{
+    pthread_mutex_t lock;
+    uint32_t count;                           /**< strings held */
+    zstr *table;                              /**< hash table of handles, probed linearly. 0 marks a free slot, as "" is never looked up. */
+    uint32_t tableSize;
+    char *chunk;                              /**< chunk that new strings are copied into */
+    size_t chunkFree;                         /**< characters left in the chunk */
+    struct zstrEntry *blocks[ZSTR_BLOCK_MAX]; /**< blocks of entries */
+};
+
+static struct zstrStripe zstrStripes[ZSTR_STRIPES];
+static pthread_once_t zstrOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Set up the stripes. Position 0 of stripe 0 is left unused, being the handle of the empty string.
+ * */
+static void zstrInit()
+{
+    int i;
+    for (i = 0; i < ZSTR_STRIPES; i++)
+    {
+        pthread_mutex_init(&zstrStripes[i].lock, NULL);
+        zstrStripes[i].count = (i == 0) ? 1 : 0;
+    }
+}
+
+/**
+ * FNV-1a hash of a string.
+ * */
+static uint32_t zstrHash(const char *str, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct zstrEntry *zstrEntryOf(zstr s)
+{
+    uint32_t pos = s >> ZSTR_STRIPE_BITS;
+    return &zstrStripes[s & (ZSTR_STRIPES - 1)].blocks[pos / ZSTR_BLOCK_SIZE][pos % ZSTR_BLOCK_SIZE];
+}
+
+static void zstrOutOfMemory()
+{
+    fprintf(stderr, "Out of memory attempting to intern a string");
+    exit(1); // failure
+}
+
+/**
+ * Double the hash table of a stripe, or create it.
+ * */
+static void zstrGrowTable(struct zstrStripe *st)
+{
+    uint32_t size = (st->tableSize > 0) ? st->tableSize * 2 : ZSTR_TABLE_SIZE;
+    zstr *table = calloc(size, sizeof(zstr));
+    uint32_t i, j;
+
+    if (!table)
+        zstrOutOfMemory();
+    for (i = 0; i < st->tableSize; i++)
+    {
+        if (st->table[i] == 0)
+            continue;
+        for (j = (zstrEntryOf(st->table[i])->hash >> ZSTR_STRIPE_BITS) & (size - 1); table[j] != 0; j = (j + 1) & (size - 1))
+            ;
+        table[j] = st->table[i];
+    }
+    free(st->table);
+    st->table = table;
+    st->tableSize = size;
+}
+
+/**
+ * Copy a string into the string storage of a stripe.
+ * */
+static const char *zstrStore(struct zstrStripe *st, const char *str, size_t len)
+{
+    char *ret;
+
+    if (len + 1 > ZSTR_CHUNK_SIZE / 4)
+    {
+        // Long strings get their own memory rather than wasting the rest of a chunk.
+        ret = malloc(len + 1);
+        if (!ret)
+            zstrOutOfMemory();
+    }
+    else
+    {
+        if (len + 1 > st->chunkFree)
+        {
+            st->chunk = malloc(ZSTR_CHUNK_SIZE);
+            if (!st->chunk)
+                zstrOutOfMemory();
+            st->chunkFree = ZSTR_CHUNK_SIZE;
+        }
+        ret = st->chunk;
+        st->chunk += len + 1;
+        st->chunkFree -= len + 1;
+    }
+    memcpy(ret, str, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+zstr zstrInternLen(const char *str, size_t len)
+{
+    uint32_t hash;
+    uint32_t i;
+    struct zstrStripe *st;
+    struct zstrEntry *e;
+    uint32_t pos;
+    zstr s;
+
+    if (len == 0)
+        return 0;
+    pthread_once(&zstrOnce, zstrInit);
+    hash = zstrHash(str, len);
+    st = &zstrStripes[hash & (ZSTR_STRIPES - 1)];
+
+    pthread_mutex_lock(&st->lock);
+    if (st->count + 1 > st->tableSize / 2)
+        zstrGrowTable(st);
+    for (i = (hash >> ZSTR_STRIPE_BITS) & (st->tableSize - 1); st->table[i] != 0; i = (i + 1) & (st->tableSize - 1))
+    {
+        e = zstrEntryOf(st->table[i]);
+        if (e->hash == hash && e->len == len && memcmp(e->str, str, len) == 0)
+        {
+            s = st->table[i];
+            pthread_mutex_unlock(&st->lock);
+            return s;
+        }
+    }
+
+    // New string.
+    pos = st->count;
+    if (pos / ZSTR_BLOCK_SIZE >= ZSTR_BLOCK_MAX)
+        zstrOutOfMemory();
+    if (!st->blocks[pos / ZSTR_BLOCK_SIZE])
+    {
+        st->blocks[pos / ZSTR_BLOCK_SIZE] = malloc(ZSTR_BLOCK_SIZE * sizeof(struct zstrEntry));
+        if (!st->blocks[pos / ZSTR_BLOCK_SIZE])
+            zstrOutOfMemory();
+    }
+    s = (pos << ZSTR_STRIPE_BITS) | (hash & (ZSTR_STRIPES - 1));
+    e = zstrEntryOf(s);
+    e->str = zstrStore(st, str, len);
+    e->len = (uint32_t)len;
+    e->hash = hash;
+    e->lower = ZSTR_UNKNOWN;
+    st->table[i] = s;
+    st->count++;
+    pthread_mutex_unlock(&st->lock);
+    return s;
+}
+
+zstr zstrIntern(const char *str)
+{
+    return (str) ? zstrInternLen(str, strlen(str)) : 0;
+}
+
+const char *zstrGet(zstr s)
+{
+    return (s != 0) ? zstrEntryOf(s)->str : "";
+}
+
+/**
+ * Get the chassis ID form of a string, working it out the first time it is asked for.
+ * The stripe lock is not held while the form is interned, which may need the lock of another stripe.
+ * */
+zstr zstrStripLower(zstr s)
+{
+    struct zstrStripe *st = &zstrStripes[s & (ZSTR_STRIPES - 1)];
+    struct zstrEntry *e;
+    char buf[256];
+    char *tmp = buf;
+    uint32_t i, n = 0;
+    char c;
+    zstr ret;
+
+    if (s == 0)
+        return 0;
+    e = zstrEntryOf(s);
+    pthread_mutex_lock(&st->lock);
+    ret = e->lower;
+    pthread_mutex_unlock(&st->lock);
+    if (ret != ZSTR_UNKNOWN)
+        return ret;
+
+    if (e->len >= sizeof buf && !(tmp = malloc(e->len + 1)))
+        zstrOutOfMemory();
+    for (i = 0; i < e->len; i++)
+    {
+        c = e->str[i];
+        if (c == ' ' || c == ':' || c == '-')
+            continue;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        tmp[n++] = c;
+    }
+    ret = zstrInternLen(tmp, n);
+    if (tmp != buf)
+        free(tmp);
+
+    // Another thread working out the same form at the same time gets the same handle, so it does not matter which is kept.
+    pthread_mutex_lock(&st->lock);
+    e->lower = ret;
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
@@ -0,0 +1,76 @@
+/**********************************************************************
+ *
+ * Copyright (C) 2021 Craig Moore
+ *
+ * This file is part of zabbix-map.
+ *
+ * zabbix-map is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * zabbix-map is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with zabbix-map.  If not, see <https://www.gnu.org/licenses/>.
+ **********************************************************************/
+
+#ifndef ZSTR_HEADER
+#define ZSTR_HEADER
+/**
+ * Interned Strings.
+ *
+ * Every distinct string is stored once, for the life of the program, and referred to by a 32 bit handle. Two handles
+ * are equal exactly when their strings are, so names, chassis IDs and port references compare as integers.
+ * */
+
+/**
+ * \file zstr.h
+ * */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Handle of an interned string. 0 is the empty string, so a zeroed struct holds empty strings.
+ * */
+typedef uint32_t zstr;
+
+/**
+ * Intern a string.
+ * Thread safe.
+ * @param [in] str      string to intern. NULL is taken as the empty string.
+ * @return              handle of the string.
+ * */
+zstr zstrIntern(const char *str);
+
+/**
+ * Intern the first len characters of a string, which need not be terminated.
+ * Thread safe.
+ * @param [in] str      string to intern.
+ * @param [in] len      number of characters to intern.
+ * @return              handle of the string.
+ * */
+zstr zstrInternLen(const char *str, size_t len);
+
+/**
+ * Get an interned string. The string lives as long as the program and must not be changed.
+ * Thread safe.
+ * @param [in] s        handle of the string.
+ * @return              the string.
+ * */
+const char *zstrGet(zstr s);
+
+/**
+ * Get the chassis ID form of an interned string without separators (' ', ':' and '-') and in lower case, so that IDs differing only in case
+ * or separators match. e.g. "00:1A-2b" gives "001a2b".
+ * The result is remembered, so repeated calls for the same string are a lookup.
+ * Thread safe.
+ * @param [in] s        handle of the string.
+ * @return              handle of the string without separators in lower case.
+ * */
+zstr zstrStripLower(zstr s);
+#endif